@@ -0,0 +1,111 @@
+// A workload in phases, run against a plain BinaryTree and against
+// an AdaptiveTree: a bulk load in random order, read only point
+// lookups, a burst of updates (30% writes), then read mostly
+// lookups (2% writes).  For each phase it prints the mean time per
+// operation, the 99.9th percentile and the worst single operation
+// (the adaptive tree's migrations are meant not to show up there),
+// and what the adaptive tree ended the phase as.
+//
+// Usage: adaptivebench [entries] [ops per phase]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "tree_adaptive.hpp"
+
+using Clock = std::chrono::steady_clock;
+using Adaptive = AdaptiveTree<uint64_t, uint64_t>;
+
+struct Op
+{
+    enum Kind
+    {
+        get,
+        put,
+        erase
+    } kind;
+    uint64_t key;
+};
+
+static std::vector<Op> phase(std::mt19937_64 &rng, size_t ops, size_t entries, unsigned writes)
+{
+    std::vector<Op> out(ops);
+    for (auto &op : out)
+    {
+        op.key = rng() % (2 * entries);
+        op.kind = rng() % 100 >= writes ? Op::get : rng() % 2 ? Op::put : Op::erase;
+    }
+    return out;
+}
+
+static uint64_t sink;
+
+template <class Tree>
+static void run(const char *name, Tree &tree, const std::vector<Op> &ops)
+{
+    std::vector<double> took(ops.size());
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        auto start = Clock::now();
+        switch (ops[i].kind)
+        {
+        case Op::get:
+            if (const uint64_t *value = tree.get(ops[i].key))
+                sink += *value;
+            break;
+        case Op::put:
+            tree[ops[i].key] = i;
+            break;
+        case Op::erase:
+            tree.erase(ops[i].key);
+            break;
+        }
+        took[i] = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+    double total = std::accumulate(took.begin(), took.end(), 0.0);
+    std::sort(took.begin(), took.end());
+    std::printf("    %-9s %8.0f ns/op, 99.9%% %8.0f ns, worst %9.1f us\n", name, total / ops.size(),
+                took[ops.size() * 999 / 1000], took.back() / 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+    std::printf("entries=%zu ops per phase=%zu\n", entries, ops);
+
+    std::vector<uint64_t> keys(entries);
+    for (size_t i = 0; i < entries; i++)
+        keys[i] = 2 * i;
+    std::mt19937_64 rng(5);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    std::vector<Op> load(entries);
+    for (size_t i = 0; i < entries; i++)
+        load[i] = {Op::put, keys[i]};
+
+    struct
+    {
+        const char *name;
+        std::vector<Op> ops;
+    } phases[] = {{"bulk load", load},
+                  {"read only", phase(rng, ops, entries, 0)},
+                  {"updates", phase(rng, ops, entries, 30)},
+                  {"read mostly", phase(rng, ops, entries, 2)}};
+
+    BinaryTree<uint64_t, uint64_t> plain;
+    Adaptive adaptive;
+    for (auto &p : phases)
+    {
+        std::printf("  %s\n", p.name);
+        run("tree", plain, p.ops);
+        run("adaptive", adaptive, p.ops);
+        std::printf("              now %s (%s)\n", Adaptive::name(adaptive.representation()),
+                    adaptive.reason().c_str());
+    }
+    return sink == 42;
+}
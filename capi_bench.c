@@ -0,0 +1,95 @@
+/* Per operation cost of the C interface in tree_capi.h, one key
+   per call against whole arrays per call.
+
+   Usage: capibench [entries] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "tree_capi.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A cheap, repeatable shuffle of the keys. */
+static uint64_t mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static void report(const char *what, double start, size_t n)
+{
+    printf("  %-14s %8.1f ns/op\n", what, (now() - start) * 1e9 / n);
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    uint64_t *values = malloc(n * sizeof(uint64_t));
+    unsigned char *found = malloc(n);
+    double start;
+    size_t i, hits = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        keys[i] = mix(i + 1);
+        values[i] = i;
+    }
+    printf("entries=%zu\n", n);
+
+    tree_u64 *single = tree_u64_new();
+    start = now();
+    for (i = 0; i < n; i++)
+        tree_u64_put(single, keys[i], values[i]);
+    report("put", start, n);
+    start = now();
+    for (i = 0; i < n; i++)
+        hits += tree_u64_get(single, keys[i], &values[i]);
+    report("get", start, n);
+    start = now();
+    for (i = 0; i < n; i++)
+        tree_u64_delete(single, keys[i]);
+    report("delete", start, n);
+    tree_u64_free(single);
+
+    tree_u64 *batch = tree_u64_new();
+    start = now();
+    tree_u64_put_batch(batch, keys, values, n);
+    report("put_batch", start, n);
+    start = now();
+    hits += tree_u64_get_batch(batch, keys, values, found, n);
+    report("get_batch", start, n);
+
+    uint64_t chunk_keys[1024], chunk_values[1024];
+    size_t got, scanned = 0;
+    start = now();
+    tree_u64_cursor *cursor = tree_u64_cursor_open(batch, 0);
+    while ((got = tree_u64_cursor_next(cursor, chunk_keys, chunk_values, 1024)) > 0)
+        scanned += got;
+    tree_u64_cursor_close(cursor);
+    report("cursor scan", start, n);
+
+    start = now();
+    tree_u64_delete_batch(batch, keys, n);
+    report("delete_batch", start, n);
+    tree_u64_free(batch);
+
+    if (hits != 2 * n || scanned != n)
+    {
+        printf("unexpected results\n");
+        return 1;
+    }
+    free(keys);
+    free(values);
+    free(found);
+    return 0;
+}
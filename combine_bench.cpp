@@ -0,0 +1,89 @@
+// Throughput of a BinaryTree shared between threads, through a
+// plain mutex (LockedTree) and through flat combining
+// (CombiningTree), for a range of thread counts.  Each thread runs
+// a mix of 50% lookups, 25% assigns and 25% erases on random keys.
+//
+// Usage: combinebench [keys] [ops per thread]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include "tree_combining.hpp"
+
+// Runs threads workers, each doing ops operations through the
+// accessor that make(id) returns, and gives Mops/s.
+template <class Make>
+double run(int threads, size_t keys, size_t ops, Make make)
+{
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int id = 0; id < threads; id++)
+    {
+        workers.emplace_back([&, id]() {
+            auto &&tree = make();
+            std::mt19937_64 rng(id);
+            uint64_t hits = 0;
+            for (size_t i = 0; i < ops; i++)
+            {
+                uint64_t r = rng(), key = r % keys;
+                switch ((r >> 32) % 4)
+                {
+                case 0:
+                    tree.assign(key, r);
+                    break;
+                case 1:
+                    tree.erase(key);
+                    break;
+                default:
+                    hits += tree.contains(key);
+                }
+            }
+            if (hits == UINT64_MAX)
+                std::printf("impossible\n");
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    return threads * ops / took.count() / 1e6;
+}
+
+// Fills a tree with every other key, in random order.
+template <class Assign>
+void fill(size_t keys, Assign assign)
+{
+    std::vector<uint64_t> order;
+    for (uint64_t k = 0; k < keys; k += 2)
+        order.push_back(k);
+    std::shuffle(order.begin(), order.end(), std::mt19937_64{1});
+    for (auto k : order)
+        assign(k);
+}
+
+int main(int argc, char **argv)
+{
+    size_t keys = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t ops = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 200000;
+
+    std::printf("keys=%zu ops/thread=%zu hardware threads=%u\n", keys, ops, std::thread::hardware_concurrency());
+    std::printf("%8s %12s %12s   (Mops/s)\n", "threads", "mutex", "combining");
+    for (int threads : {1, 2, 4, 8, 16, 32})
+    {
+        LockedTree<uint64_t, uint64_t> locked;
+        fill(keys, [&](uint64_t k) { locked.assign(k, k); });
+        double a = run(threads, keys, ops, [&]() -> LockedTree<uint64_t, uint64_t> & { return locked; });
+
+        CombiningTree<uint64_t, uint64_t> combining(threads);
+        {
+            auto h = combining.handle();
+            fill(keys, [&](uint64_t k) { h.assign(k, k); });
+        }
+        double b = run(threads, keys, ops, [&]() { return combining.handle(); });
+        std::printf("%8d %12.2f %12.2f\n", threads, a, b);
+    }
+    return 0;
+}
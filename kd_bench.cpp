@@ -0,0 +1,97 @@
+// k-d tree queries against brute force scans over the same
+// points.  Points are uniform in the unit square; each box query
+// covers about 100 points, and each nearest neighbour query asks
+// for the 10 nearest.  Brute force runs fewer queries, since each
+// one reads every point.
+//
+// Usage: kdbench [points] [queries]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "tree_kd.hpp"
+
+using Point = std::array<double, 2>;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t queries = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000;
+    size_t brute_queries = std::max<size_t>(queries / 1000, 5);
+
+    std::mt19937_64 rng(3);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::vector<std::pair<Point, uint64_t>> points(n);
+    for (size_t i = 0; i < n; i++)
+        points[i] = {{unit(rng), unit(rng)}, i};
+
+    auto start = std::chrono::steady_clock::now();
+    KdTree<2, uint64_t> tree;
+    tree.build(points);
+    std::printf("points=%zu build: %.2f s\n", n, seconds_since(start));
+
+    double side = std::sqrt(100.0 / n);
+    std::vector<Point> centres(queries);
+    for (auto &c : centres)
+        c = {unit(rng), unit(rng)};
+
+    uint64_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (auto &c : centres)
+        tree.box({c[0], c[1]}, {c[0] + side, c[1] + side}, [&](const Point &, uint64_t) { found++; });
+    double tree_box = seconds_since(start) / queries;
+
+    uint64_t brute_found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < brute_queries; q++)
+    {
+        const Point &c = centres[q];
+        for (auto &[p, v] : points)
+            brute_found += p[0] >= c[0] && p[0] <= c[0] + side && p[1] >= c[1] && p[1] <= c[1] + side;
+    }
+    double brute_box = seconds_since(start) / brute_queries;
+    std::printf("box (avg %.0f hits):  kd %.2f us  brute %.0f us  (%.0fx)\n", double(found) / queries,
+                tree_box * 1e6, brute_box * 1e6, brute_box / tree_box);
+
+    start = std::chrono::steady_clock::now();
+    for (auto &c : centres)
+        found += tree.nearest(c, 10).size();
+    double tree_knn = seconds_since(start) / queries;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < brute_queries; q++)
+    {
+        const Point &c = centres[q];
+        std::vector<std::pair<double, uint64_t>> best;
+        for (auto &[p, v] : points)
+        {
+            double d = (p[0] - c[0]) * (p[0] - c[0]) + (p[1] - c[1]) * (p[1] - c[1]);
+            if (best.size() < 10 || d < best.front().first)
+            {
+                best.push_back({d, v});
+                std::push_heap(best.begin(), best.end());
+                if (best.size() > 10)
+                {
+                    std::pop_heap(best.begin(), best.end());
+                    best.pop_back();
+                }
+            }
+        }
+        brute_found += best.size();
+    }
+    double brute_knn = seconds_since(start) / brute_queries;
+    std::printf("10-nn:                kd %.2f us  brute %.0f us  (%.0fx)\n", tree_knn * 1e6, brute_knn * 1e6,
+                brute_knn / tree_knn);
+    return brute_found == UINT64_MAX;
+}
@@ -0,0 +1,88 @@
+// Memory and range scan throughput of a PackedKeyTree against the
+// plain sorted key and value arrays it replaces, and against the
+// BinaryTree it was frozen from.  Keys are millisecond timestamps
+// about a second apart, values are uint32_t; each scan sums the
+// keys and values of a random range of about span entries.
+//
+// Usage: packedbench [entries] [scans] [span]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "tree_packed.hpp"
+
+template <class Scan>
+double scan_rate(const std::vector<uint64_t> &starts, uint64_t width, Scan scan)
+{
+    uint64_t sum = 0, seen = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto lo : starts)
+        scan(lo, lo + width, [&](uint64_t k, uint32_t v) {
+            sum += k + v;
+            seen++;
+        });
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    if (sum == 1)
+        std::printf("impossible\n");
+    return seen / took.count() / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t scans = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000;
+    size_t span = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10000;
+
+    std::mt19937_64 rng(9);
+    std::vector<uint64_t> keys(entries);
+    std::vector<uint32_t> values(entries);
+    uint64_t key = 1700000000000;
+    for (size_t i = 0; i < entries; i++)
+    {
+        key += 900 + rng() % 200;
+        keys[i] = key;
+        values[i] = uint32_t(rng());
+    }
+    BinaryTree<uint64_t, uint32_t> tree;
+    std::vector<size_t> order(entries);
+    for (size_t i = 0; i < entries; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    for (auto i : order)
+        tree[keys[i]] = values[i];
+    PackedKeyTree<uint32_t> packed(tree);
+
+    std::vector<uint64_t> starts(scans);
+    for (auto &s : starts)
+        s = keys[rng() % entries];
+    uint64_t width = span * 1000;
+
+    std::printf("entries=%zu scans=%zu span=%zu\n", entries, scans, span);
+    std::printf("  keys, plain array:  %6.1f MB  %5.2f bytes/key\n", entries * 8 / 1e6, 8.0);
+    std::printf("  keys, packed:       %6.1f MB  %5.2f bytes/key\n", packed.key_bytes() / 1e6,
+                double(packed.key_bytes()) / entries);
+
+    std::printf("  scan, pointer tree: %7.1f M entries/s\n",
+                scan_rate(starts, width, [&](uint64_t lo, uint64_t hi, auto fn) {
+                    for (auto it = tree.lower_bound(lo); it != std::default_sentinel; ++it)
+                    {
+                        auto [k, v] = *it;
+                        if (k >= hi)
+                            break;
+                        fn(k, v);
+                    }
+                }));
+    std::printf("  scan, plain arrays: %7.1f M entries/s\n",
+                scan_rate(starts, width, [&](uint64_t lo, uint64_t hi, auto fn) {
+                    size_t i = std::lower_bound(keys.begin(), keys.end(), lo) - keys.begin();
+                    for (; i < entries && keys[i] < hi; i++)
+                        fn(keys[i], values[i]);
+                }));
+    std::printf("  scan, packed:       %7.1f M entries/s\n",
+                scan_rate(starts, width, [&](uint64_t lo, uint64_t hi, auto fn) { packed.scan(lo, hi, fn); }));
+    return 0;
+}
@@ -0,0 +1,67 @@
+// A BinaryTree against a PmaTree on a mixed workload: a batch of
+// random inserts and erases, then a full scan, over and over.
+// Keys and values are uint64_t; the key space is twice the
+// starting size, so the map stays about the same size.
+//
+// Usage: pmabench [entries] [rounds] [updates per round]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "tree.hpp"
+#include "tree_pma.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+template <class Map>
+void run(const char *name, size_t entries, size_t rounds, size_t updates)
+{
+    Map map;
+    std::mt19937_64 rng(8);
+    auto start = Clock::now();
+    for (size_t i = 0; i < entries; i++)
+        map[rng() % (2 * entries)] = i;
+    std::chrono::duration<double> build = Clock::now() - start;
+
+    std::chrono::duration<double> updating{0}, scanning{0};
+    uint64_t sum = 0, scanned = 0;
+    for (size_t r = 0; r < rounds; r++)
+    {
+        start = Clock::now();
+        for (size_t i = 0; i < updates; i++)
+        {
+            uint64_t k = rng() % (2 * entries);
+            if (i % 2)
+                map[k] = i;
+            else
+                map.erase(k);
+        }
+        auto mid = Clock::now();
+        for (auto [key, value] : map)
+        {
+            sum += key + value;
+            scanned++;
+        }
+        updating += mid - start;
+        scanning += Clock::now() - mid;
+    }
+    if (sum == 1)
+        std::printf("impossible\n");
+    std::printf("  %-12s build %6.0f ns/insert  updates %6.0f ns/op  scan %7.1f M entries/s\n", name,
+                build.count() * 1e9 / entries, updating.count() * 1e9 / (rounds * updates),
+                scanned / scanning.count() / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    size_t rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10;
+    size_t updates = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100000;
+
+    std::printf("entries=%zu rounds=%zu updates=%zu\n", entries, rounds, updates);
+    run<BinaryTree<uint64_t, uint64_t>>("BinaryTree", entries, rounds, updates);
+    run<PmaTree<uint64_t, uint64_t>>("PmaTree", entries, rounds, updates);
+    return 0;
+}
@@ -0,0 +1,70 @@
+// How long the caller is held up getting rid of a big tree: the
+// plain destructor against retiring it to a BinaryTreeReclaimer,
+// and how long each reclaim(budget) slice then takes.  Keys are
+// uint64_t inserted in random order, values short std::strings
+// (so every node has a destructor to run).
+//
+// Usage: reclaimbench [entries] [budget]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_reclaim.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static std::unique_ptr<BinaryTree<uint64_t, std::string>> build(const std::vector<uint64_t> &keys)
+{
+    auto tree = std::make_unique<BinaryTree<uint64_t, std::string>>();
+    for (auto k : keys)
+        (*tree)[k] = "value";
+    return tree;
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000000;
+    size_t budget = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 10000;
+
+    std::vector<uint64_t> keys(entries);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(3));
+    std::printf("entries=%zu budget=%zu\n", entries, budget);
+
+    auto tree = build(keys);
+    auto start = Clock::now();
+    tree.reset();
+    std::chrono::duration<double> destroy = Clock::now() - start;
+    std::printf("  destructor:        %9.1f ms\n", destroy.count() * 1e3);
+
+    tree = build(keys);
+    BinaryTreeReclaimer<uint64_t, std::string> reclaimer;
+    start = Clock::now();
+    reclaimer.retire(std::move(*tree));
+    std::chrono::duration<double> retire = Clock::now() - start;
+    std::printf("  retire:            %9.1f us\n", retire.count() * 1e6);
+
+    std::vector<double> slices;
+    while (true)
+    {
+        start = Clock::now();
+        size_t done = reclaimer.reclaim(budget);
+        std::chrono::duration<double> took = Clock::now() - start;
+        slices.push_back(took.count() * 1e6);
+        if (done < budget)
+            break;
+    }
+    double total = std::accumulate(slices.begin(), slices.end(), 0.0);
+    std::sort(slices.begin(), slices.end());
+    std::printf("  reclaim slices:    %9zu, median %.1f us, 99%% %.1f us, worst %.1f us, total %.1f ms\n",
+                slices.size(), slices[slices.size() / 2], slices[slices.size() * 99 / 100], slices.back(),
+                total / 1e3);
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Memory and lookup latency of a frozen SuccinctTree against the
+// BinaryTree it was frozen from (and the same tree after
+// compact(), for reference).  Keys and values are uint64_t, keys
+// inserted in random order, lookups at random keys that are all
+// present.
+//
+// Usage: succinctbench [entries] [lookups]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "tree_succinct.hpp"
+
+template <class Get>
+double lookup_ns(const std::vector<uint64_t> &probes, Get get)
+{
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto k : probes)
+        sum += *get(k);
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    if (sum == 1)
+        std::printf("impossible\n");
+    return took.count() * 1e9 / probes.size();
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t lookups = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000000;
+
+    std::vector<uint64_t> keys(entries);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::mt19937_64 rng(5);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    BinaryTree<uint64_t, uint64_t> tree;
+    for (auto k : keys)
+        tree[k * 3] = k;
+    std::vector<uint64_t> probes(lookups);
+    for (auto &p : probes)
+        p = rng() % entries * 3;
+
+    SuccinctTree<uint64_t, uint64_t> frozen(tree);
+    size_t pointer_bytes = entries * sizeof(BinaryTreeNode<uint64_t, uint64_t>);
+    std::printf("entries=%zu\n", entries);
+    std::printf("  pointer tree:   %6.1f MB  %5.1f bytes/entry\n", pointer_bytes / 1e6, double(pointer_bytes) / entries);
+    std::printf("  succinct tree:  %6.1f MB  %5.1f bytes/entry (shape %.2f bits/entry)\n", frozen.memory_bytes() / 1e6,
+                double(frozen.memory_bytes()) / entries, 8.0 * frozen.shape_bytes() / entries);
+
+    std::printf("  lookup, pointer tree:           %5.0f ns\n", lookup_ns(probes, [&](uint64_t k) { return tree.get(k); }));
+    std::printf("  lookup, succinct tree:          %5.0f ns\n", lookup_ns(probes, [&](uint64_t k) { return frozen.get(k); }));
+    tree.compact(BinaryTreeLayout::van_emde_boas);
+    std::printf("  lookup, pointer tree (vEB):     %5.0f ns\n", lookup_ns(probes, [&](uint64_t k) { return tree.get(k); }));
+    return 0;
+}
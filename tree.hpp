@@ -5,26 +5,211 @@
 // high level functionality as std::map, that is, a key/value
 // data store with a sorted order
 
+#ifndef TREE_HPP
+#define TREE_HPP
+
 // We need to include the following headers...
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 #include <memory>
-#include <stack>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 //#define HERE {std::cout << "IMPLEMENT HERE\n";}
 
+// When this is on, every tree keeps a count of the times keys
+// were added or removed, and iterators check it hasn't moved
+// since they were created, throwing rather than walking freed
+// nodes.  It is on in debug builds (and hardened builds that
+// define TREE_HARDENED), and off otherwise, where it costs
+// nothing at all.  Define it to 0 or 1 yourself to override.
+#ifndef TREE_CHECK_ITERATORS
+#if !defined(NDEBUG) || defined(TREE_HARDENED)
+#define TREE_CHECK_ITERATORS 1
+#else
+#define TREE_CHECK_ITERATORS 0
+#endif
+#endif
+
+// The iterator prefetches the right child of every node it
+// pushes on its path, so that by the time the walk comes back
+// up and goes right the node is already on its way into the
+// cache.  Define TREE_PREFETCH to 0 to turn that off.
+#ifndef TREE_PREFETCH
+#define TREE_PREFETCH 1
+#endif
+
+inline void tree_prefetch(const void *address)
+{
+#if TREE_PREFETCH && defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+// Each node can keep a small summary of its key, a prefix,
+// that orders the same way as the key whenever two prefixes
+// differ.  Searches compare the prefixes first and only look at
+// the keys themselves on a tie.  For most key types there is no
+// prefix: the type is empty, and [[no_unique_address]] means it
+// takes no room in the node.
+template <class K>
+struct BinaryTreeKeyPrefix
+{
+    struct type
+    {
+    };
+    static type of(const K &)
+    {
+        return {};
+    }
+    static int compare(type, type)
+    {
+        return 0;
+    }
+};
+
+// For strings the prefix is the first 8 bytes, big-endian and
+// padded with zeros, so comparing it as an integer orders like
+// comparing the bytes.  Most steps of a descent are then decided
+// without touching the string's heap buffer.
+template <>
+struct BinaryTreeKeyPrefix<std::string>
+{
+    using type = uint64_t;
+    static type of(const std::string &key)
+    {
+        uint64_t prefix = 0;
+        size_t n = std::min<size_t>(key.size(), 8);
+        for (size_t i = 0; i < n; i++)
+            prefix |= uint64_t((unsigned char)key[i]) << (56 - 8 * i);
+        return prefix;
+    }
+    static int compare(type a, type b)
+    {
+        return (a > b) - (a < b);
+    }
+};
+
 // C++ require declaration before use, so we define
-// our three classes here.
+// our classes here.
 template <class K, class V>
 class BinaryTree;
 template <class K, class V>
 class BinaryTreeIterator;
 template <class K, class V>
 class BinaryTreeNode;
+template <class K, class V>
+class BinaryTreeNodePool;
+template <class K, class V>
+class BinaryTreeReclaimer;
 
-// This iterator is returned for both start and
-// end but only the start iterator matters, the end 
-// iterator is effectively ignored.
+// The order compact() lays the nodes out in.  Depth first
+// puts each node right before its left subtree, so both a
+// descent to the left and an in-order walk mostly move forward
+// through memory.  Van Emde Boas recursively packs the top half
+// of the tree's height together, then each bottom subtree, which
+// keeps lookups within a few cache lines per group of levels
+// no matter how big the tree is.
+enum class BinaryTreeLayout
+{
+    depth_first,
+    van_emde_boas
+};
+
+// The iterator's path.  A vector would make every copy of an
+// iterator (postfix ++, ranges adaptors, passing one by value) a
+// heap allocation, so the first N entries live inline and only
+// paths deeper than that, in trees that have grown lopsided,
+// spill onto the heap.  Copies only copy the entries in use.
+template <class T, size_t N>
+class BinaryTreeSmallStack
+{
+public:
+    BinaryTreeSmallStack() : count(0)
+    {
+    }
+    BinaryTreeSmallStack(const BinaryTreeSmallStack &other) : count(other.count), spill(other.spill)
+    {
+        std::copy(other.items, other.items + std::min(count, N), items);
+    }
+    BinaryTreeSmallStack(BinaryTreeSmallStack &&other) noexcept : count(other.count), spill(std::move(other.spill))
+    {
+        std::copy(other.items, other.items + std::min(count, N), items);
+    }
+    BinaryTreeSmallStack &operator=(const BinaryTreeSmallStack &other)
+    {
+        count = other.count;
+        spill = other.spill;
+        std::copy(other.items, other.items + std::min(count, N), items);
+        return *this;
+    }
+    BinaryTreeSmallStack &operator=(BinaryTreeSmallStack &&other) noexcept
+    {
+        count = other.count;
+        spill = std::move(other.spill);
+        std::copy(other.items, other.items + std::min(count, N), items);
+        return *this;
+    }
+
+    void push_back(T item)
+    {
+        if (count < N)
+            items[count] = item;
+        else
+            spill.push_back(item);
+        count++;
+    }
+    void pop_back()
+    {
+        if (--count >= N)
+            spill.pop_back();
+    }
+    T back() const
+    {
+        return count > N ? spill.back() : items[count - 1];
+    }
+    bool empty() const
+    {
+        return count == 0;
+    }
+    size_t size() const
+    {
+        return count;
+    }
+    // Cuts the stack back to its first n entries.
+    void resize(size_t n)
+    {
+        count = n;
+        spill.resize(n > N ? n - N : 0);
+    }
+
+private:
+    size_t count;
+    T items[N];
+    std::vector<T> spill;
+};
+
+// The iterator walks the tree in order, keeping the path from
+// the root down to the node it is on.  That path is what lets
+// it go both forwards and backwards.  Dereferencing it gives a
+// pair of references to the node's key and value, so nothing is
+// copied and the value can be changed in place.
+//
+// begin() hands out one of these, while end() is just a
+// std::default_sentinel_t: an iterator is at the end once its
+// path is empty, so there is nothing to build for the end.  This
+// makes the tree a proper C++20 bidirectional range, so std::ranges
+// algorithms and views (take, filter, transform...) work on it.
 
 // It is considered "undefined behavior" (that is,
 // things are allowed to crash in obscure ways if)
@@ -37,98 +222,182 @@ class BinaryTreeNode;
 // the data associated with keys using the iterator in a 
 // for loop, but it is not OK to
 // add new keys or remove keys)
+
+// With TREE_CHECK_ITERATORS on, B is caught and reported
+// as a std::logic_error.  To remove entries as you go use
+// BinaryTree::erase_if instead of a loop.
 template <class K, class V>
-class BinaryTreeIterator : public std::input_iterator_tag
+class BinaryTreeIterator
 {
     friend class BinaryTree<K, V>;
 
-    // The constructor.  For end you don't actually
-    // need to do anything (the end is effectively a dummy).
-    // For the start iterator, you should set current to root
-    // and then call incr() so that the iterator is ready to 
-    // actually start the traversal
-    BinaryTreeIterator(BinaryTreeNode<K, V> *root, bool start)
+    // The constructor.  For the start iterator we walk
+    // down the left hand side to the smallest key; otherwise
+    // the path stays empty, which is the end.
+    BinaryTreeIterator(BinaryTreeNode<K, V> *root, bool start) : root(root)
     {
-        (void) root; (void) start;
-        current = nullptr;
         if (start && root)
         {
-            current = root;
-            incr();
+            descend(root, &BinaryTreeNode<K, V>::left, &BinaryTreeNode<K, V>::right);
         }
     }
 
 public:
-    // This should return TRUE if there is still
-    // items left in the iteration:
-    // Basically, check to see if the stack is empty
-    // and current is null, and, if not, there is 
-    // still more work to do...
-    bool operator!=(BinaryTreeIterator<K, V> &other)
+    using iterator_concept = std::bidirectional_iterator_tag;
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<K, V>;
+    using reference = std::pair<const K &, V &>;
+    using difference_type = std::ptrdiff_t;
+
+    // An iterator that isn't on any tree.  Only here because
+    // the standard iterator concepts want one.
+    BinaryTreeIterator() : root(nullptr)
+    {
+    }
+
+    bool operator==(const BinaryTreeIterator<K, V> &other) const
     {
-        (void)other;
-        bool curEnd = (current == nullptr && working_stack.empty());
-        bool otherEnd = (other.current == nullptr && other.working_stack.empty());
-        return !(curEnd && otherEnd);
+        return node() == other.node();
+    }
+    bool operator==(std::default_sentinel_t) const
+    {
+        return path.empty();
     }
 
     // This is the heart of the tree traversal algorithm.
-    // It needs to be called once in the constructor and 
-    // once by each invocation of the ++ operator.
     // The idea in english...
     //
-    // While current is not null, push the current
-    // pointer onto the stack and take current->left 
-    // and make it the new current.
-    // 
-    // Once current is null, then take the top of the stack
-    // and set it to current...
+    // If the current node has a right subtree, the next
+    // node is the leftmost one in it: step right, then keep
+    // going left, pushing every node on the way.
+    //
+    // If it doesn't, pop back up the path until we come up out
+    // of a left child: that parent is the next node.  If we run
+    // out of path, we were on the last node and are now at the end.
     void incr()
     {
-        while (current != nullptr)
+        step(&BinaryTreeNode<K, V>::right, &BinaryTreeNode<K, V>::left);
+    }
+
+    // And the same thing in the mirror, for going backwards.
+    // Stepping back from the end goes to the last node.
+    void decr()
     {
-        working_stack.push(current);
-        current = current->left;
+        if (path.empty())
+        {
+            if (root)
+                descend(root, &BinaryTreeNode<K, V>::right, &BinaryTreeNode<K, V>::left);
+            return;
+        }
+        step(&BinaryTreeNode<K, V>::left, &BinaryTreeNode<K, V>::right);
     }
 
-    if (!working_stack.empty())
+    BinaryTreeIterator<K, V> &operator++()
     {
-        current = working_stack.top();
-        working_stack.pop();
+        check();
+        incr();
+        return *this;
     }
-    else
+    BinaryTreeIterator<K, V> operator++(int)
     {
-        current = nullptr;
+        BinaryTreeIterator<K, V> was = *this;
+        ++*this;
+        return was;
     }
+    BinaryTreeIterator<K, V> &operator--()
+    {
+        check();
+        decr();
+        return *this;
     }
-
-    // This should just call incr
-    void operator++()
+    BinaryTreeIterator<K, V> operator--(int)
     {
-        incr();
+        BinaryTreeIterator<K, V> was = *this;
+        --*this;
+        return was;
     }
 
-    // And this visits the node itself...
-    // In visiting the node, it should 
-    // both set current to be the current node's right
-    // and then return a pair constructed from the old 
-    // current node's key and value.
-    std::pair<K, V> operator*()
+    // And this visits the node itself, returning references
+    // to its key and value.
+    reference operator*() const
     {
-        if (current)
+        check();
+        if (!path.empty())
         {
-            return std::make_pair(current->key, current->value);
+            BinaryTreeNode<K, V> *visit = path.back();
+            return reference(visit->key, visit->value);
         }
         throw std::logic_error("Dereference of an invalid iterator");
     }
 
 private:
-    // A pointer to the current node
-    BinaryTreeNode<K, V> *current;
+    // The node we are on, or null at the end.
+    BinaryTreeNode<K, V> *node() const
+    {
+        return path.empty() ? nullptr : path.back();
+    }
 
-    // And a stack for the traversal visit of the tree
-    // nodes.
-    std::stack<BinaryTreeNode<K, V> *> working_stack;
+    // Pushes node and then follows the given link (left or
+    // right) all the way down, pushing each node on the way.
+    // We'll come back to each of them later and cross their
+    // other link, so that is prefetched as we go.
+    void descend(BinaryTreeNode<K, V> *node, BinaryTreeNode<K, V> *BinaryTreeNode<K, V>::*link,
+                 BinaryTreeNode<K, V> *BinaryTreeNode<K, V>::*other)
+    {
+        while (node)
+        {
+            tree_prefetch(node->*other);
+            path.push_back(node);
+            node = node->*link;
+        }
+    }
+
+    // One step of the in-order walk.  forward is the link we
+    // move across (right when going forwards) and back the one
+    // we then follow down (left when going forwards).
+    void step(BinaryTreeNode<K, V> *BinaryTreeNode<K, V>::*forward,
+              BinaryTreeNode<K, V> *BinaryTreeNode<K, V>::*back)
+    {
+        if (path.empty())
+            return;
+        BinaryTreeNode<K, V> *node = path.back();
+        if (node->*forward)
+        {
+            descend(node->*forward, back, forward);
+            return;
+        }
+        path.pop_back();
+        while (!path.empty() && path.back()->*forward == node)
+        {
+            node = path.back();
+            path.pop_back();
+        }
+    }
+
+    // Throws if the tree has had keys added or removed since
+    // this iterator was made.
+    void check() const
+    {
+#if TREE_CHECK_ITERATORS
+        if (tree_mods && *tree_mods != seen_mods)
+            throw std::logic_error("Tree modified during iteration");
+#endif
+    }
+
+    // The root of the tree, for stepping back from the end.
+    BinaryTreeNode<K, V> *root;
+
+    // And the path from the root down to the current node,
+    // which is empty at the end.  40 levels covers a balanced
+    // tree of any size that fits in memory without allocating.
+    BinaryTreeSmallStack<BinaryTreeNode<K, V> *, 40> path;
+
+#if TREE_CHECK_ITERATORS
+    // The owning tree's modification count, and its value
+    // when we were created.
+    const size_t *tree_mods = nullptr;
+    size_t seen_mods = 0;
+#endif
 };
 
 
@@ -136,11 +405,35 @@ private:
 template <class K, class V>
 class BinaryTree
 {
+    // Takes trees apart a slice at a time (see tree_reclaim.hpp).
+    friend class BinaryTreeReclaimer<K, V>;
+
 public:
     BinaryTree() : root(nullptr)
     {
     }
-    
+
+    // A tree owns its nodes, so a copy would end up freeing
+    // them twice.  Moving is fine though: the moved-from tree
+    // is simply left empty (or holding our old nodes, which
+    // its own destructor will clean up).
+    BinaryTree(const BinaryTree &) = delete;
+    BinaryTree &operator=(const BinaryTree &) = delete;
+    BinaryTree(BinaryTree &&other) noexcept : root(other.root)
+    {
+        other.root = nullptr;
+        pool.swap(other.pool);
+        other.modified();
+    }
+    BinaryTree &operator=(BinaryTree &&other) noexcept
+    {
+        std::swap(root, other.root);
+        pool.swap(other.pool);
+        modified();
+        other.modified();
+        return *this;
+    }
+
     // The [] operation is for both getting and setting.
     // If the key exists in the tree a reference to the
     // associated value is returned.  Otherwise, it will
@@ -153,11 +446,20 @@ public:
     // a reference.
     V &operator[](const K &key)
     {
+        [[maybe_unused]] size_t before = pool.size();
         if (!root)
         {
-            root = new BinaryTreeNode<K, V>(key);
+            root = pool.create(key);
         }
-        return root->find(key);
+        V &value = root->find(key, BinaryTreeKeyPrefix<K>::of(key), pool);
+        note_changes(before);
+        return value;
+    }
+
+    // How many keys are in the tree.
+    size_t size() const
+    {
+        return pool.size();
     }
 
     // This should return false if the tree
@@ -169,7 +471,26 @@ public:
         {
         return false;
         }
-        else return root->contains(key);
+        else return root->contains(key, BinaryTreeKeyPrefix<K>::of(key));
+    }
+
+    // A pointer to the value for key, or null if it isn't there.
+    // Unlike [] this never adds the key.
+    V *get(const K &key)
+    {
+        auto prefix = BinaryTreeKeyPrefix<K>::of(key);
+        BinaryTreeNode<K, V> *node = root;
+        while (node)
+        {
+            int order = node->order(key, prefix);
+            if (order < 0)
+                node = node->left;
+            else if (order > 0)
+                node = node->right;
+            else
+                return &node->value;
+        }
+        return nullptr;
     }
 
     // Erases a node if a key matches.  If the
@@ -178,8 +499,220 @@ public:
     void erase(const K &key)
     {
         (void) key;
+        [[maybe_unused]] size_t before = pool.size();
         if (root)
-        root = root->erase(key);
+        root = root->erase(key, BinaryTreeKeyPrefix<K>::of(key), pool);
+        note_changes(before);
+    }
+
+    // The iterate-and-purge loop: visits every entry in order
+    // and removes the ones fn(key, value) returns true for.  fn may
+    // also change the value of the entries it keeps.  Erasing from
+    // inside a normal iteration isn't allowed, and restarting the
+    // iteration after every erase is quadratic, whereas this is
+    // a single O(N) pass.  The survivors are relinked into a
+    // balanced shape as a bonus.  Returns how many were removed.
+    template <class F>
+    size_t erase_if(F fn)
+    {
+        std::vector<BinaryTreeNode<K, V> *> keep, drop;
+        for (BinaryTreeIterator<K, V> walk(root, true); walk != std::default_sentinel; walk.incr())
+        {
+            BinaryTreeNode<K, V> *node = walk.node();
+            if (fn(static_cast<const K &>(node->key), node->value))
+                drop.push_back(node);
+            else
+                keep.push_back(node);
+        }
+        if (drop.empty())
+            return 0;
+        for (auto *node : drop)
+            pool.destroy(node);
+        root = relink(keep, 0, keep.size());
+        modified();
+        return drop.size();
+    }
+
+    // Applies a whole batch of changes in one go.  The batch is a
+    // range of (key, optional value) pairs sorted by key, with at
+    // most one entry per key: a value means set the key to it,
+    // an empty optional means erase the key.
+    //
+    // Rather than one descent from the root per change, the batch
+    // is split around each node's key on the way down, so every
+    // node is visited at most once and the top of the tree is only
+    // read once for the whole batch.  Runs of new keys that land
+    // in an empty spot are built into a balanced subtree directly.
+    template <class It>
+    void apply_sorted(It first, It last)
+    {
+        bool reshaped = false;
+        root = merge(root, first, last, reshaped);
+        if (reshaped)
+            modified();
+    }
+
+    // Writes the whole tree out in key order as two plain arrays
+    // (structure of arrays), keys_out[i] and values_out[i], which
+    // must each have room for size() elements.  Returns size().
+    //
+    // Small trees are written by one in-order walk.  Big ones are
+    // cut into a few dozen subtrees (plus the nodes between them)
+    // which are first counted and then written out in parallel,
+    // each straight into its own slice of the arrays.  threads
+    // defaults to one per core.
+    size_t export_columns(K *keys_out, V *values_out, unsigned threads = 0)
+    {
+        if (!threads)
+            threads = std::thread::hardware_concurrency();
+        if (size() < parallel_export_size || threads < 2)
+            return export_subtree(root, keys_out, values_out);
+
+        // Split the tree, in order, into subtrees and single nodes,
+        // a level at a time until there are enough pieces.
+        struct Part
+        {
+            BinaryTreeNode<K, V> *node;
+            bool whole;
+            size_t offset;
+        };
+        std::vector<Part> parts{{root, true, 0}};
+        while (parts.size() < 8 * threads)
+        {
+            std::vector<Part> split;
+            for (auto &part : parts)
+            {
+                if (!part.whole)
+                {
+                    split.push_back(part);
+                    continue;
+                }
+                if (part.node->left)
+                    split.push_back({part.node->left, true, 0});
+                split.push_back({part.node, false, 0});
+                if (part.node->right)
+                    split.push_back({part.node->right, true, 0});
+            }
+            if (split.size() == parts.size())
+                break;
+            parts.swap(split);
+        }
+
+        std::vector<size_t> counts(parts.size(), 1);
+        parallel_for(parts.size(), threads, [&](size_t i) {
+            if (parts[i].whole)
+                counts[i] = count_subtree(parts[i].node);
+        });
+        size_t offset = 0;
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            parts[i].offset = offset;
+            offset += counts[i];
+        }
+        parallel_for(parts.size(), threads, [&](size_t i) {
+            const Part &part = parts[i];
+            if (part.whole)
+            {
+                export_subtree(part.node, keys_out + part.offset, values_out + part.offset);
+            }
+            else
+            {
+                keys_out[part.offset] = part.node->key;
+                values_out[part.offset] = part.node->value;
+            }
+        });
+        return offset;
+    }
+
+    // The same, but only for the keys in [lo, hi).  Use
+    // count_range(lo, hi) to find out how much room that needs.
+    size_t export_columns(K *keys_out, V *values_out, const K &lo, const K &hi)
+    {
+        size_t count = 0;
+        for (auto it = lower_bound(lo); it != end(); ++it)
+        {
+            BinaryTreeNode<K, V> *node = it.node();
+            if (!(node->key < hi))
+                break;
+            keys_out[count] = node->key;
+            values_out[count] = node->value;
+            count++;
+        }
+        return count;
+    }
+
+    // How many keys are in [lo, hi).
+    size_t count_range(const K &lo, const K &hi)
+    {
+        size_t count = 0;
+        for (auto it = lower_bound(lo); it != end() && (*it).first < hi; ++it)
+            count++;
+        return count;
+    }
+
+    // After lots of random inserts and erases the nodes end up
+    // scattered all over the pool, so both lookups and iteration
+    // jump around memory.  This copies every node into one fresh
+    // contiguous block in the given layout, patches the links and
+    // then frees all of the old memory in one go.  The contents of
+    // the tree don't change, but any iterators do become invalid.
+    //
+    // The copy works in two passes.  First we decide the order the
+    // nodes go in, then we copy each one across and leave a
+    // forwarding pointer to the copy in the old node's left link.
+    // Once every node has been copied the new nodes' links, which
+    // still point at old nodes, are patched through those forwarding
+    // pointers.
+    void compact(BinaryTreeLayout layout = BinaryTreeLayout::depth_first)
+    {
+        if (!root)
+            return;
+        std::vector<BinaryTreeNode<K, V> *> order;
+        if (layout == BinaryTreeLayout::depth_first)
+        {
+            std::vector<BinaryTreeNode<K, V> *> todo{root};
+            while (!todo.empty())
+            {
+                BinaryTreeNode<K, V> *node = todo.back();
+                todo.pop_back();
+                order.push_back(node);
+                if (node->right)
+                    todo.push_back(node->right);
+                if (node->left)
+                    todo.push_back(node->left);
+            }
+        }
+        else
+        {
+            std::vector<BinaryTreeNode<K, V> *> fringe;
+            veb_order(root, height(), order, fringe);
+        }
+
+        BinaryTreeNodePool<K, V> fresh;
+        fresh.reserve(order.size());
+        std::vector<BinaryTreeNode<K, V> *> copies;
+        copies.reserve(order.size());
+        for (auto *node : order)
+        {
+            auto *copy = fresh.create(std::move(node->key));
+            copy->value = std::move(node->value);
+            copy->left = node->left;
+            copy->right = node->right;
+            node->left = copy;
+            copies.push_back(copy);
+        }
+        for (auto *copy : copies)
+        {
+            if (copy->left)
+                copy->left = copy->left->left;
+            if (copy->right)
+                copy->right = copy->right->left;
+        }
+        root = root->left;
+        for (auto *node : order)
+            pool.destroy(node);
+        pool.swap(fresh);
+        modified();
     }
 
     // And the destructor for the binary tree.
@@ -187,26 +720,303 @@ public:
     // the C++ "RAII" convention, it should see
     // if there is a root and, if so, call freetree()
     // on the root.
+    //
+    // When neither keys nor values need destroying there is nothing
+    // to do node by node, and the pool just frees its chunks.
     ~BinaryTree()
     {
-        if (root)
-    {
-        root->freetree();
-    }
+        if constexpr (!std::is_trivially_destructible_v<K> || !std::is_trivially_destructible_v<V>)
+        {
+            if (root)
+                root->freetree(pool);
+        }
     }
 
-    // This returns the iterators.
+    // This returns the iterators.  end() is only a sentinel
+    // that the iterator compares equal to once it runs off the
+    // end; iterator_end() is a real iterator at the end, for
+    // code that needs one (such as walking backwards from it).
     BinaryTreeIterator<K, V> begin()
     {
-        return BinaryTreeIterator(root, true);
+        return watched(BinaryTreeIterator<K, V>(root, true));
+    }
+    std::default_sentinel_t end()
+    {
+        return std::default_sentinel;
     }
-    BinaryTreeIterator<K, V> end()
+    BinaryTreeIterator<K, V> iterator_end()
     {
-        return BinaryTreeIterator(root, false);
+        return watched(BinaryTreeIterator<K, V>(root, false));
+    }
+
+    // An iterator at the first key that is not less than key (or
+    // at the end if there isn't one), for range scans.  The search
+    // path down to it is exactly the path the iterator keeps, so
+    // we record the whole descent and cut it back to that node.
+    BinaryTreeIterator<K, V> lower_bound(const K &key)
+    {
+        BinaryTreeIterator<K, V> it(root, false);
+        size_t keep = 0;
+        auto prefix = BinaryTreeKeyPrefix<K>::of(key);
+        BinaryTreeNode<K, V> *node = root;
+        while (node)
+        {
+            it.path.push_back(node);
+            int order = node->order(key, prefix);
+            if (order > 0)
+            {
+                node = node->right;
+            }
+            else
+            {
+                keep = it.path.size();
+                if (order == 0)
+                    break;
+                node = node->left;
+            }
+        }
+        it.path.resize(keep);
+        return watched(std::move(it));
     }
 
 protected:
+    // For subclasses that arrange the nodes in their own order
+    // (and so can't use the search methods), while still getting
+    // the pool, the iterator and the teardown from here.
+    static K &key_of(BinaryTreeNode<K, V> *node)
+    {
+        return node->key;
+    }
+    static V &value_of(BinaryTreeNode<K, V> *node)
+    {
+        return node->value;
+    }
+    static BinaryTreeNode<K, V> *&left_of(BinaryTreeNode<K, V> *node)
+    {
+        return node->left;
+    }
+    static BinaryTreeNode<K, V> *&right_of(BinaryTreeNode<K, V> *node)
+    {
+        return node->right;
+    }
+
+    // Trees smaller than this are exported by a single thread.
+    static constexpr size_t parallel_export_size = 1 << 16;
+
+    // Runs fn(0) .. fn(count - 1) spread over up to threads threads.
+    template <class F>
+    static void parallel_for(size_t count, unsigned threads, F fn)
+    {
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads && t < count; t++)
+        {
+            workers.emplace_back([&, t]() {
+                for (size_t i = t; i < count; i += threads)
+                    fn(i);
+            });
+        }
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    // Writes node's subtree out in order, returning how many
+    // entries that was.
+    static size_t export_subtree(BinaryTreeNode<K, V> *node, K *keys_out, V *values_out)
+    {
+        size_t count = 0;
+        for (BinaryTreeIterator<K, V> it(node, true); it != std::default_sentinel; it.incr())
+        {
+            keys_out[count] = it.node()->key;
+            values_out[count] = it.node()->value;
+            count++;
+        }
+        return count;
+    }
+
+    static size_t count_subtree(BinaryTreeNode<K, V> *node)
+    {
+        size_t count = 0;
+        std::vector<BinaryTreeNode<K, V> *> todo{node};
+        while (!todo.empty())
+        {
+            node = todo.back();
+            todo.pop_back();
+            count++;
+            if (node->left)
+                todo.push_back(node->left);
+            if (node->right)
+                todo.push_back(node->right);
+        }
+        return count;
+    }
+
+    // Ties an iterator to our modification count.
+    BinaryTreeIterator<K, V> watched(BinaryTreeIterator<K, V> it)
+    {
+#if TREE_CHECK_ITERATORS
+        it.tree_mods = &mods;
+        it.seen_mods = mods;
+#endif
+        return it;
+    }
+
+    // Bumps the modification count that checked iterators watch.
+    void modified()
+    {
+#if TREE_CHECK_ITERATORS
+        mods++;
+#endif
+    }
+
+    // Records a modification if the number of nodes changed.
+    void note_changes(size_t before)
+    {
+#if TREE_CHECK_ITERATORS
+        if (pool.size() != before)
+            mods++;
+#else
+        (void)before;
+#endif
+    }
+
+    // The recursive half of apply_sorted.
+    template <class It>
+    BinaryTreeNode<K, V> *merge(BinaryTreeNode<K, V> *node, It first, It last, bool &reshaped)
+    {
+        if (first == last)
+            return node;
+        if (!node)
+        {
+            std::vector<BinaryTreeNode<K, V> *> fresh;
+            for (It it = first; it != last; ++it)
+            {
+                if (it->second)
+                {
+                    fresh.push_back(pool.create(it->first));
+                    fresh.back()->value = *it->second;
+                }
+            }
+            reshaped |= !fresh.empty();
+            return relink(fresh, 0, fresh.size());
+        }
+        It mid = std::partition_point(first, last, [&](const auto &change) { return change.first < node->key; });
+        It after = mid;
+        bool drop = false;
+        if (mid != last && !(node->key < mid->first))
+        {
+            if (mid->second)
+                node->value = *mid->second;
+            else
+                drop = true;
+            ++after;
+        }
+        node->left = merge(node->left, first, mid, reshaped);
+        node->right = merge(node->right, after, last, reshaped);
+        if (!drop)
+            return node;
+        reshaped = true;
+        return unlink(node);
+    }
+
+    // Removes node from the top of its subtree and returns what
+    // replaces it.  Same idea as BinaryTreeNode::erase, but the
+    // predecessor node is moved into place rather than copying
+    // its key and value across.
+    BinaryTreeNode<K, V> *unlink(BinaryTreeNode<K, V> *node)
+    {
+        BinaryTreeNode<K, V> *replacement;
+        if (!node->left)
+        {
+            replacement = node->right;
+        }
+        else if (!node->right)
+        {
+            replacement = node->left;
+        }
+        else if (!node->left->right)
+        {
+            replacement = node->left;
+            replacement->right = node->right;
+        }
+        else
+        {
+            BinaryTreeNode<K, V> *parent = node->left;
+            while (parent->right->right)
+                parent = parent->right;
+            replacement = parent->right;
+            parent->right = replacement->left;
+            replacement->left = node->left;
+            replacement->right = node->right;
+        }
+        pool.destroy(node);
+        return replacement;
+    }
+
+    // Turns the sorted nodes in [lo, hi) back into a tree,
+    // picking the middle one as the root each time.
+    static BinaryTreeNode<K, V> *relink(std::vector<BinaryTreeNode<K, V> *> &nodes, size_t lo, size_t hi)
+    {
+        if (lo == hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        BinaryTreeNode<K, V> *node = nodes[mid];
+        node->left = relink(nodes, lo, mid);
+        node->right = relink(nodes, mid + 1, hi);
+        return node;
+    }
+
+    // The number of levels in the tree.  This is done level by
+    // level rather than recursively so a degenerate (list shaped)
+    // tree can't blow the stack.
+    size_t height()
+    {
+        size_t levels = 0;
+        std::vector<BinaryTreeNode<K, V> *> level{root}, next;
+        while (!level.empty())
+        {
+            levels++;
+            next.clear();
+            for (auto *node : level)
+            {
+                if (node->left)
+                    next.push_back(node->left);
+                if (node->right)
+                    next.push_back(node->right);
+            }
+            level.swap(next);
+        }
+        return levels;
+    }
+
+    // Appends the top `levels` levels of node's subtree to order in
+    // van Emde Boas order, and the roots of whatever hangs below
+    // them to fringe.  The recursion halves the height each time,
+    // so it is only log(height) deep.
+    static void veb_order(BinaryTreeNode<K, V> *node, size_t levels,
+                          std::vector<BinaryTreeNode<K, V> *> &order,
+                          std::vector<BinaryTreeNode<K, V> *> &fringe)
+    {
+        if (levels == 1)
+        {
+            order.push_back(node);
+            if (node->left)
+                fringe.push_back(node->left);
+            if (node->right)
+                fringe.push_back(node->right);
+            return;
+        }
+        size_t top = levels / 2;
+        std::vector<BinaryTreeNode<K, V> *> middle;
+        veb_order(node, top, order, middle);
+        for (auto *subtree : middle)
+            veb_order(subtree, levels - top, order, fringe);
+    }
+
     BinaryTreeNode<K, V> *root;
+    BinaryTreeNodePool<K, V> pool;
+#if TREE_CHECK_ITERATORS
+    size_t mods = 0;
+#endif
 };
 
 // And the class for the binary tree node itself.
@@ -219,33 +1029,69 @@ class BinaryTreeNode
 public:
     // The constructor, it simply setts the key and the left/right pointers.
     // Data defaults to whatever the default value is for the data type.
-    BinaryTreeNode(const K &keyin) : key(keyin), left(nullptr), right(nullptr)
+    BinaryTreeNode(const K &keyin) : key(keyin), value(), left(nullptr), right(nullptr), prefix(Prefix::of(key))
+    {
+    }
+    BinaryTreeNode(K &&keyin) : key(std::move(keyin)), value(), left(nullptr), right(nullptr), prefix(Prefix::of(key))
     {
     }
 
-    // This should recursively free the tree.
-    // It should call freetree on left and 
-    // right and then, as the last act,
-    // call delete on this.  
+    // This frees the tree.  It used to call freetree on left
+    // and right and then free this node, but a tree that was
+    // built from sorted keys is one long chain, and recursing
+    // down a chain of a few million nodes runs off the end of the
+    // stack.  So it goes round a loop instead (see freesome), and
+    // as the last act hands this node back to the pool it came
+    // from.
 
     // Yes, you can "suicide" an object in C++,
     // and this is a case where you want to do it.
-    void freetree()
+    void freetree(BinaryTreeNodePool<K, V> &pool)
     {
-        if (left)
-        {
-            left->freetree();
-            left = nullptr;
-        }
-        if (right)
+        size_t budget = SIZE_MAX;
+        freesome(this, pool, budget);
+    }
+
+    // Frees the tree at node a step at a time, for at most budget
+    // steps, and returns what is left of it (null once it is all
+    // gone).  Each step either frees a node with no left child,
+    // moving on to its right child, or rotates the left child up,
+    // so the tree unrolls into a chain down the right as it goes.
+    // Every node is rotated up at most once and freed once, with
+    // no recursion and no extra memory.
+    static BinaryTreeNode<K, V> *freesome(BinaryTreeNode<K, V> *node, BinaryTreeNodePool<K, V> &pool,
+                                          size_t &budget)
+    {
+        while (node && budget)
         {
-            right->freetree();
-            right = nullptr;
+            budget--;
+            if (BinaryTreeNode<K, V> *left = node->left)
+            {
+                node->left = left->right;
+                left->right = node;
+                node = left;
+            }
+            else
+            {
+                BinaryTreeNode<K, V> *right = node->right;
+                pool.destroy(node);
+                node = right;
+            }
         }
-        delete this;
+        return node;
     }
 
 protected:
+    using Prefix = BinaryTreeKeyPrefix<K>;
+
+    // Less than, equal to or greater than zero as k (whose prefix
+    // is p) comes before, is the same as or comes after our key.
+    int order(const K &k, typename Prefix::type p) const
+    {
+        if (int c = Prefix::compare(p, prefix))
+            return c;
+        return k < key ? -1 : key < k ? 1 : 0;
+    }
 
     // Removing a node from a binary tree, returning
     // a pointer to the now modified tree.
@@ -270,31 +1116,31 @@ protected:
     // node to a temporary, have its left point to the current node's left
     // its right to the current node's right, delete this and return that
     // node.
-    BinaryTreeNode<K, V> *erase(const K &k)
+    BinaryTreeNode<K, V> *erase(const K &k, typename Prefix::type p, BinaryTreeNodePool<K, V> &pool)
     {
-        (void) k;
-        if (k < key)
+        int c = order(k, p);
+        if (c < 0)
         {
             if (left)
-                left = left->erase(k);
+                left = left->erase(k, p, pool);
         }
-        else if (k > key)
+        else if (c > 0)
         {
             if (right)
-                right = right->erase(k);
+                right = right->erase(k, p, pool);
         }
         else
         {
             if (!left)
             {
                 BinaryTreeNode<K, V> *temp = right;
-                delete this;
+                pool.destroy(this);
                 return temp;
             }
             else if (!right)
             {
                 BinaryTreeNode<K, V> *temp = left;
-                delete this;
+                pool.destroy(this);
                 return temp;
             }
             else
@@ -303,8 +1149,9 @@ protected:
                 while (successor->right)
                     successor = successor->right;
                 key = successor->key;
-                value = successor->value;
-                left = left->erase(successor->key);
+                value = std::move(successor->value);
+                prefix = successor->prefix;
+                left = left->erase(successor->key, prefix, pool);
             }
         }
         // Again, not what you will always want to return...
@@ -318,42 +1165,43 @@ protected:
     // If there is no left node, create it with k as the key.
     // Then recursively return find on the left.  Similar for
     // the right. 
-    V &find(const K &k)
+    V &find(const K &k, typename Prefix::type p, BinaryTreeNodePool<K, V> &pool)
     {
-        if (k == key)
+        int c = order(k, p);
+        if (c == 0)
         {
             return value;
         }
-        if (k < key)
+        if (c < 0)
         {
             if (!left)
-                left = new BinaryTreeNode<K, V>(k);
-         return left->find(k);
+                left = pool.create(k);
+         return left->find(k, p, pool);
         }
         else // k > key
         {
             if (!right)
-                right = new BinaryTreeNode<K, V>(k);
-            return right->find(k);
+                right = pool.create(k);
+            return right->find(k, p, pool);
         }
     }
 
     // And contains is a recursive search that doesn't
     // create new nodes, just checks if the key exists.
-    bool contains(const K &k)
+    bool contains(const K &k, typename Prefix::type p)
     {
-        (void) k;
-        if (k == key)
+        int c = order(k, p);
+        if (c == 0)
         {
             return true;
         }
-        else if (k < key)
+        else if (c < 0)
         {
-            return left ? left->contains(k) : false;
+            return left ? left->contains(k, p) : false;
         }
-        else if (k > key)
+        else // k > key
         {
-            return right ? right->contains(k) : false;
+            return right ? right->contains(k, p) : false;
         }
     }
 
@@ -361,8 +1209,117 @@ protected:
     V value;
     BinaryTreeNode<K, V> *left;
     BinaryTreeNode<K, V> *right;
+    // Kept in step with key; see BinaryTreeKeyPrefix.
+    [[no_unique_address]] typename Prefix::type prefix;
 };
-    V value;
-    BinaryTreeNode<K, V> *left;
-    BinaryTreeNode<K, V> *right;
+
+// Every tree gets its nodes from its own pool rather than
+// calling new and delete for each one.  The pool hands out
+// slots from a list of chunks, bumping through the newest
+// chunk and reusing freed slots before that.  Apart from
+// saving the allocator calls, this keeps a tree's nodes close
+// together in memory and lets compact() build a whole new
+// layout and throw the old one away at once.
+template <class K, class V>
+class BinaryTreeNodePool
+{
+public:
+    BinaryTreeNodePool() : free_list(nullptr), used(0), capacity(0), live(0)
+    {
+    }
+    BinaryTreeNodePool(const BinaryTreeNodePool &) = delete;
+    BinaryTreeNodePool &operator=(const BinaryTreeNodePool &) = delete;
+
+    // Builds a node for key in a free slot.
+    template <class Key>
+    BinaryTreeNode<K, V> *create(Key &&key)
+    {
+        Slot *slot = free_list;
+        if (slot)
+        {
+            free_list = slot->next;
+        }
+        else
+        {
+            if (used == capacity)
+                grow(1);
+            slot = &chunks.back()[used++];
+        }
+        auto *node = new (slot->storage) BinaryTreeNode<K, V>(std::forward<Key>(key));
+        live++;
+        return node;
+    }
+
+    // Destroys a node and puts its slot on the free list.
+    void destroy(BinaryTreeNode<K, V> *node)
+    {
+        node->~BinaryTreeNode();
+        Slot *slot = reinterpret_cast<Slot *>(node);
+        slot->next = free_list;
+        free_list = slot;
+        live--;
+    }
+
+    // How many nodes are currently handed out.
+    size_t size() const
+    {
+        return live;
+    }
+
+    // Makes sure the next count creates come out of a single
+    // contiguous run of slots.
+    void reserve(size_t count)
+    {
+        if (capacity - used < count)
+            grow(count);
+    }
+
+    // Frees the newest chunk, whatever is in it, and returns
+    // false once there are none.  Only for taking apart a pool
+    // whose nodes are all gone (or need no destructor).
+    bool release_chunk()
+    {
+        if (chunks.empty())
+            return false;
+        chunks.pop_back();
+        free_list = nullptr;
+        used = capacity = live = 0;
+        return true;
+    }
+
+    void swap(BinaryTreeNodePool &other) noexcept
+    {
+        chunks.swap(other.chunks);
+        std::swap(free_list, other.free_list);
+        std::swap(used, other.used);
+        std::swap(capacity, other.capacity);
+        std::swap(live, other.live);
+    }
+
+private:
+    static constexpr size_t first_chunk = 16;
+    static constexpr size_t max_chunk = 4096;
+
+    union Slot
+    {
+        Slot *next;
+        alignas(BinaryTreeNode<K, V>) unsigned char storage[sizeof(BinaryTreeNode<K, V>)];
+    };
+
+    // Starts a new chunk with room for at least count nodes.  Chunks
+    // double in size up to a limit, so small trees stay small.
+    void grow(size_t count)
+    {
+        capacity = std::max({count, std::min(capacity * 2, max_chunk), first_chunk});
+        chunks.push_back(std::make_unique_for_overwrite<Slot[]>(capacity));
+        used = 0;
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot *free_list;
+    size_t used;
+    size_t capacity;
+    size_t live;
 };
+
+#endif // TREE_HPP
@@ -0,0 +1,645 @@
+// A map that picks its own representation from how it is being
+// used, and moves between them as the workload changes:
+//
+//  - flat: the entries in two sorted arrays.  The smallest and
+//    fastest to search and scan, but it can't take new keys, so it
+//    is only used while nothing is being written (serving after a
+//    bulk load, say).
+//  - tree: a BalancedTree, for when keys come and go.  It stays
+//    balanced however the keys arrive, sorted bulk loads included,
+//    at the price of rebuilding a subtree now and then (see
+//    tree_balanced.hpp), which the operation that does it pays for.
+//  - indexed tree: the tree plus a hash index from key to
+//    value, for when point lookups dominate and there are only a
+//    few writes, which keep the index up to date as they go.
+//
+// Every operation is counted, and every window of operations the
+// mix decides which representation fits best: write heavy windows
+// want the tree, read only ones the flat arrays, and read mostly
+// ones that are mostly point lookups (rather than scans) the
+// indexed tree.  A write to the flat arrays moves them to a tree
+// straight away.  representation() says which is in use, and
+// reason() why it was picked.
+//
+// Moving from one to the other is never done in one go, which for
+// a big map would stall whichever operation happened to trigger
+// it.  Instead every operation afterwards does a few steps of it,
+// and until it is done lookups consult both sides:
+//
+//  - tree to flat copies the tree out in key order, a few entries
+//    at a time, picking up each time from the last key copied.
+//    Any write abandons it.  Once done the tree is handed to a
+//    BinaryTreeReclaimer, which frees it a slice at a time too.
+//  - flat to tree moves the entries into the tree in breadth first
+//    order of a balanced tree over the array, so the tree comes
+//    out balanced.  Writes meanwhile go to the tree, and entries
+//    they touch are moved over early.  A bit per entry marks the
+//    ones already moved.  The arrays are then destroyed a few
+//    entries at a time.
+//  - building the index walks the tree a few entries at a time;
+//    dropping it erases a few entries at a time.
+//
+// The hash index points at the values in the tree's nodes, which
+// stay put until their own key is erased.  Keys have to be
+// hashable with Hash.
+//
+// Values do move between representations, so the references and
+// pointers that operator[] and get() hand out are only good until
+// the next operation.  get() and scan() hand out const ones: a copy
+// to the flat arrays may already have taken the value, and a change
+// made through them would be lost.  Changes go through operator[],
+// which abandons such a copy.
+
+#ifndef TREE_ADAPTIVE_HPP
+#define TREE_ADAPTIVE_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tree_balanced.hpp"
+#include "tree_reclaim.hpp"
+
+template <class K, class V, class Hash = std::hash<K>>
+class AdaptiveTree
+{
+public:
+    enum class Representation
+    {
+        flat,
+        tree,
+        indexed_tree
+    };
+
+    static const char *name(Representation r)
+    {
+        switch (r)
+        {
+        case Representation::flat:
+            return "flat";
+        case Representation::tree:
+            return "tree";
+        default:
+            return "indexed tree";
+        }
+    }
+
+    AdaptiveTree()
+        : active(Representation::tree), migration(Migration::none), reason_text("empty to start with"), count(0),
+          reads(0), writes(0), scans(0), ops(0), level(0), position(0)
+    {
+    }
+
+    // The value for key, adding it with a default value if it
+    // isn't there.
+    V &operator[](const K &key)
+    {
+        step();
+        writes++;
+        V *value;
+        if (active == Representation::flat)
+        {
+            // Values of keys already there can be changed in place;
+            // a new key needs the tree.
+            size_t at = flat_find(key);
+            if (migration == Migration::none && at != npos)
+                return flat_values[at];
+            if (migration == Migration::none)
+                start_to_tree("a key was added to the flat arrays");
+            value = &moved_value(key);
+        }
+        else
+        {
+            if (migration == Migration::to_flat)
+                abandon_to_flat();
+            size_t before = tree.size();
+            value = &tree[key];
+            count += tree.size() - before;
+            if (index_in_use())
+                index.set(key, value);
+        }
+        return *value;
+    }
+
+    // A pointer to the value for key, or null if it isn't there.
+    const V *get(const K &key)
+    {
+        step();
+        reads++;
+        return find(key);
+    }
+
+    bool contains(const K &key)
+    {
+        return get(key) != nullptr;
+    }
+
+    void erase(const K &key)
+    {
+        step();
+        writes++;
+        if (active == Representation::flat)
+        {
+            size_t at = flat_find(key);
+            if (migration == Migration::none && at != npos)
+                start_to_tree("a key was erased from the flat arrays");
+            if (at != npos)
+            {
+                flat_moved[at] = true;
+                count--;
+            }
+            else if (tree.contains(key))
+            {
+                tree.erase(key);
+                count--;
+            }
+        }
+        else
+        {
+            if (migration == Migration::to_flat)
+                abandon_to_flat();
+            if (tree.contains(key))
+            {
+                tree.erase(key);
+                count--;
+                if (index_in_use())
+                    index.erase(key);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // Calls fn(key, value) for every key in [lo, hi), in order,
+    // with const references to both.
+    template <class F>
+    void scan(const K &lo, const K &hi, F fn)
+    {
+        step();
+        scans++;
+        if (active != Representation::flat)
+        {
+            for (auto it = tree.lower_bound(lo); it != std::default_sentinel; ++it)
+            {
+                auto [key, value] = *it;
+                if (!(key < hi))
+                    break;
+                fn(static_cast<const K &>(key), static_cast<const V &>(value));
+            }
+            return;
+        }
+        // The flat arrays, merged with the tree if they are part way
+        // through moving into it.  A key is never live in both.
+        auto it = tree.lower_bound(lo);
+        size_t at = std::lower_bound(flat_keys.begin(), flat_keys.end(), lo) - flat_keys.begin();
+        while (true)
+        {
+            while (at < flat_keys.size() && moved(at))
+                at++;
+            bool in_flat = at < flat_keys.size() && flat_keys[at] < hi;
+            bool in_tree = it != std::default_sentinel && (*it).first < hi;
+            if (in_tree && (!in_flat || (*it).first < flat_keys[at]))
+            {
+                auto [key, value] = *it;
+                fn(static_cast<const K &>(key), static_cast<const V &>(value));
+                ++it;
+            }
+            else if (in_flat)
+            {
+                fn(static_cast<const K &>(flat_keys[at]), static_cast<const V &>(flat_values[at]));
+                at++;
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+
+    // What is in use now, whether it is being moved to another,
+    // and why.
+    Representation representation() const
+    {
+        return active;
+    }
+    std::optional<Representation> migrating_to() const
+    {
+        switch (migration)
+        {
+        case Migration::to_flat:
+            return Representation::flat;
+        case Migration::to_tree:
+        case Migration::drop_index:
+            return Representation::tree;
+        case Migration::to_index:
+            return Representation::indexed_tree;
+        default:
+            return std::nullopt;
+        }
+    }
+    const std::string &reason() const
+    {
+        return reason_text;
+    }
+
+    // Operations per decision, migration steps per operation, and
+    // the smallest map worth a flat copy or an index.
+    static constexpr size_t window = 4096;
+    static constexpr size_t steps_per_op = 16;
+    static constexpr size_t min_size = 1024;
+
+private:
+    // The hash index, in shards that each grow on their own.  One
+    // big table would either have to be sized up front, which
+    // clears a bucket array for the whole map in one operation, or
+    // rehash everything in it each time it doubled.  A shard only
+    // ever rehashes its own small slice.  Shards are picked by the
+    // top bits of the key's hash, scrambled so that hashes that
+    // are just the key (as std::hash of an integer is) spread too.
+    class Index
+    {
+        using Shard = std::unordered_map<K, V *, Hash>;
+
+    public:
+        static constexpr unsigned shard_bits = 10;
+
+        void open()
+        {
+            shards.resize(size_t(1) << shard_bits);
+        }
+
+        // Whether close_some() has emptied and freed every shard.
+        bool closed() const
+        {
+            return shards.empty();
+        }
+
+        V *find(const K &key) const
+        {
+            const Shard &in = shard(key);
+            auto it = in.find(key);
+            return it == in.end() ? nullptr : it->second;
+        }
+
+        // Points key at value.
+        void set(const K &key, V *value)
+        {
+            shard(key).insert_or_assign(key, value);
+        }
+
+        // The same, unless key is already there.
+        void add(const K &key, V *value)
+        {
+            shard(key).try_emplace(key, value);
+        }
+
+        void erase(const K &key)
+        {
+            shard(key).erase(key);
+        }
+
+        // Erases up to n entries, freeing each shard once it is
+        // empty.
+        void close_some(size_t n)
+        {
+            while (!shards.empty())
+            {
+                Shard &last = shards.back();
+                for (; n > 0 && !last.empty(); n--)
+                    last.erase(last.begin());
+                if (!last.empty())
+                    return;
+                shards.pop_back();
+            }
+        }
+
+    private:
+        Shard &shard(const K &key)
+        {
+            return shards[uint64_t(Hash()(key)) * 0x9e3779b97f4a7c15 >> (64 - shard_bits)];
+        }
+        const Shard &shard(const K &key) const
+        {
+            return const_cast<Index *>(this)->shard(key);
+        }
+
+        std::vector<Shard> shards;
+    };
+
+    enum class Migration
+    {
+        none,
+        to_flat,
+        to_tree,
+        to_index,
+        drop_index
+    };
+
+    static constexpr size_t npos = size_t(-1);
+
+    V *find(const K &key)
+    {
+        if (active == Representation::flat)
+        {
+            size_t at = flat_find(key);
+            if (at != npos)
+                return &flat_values[at];
+            return migration == Migration::to_tree ? tree.get(key) : nullptr;
+        }
+        if (index_in_use())
+        {
+            if (V *found = index.find(key))
+                return found;
+            if (active == Representation::indexed_tree)
+                return nullptr;
+        }
+        return tree.get(key);
+    }
+
+    // Where key is live in the flat arrays, or npos.
+    size_t flat_find(const K &key) const
+    {
+        size_t at = std::lower_bound(flat_keys.begin(), flat_keys.end(), key) - flat_keys.begin();
+        if (at == flat_keys.size() || key < flat_keys[at] || moved(at))
+            return npos;
+        return at;
+    }
+
+    bool moved(size_t at) const
+    {
+        return !flat_moved.empty() && flat_moved[at];
+    }
+
+    // While moving to the tree: key's value in the tree, moving it
+    // over from the flat arrays first if it is still there.
+    V &moved_value(const K &key)
+    {
+        size_t at = flat_find(key);
+        size_t before = tree.size();
+        V &value = tree[key];
+        if (at != npos)
+        {
+            value = std::move(flat_values[at]);
+            flat_moved[at] = true;
+        }
+        else
+        {
+            count += tree.size() - before;
+        }
+        return value;
+    }
+
+    bool index_in_use() const
+    {
+        if (migration == Migration::drop_index)
+            return false;
+        return migration == Migration::to_index || active == Representation::indexed_tree;
+    }
+
+    // The start of every operation: a few steps of whatever is in
+    // progress, and a decision at the end of each window.  Done
+    // first so that nothing moves the value an operation returns.
+    void step()
+    {
+        switch (migration)
+        {
+        case Migration::to_flat:
+            copy_out();
+            break;
+        case Migration::to_tree:
+            move_in();
+            break;
+        case Migration::to_index:
+            index_some();
+            break;
+        case Migration::drop_index:
+            index.close_some(4 * steps_per_op);
+            if (index.closed())
+                finish(Representation::tree);
+            break;
+        case Migration::none:
+            break;
+        }
+        tidy();
+        if (++ops == window)
+            decide();
+    }
+
+    // Frees a little of what the last migration left behind.
+    void tidy()
+    {
+        if (reclaimer.pending())
+            reclaimer.reclaim(16 * steps_per_op);
+        if (!old_keys.empty())
+        {
+            for (size_t i = 0; i < 4 * steps_per_op && !old_keys.empty(); i++)
+            {
+                old_keys.pop_back();
+                old_values.pop_back();
+            }
+            if (old_keys.empty())
+            {
+                std::vector<K>().swap(old_keys);
+                std::vector<V>().swap(old_values);
+            }
+        }
+    }
+
+    void decide()
+    {
+        size_t total = ops;
+        size_t r = reads, w = writes, s = scans;
+        ops = reads = writes = scans = 0;
+        // One thing at a time: leftovers of the last flat arrays have
+        // to be gone before another set can be made.
+        if (migration != Migration::none || active == Representation::flat || !old_keys.empty())
+            return;
+        if (w * 8 > total || count < min_size)
+        {
+            if (active == Representation::indexed_tree)
+                start(Migration::drop_index, "writes are " + percent(w, total) + " of recent operations");
+            return;
+        }
+        if (w == 0)
+        {
+            if (active == Representation::indexed_tree)
+                start(Migration::drop_index, "read only; dropping the index to go flat");
+            else
+                start_to_flat("read only for the last " + std::to_string(total) + " operations");
+            return;
+        }
+        if (active == Representation::tree && r > s)
+            start_to_index("point lookups are " + percent(r, total) + " of recent operations, writes only " +
+                           percent(w, total));
+    }
+
+    static std::string percent(size_t part, size_t whole)
+    {
+        return std::to_string(part * 100 / whole) + "%";
+    }
+
+    void start(Migration to, std::string why)
+    {
+        migration = to;
+        reason_text = std::move(why);
+    }
+
+    void finish(Representation now)
+    {
+        active = now;
+        migration = Migration::none;
+    }
+
+    void start_to_flat(std::string why)
+    {
+        start(Migration::to_flat, std::move(why));
+        flat_keys.reserve(count);
+        flat_values.reserve(count);
+        cursor.reset();
+    }
+
+    // Copies the next few entries out of the tree.
+    void copy_out()
+    {
+        auto it = cursor ? tree.lower_bound(*cursor) : tree.begin();
+        for (size_t i = 0; i < steps_per_op && it != std::default_sentinel; i++, ++it)
+        {
+            auto [key, value] = *it;
+            flat_keys.push_back(key);
+            flat_values.push_back(value);
+        }
+        if (it == std::default_sentinel)
+        {
+            finish(Representation::flat);
+            reclaimer.retire(tree.release());
+            return;
+        }
+        cursor = (*it).first;
+    }
+
+    void abandon_to_flat()
+    {
+        discard_flat();
+        finish(Representation::tree);
+        reason_text = "writes resumed before the flat copy was done";
+    }
+
+    // Leaves the flat arrays to tidy() to destroy bit by bit.
+    void discard_flat()
+    {
+        old_keys.swap(flat_keys);
+        old_values.swap(flat_values);
+        flat_keys.clear();
+        flat_values.clear();
+        flat_moved.clear();
+    }
+
+    void start_to_tree(std::string why)
+    {
+        start(Migration::to_tree, std::move(why));
+        flat_moved.assign(flat_keys.size(), false);
+        level = position = 0;
+    }
+
+    // Moves the next few entries into the tree.  Entry number
+    // `position` on level `level` of a balanced tree over the
+    // arrays is found by halving the whole range, going left or
+    // right by the bits of position from the top.
+    void move_in()
+    {
+        size_t n = flat_keys.size();
+        for (size_t i = 0; i < steps_per_op; i++)
+        {
+            if (level > size_t(std::bit_width(n)))
+            {
+                finish(Representation::tree);
+                discard_flat();
+                return;
+            }
+            size_t lo = 0, hi = n;
+            for (size_t bit = level; bit-- > 0 && lo < hi;)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                if (position >> bit & 1)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo < hi)
+            {
+                size_t mid = lo + (hi - lo) / 2;
+                if (!flat_moved[mid])
+                {
+                    tree[flat_keys[mid]] = std::move(flat_values[mid]);
+                    flat_moved[mid] = true;
+                }
+            }
+            if (++position == size_t(1) << level)
+            {
+                level++;
+                position = 0;
+            }
+        }
+    }
+
+    void start_to_index(std::string why)
+    {
+        start(Migration::to_index, std::move(why));
+        index.open();
+        cursor.reset();
+    }
+
+    // Indexes the next few entries of the tree.
+    void index_some()
+    {
+        auto it = cursor ? tree.lower_bound(*cursor) : tree.begin();
+        for (size_t i = 0; i < steps_per_op && it != std::default_sentinel; i++, ++it)
+        {
+            auto [key, value] = *it;
+            index.add(key, &value);
+        }
+        if (it == std::default_sentinel)
+        {
+            finish(Representation::indexed_tree);
+            return;
+        }
+        cursor = (*it).first;
+    }
+
+    Representation active;
+    Migration migration;
+    std::string reason_text;
+    size_t count;
+
+    // This window's operation mix.
+    size_t reads, writes, scans, ops;
+
+    BalancedTree<K, V> tree;
+    Index index;
+    std::vector<K> flat_keys;
+    std::vector<V> flat_values;
+    // Which flat entries have moved to the tree (or been erased),
+    // while moving to the tree; empty otherwise.
+    std::vector<bool> flat_moved;
+
+    // Where the tree walks (to flat, or indexing) pick up again.
+    std::optional<K> cursor;
+    // And where moving to the tree is up to.
+    size_t level, position;
+
+    // What earlier migrations left to free.
+    BinaryTreeReclaimer<K, V> reclaimer;
+    std::vector<K> old_keys;
+    std::vector<V> old_values;
+};
+
+#endif // TREE_ADAPTIVE_HPP
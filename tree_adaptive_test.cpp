@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "tree_adaptive.hpp"
+
+using Adaptive = AdaptiveTree<int, std::string>;
+
+// Reads hand out const values, so nothing can change one behind the
+// back of a copy to the flat arrays.
+static_assert(std::is_same_v<decltype(std::declval<Adaptive &>().get(0)), const std::string *>);
+
+// Compares a full scan with the reference map.
+static void expect_same(Adaptive &tree, const std::map<int, std::string> &expected)
+{
+    std::vector<std::pair<int, std::string>> seen;
+    tree.scan(INT_MIN, INT_MAX, [&](const int &key, const std::string &value) { seen.emplace_back(key, value); });
+    std::vector<std::pair<int, std::string>> want(expected.begin(), expected.end());
+    EXPECT_EQ(seen, want);
+    EXPECT_EQ(tree.size(), expected.size());
+}
+
+// A random mix of operations, writes out of every 100 of them,
+// checked against the reference map as it goes.
+static void run(Adaptive &tree, std::map<int, std::string> &expected, std::mt19937 &rng, int ops, int writes)
+{
+    for (int i = 0; i < ops; i++)
+    {
+        int key = int(rng() % 40000);
+        if (int(rng() % 100) < writes)
+        {
+            if (rng() % 2)
+            {
+                tree[key] = std::to_string(i);
+                expected[key] = std::to_string(i);
+            }
+            else
+            {
+                tree.erase(key);
+                expected.erase(key);
+            }
+        }
+        else
+        {
+            auto it = expected.find(key);
+            const std::string *value = tree.get(key);
+            ASSERT_EQ(value != nullptr, it != expected.end()) << key;
+            if (value)
+            {
+                ASSERT_EQ(*value, it->second);
+            }
+        }
+    }
+}
+
+// Keeps running the mix until the tree settles on want.
+static void settle(Adaptive &tree, std::map<int, std::string> &expected, std::mt19937 &rng, int writes,
+                   Adaptive::Representation want)
+{
+    for (int rounds = 0; rounds < 100; rounds++)
+    {
+        if (tree.representation() == want && !tree.migrating_to())
+            return;
+        run(tree, expected, rng, 1000, writes);
+    }
+    FAIL() << "never became " << Adaptive::name(want) << "; is " << Adaptive::name(tree.representation());
+}
+
+TEST(AdaptiveTest, FollowsTheWorkload)
+{
+    Adaptive tree;
+    std::map<int, std::string> expected;
+    std::mt19937 rng(7);
+    EXPECT_EQ(tree.representation(), Adaptive::Representation::tree);
+
+    // Bulk load, then read only serving goes flat.
+    run(tree, expected, rng, 30000, 100);
+    expect_same(tree, expected);
+    settle(tree, expected, rng, 0, Adaptive::Representation::flat);
+    EXPECT_NE(tree.reason().find("read only"), std::string::npos);
+    expect_same(tree, expected);
+
+    // The first new key starts the move back to a tree, and the
+    // burst of updates carries on while it happens.
+    int fresh = 50000;
+    tree[fresh] = "new";
+    expected[fresh] = "new";
+    EXPECT_EQ(tree.representation(), Adaptive::Representation::flat);
+    EXPECT_EQ(tree.migrating_to(), Adaptive::Representation::tree);
+    EXPECT_NE(tree.reason().find("added"), std::string::npos);
+    run(tree, expected, rng, 500, 30);
+    expect_same(tree, expected);
+    settle(tree, expected, rng, 30, Adaptive::Representation::tree);
+    expect_same(tree, expected);
+
+    // Mostly point lookups with a trickle of writes get an index,
+    // which the writes (erases especially) keep right.
+    settle(tree, expected, rng, 3, Adaptive::Representation::indexed_tree);
+    EXPECT_NE(tree.reason().find("point lookups"), std::string::npos);
+    run(tree, expected, rng, 20000, 3);
+    expect_same(tree, expected);
+
+    // And write heavy work drops it again.
+    settle(tree, expected, rng, 50, Adaptive::Representation::tree);
+    EXPECT_NE(tree.reason().find("writes are"), std::string::npos);
+    expect_same(tree, expected);
+}
+
+TEST(AdaptiveTest, ErasesDuringTheMoveToATree)
+{
+    Adaptive tree;
+    std::map<int, std::string> expected;
+    std::mt19937 rng(11);
+    run(tree, expected, rng, 20000, 100);
+    settle(tree, expected, rng, 0, Adaptive::Representation::flat);
+
+    // Erase every other key, starting the move, and check the
+    // halfway state both ways.
+    std::vector<int> keys;
+    for (auto &[key, value] : expected)
+        keys.push_back(key);
+    for (size_t i = 0; i < keys.size(); i += 2)
+    {
+        tree.erase(keys[i]);
+        expected.erase(keys[i]);
+        if (i == keys.size() / 2)
+        {
+            ASSERT_EQ(tree.migrating_to(), Adaptive::Representation::tree);
+            expect_same(tree, expected);
+        }
+    }
+    for (int key : keys)
+        EXPECT_EQ(tree.contains(key), expected.count(key) == 1) << key;
+    settle(tree, expected, rng, 30, Adaptive::Representation::tree);
+    expect_same(tree, expected);
+}
+
+TEST(AdaptiveTest, WritesAbandonTheFlatCopy)
+{
+    Adaptive tree;
+    std::map<int, std::string> expected;
+    std::mt19937 rng(3);
+    run(tree, expected, rng, 20000, 100);
+    for (int i = 0; !tree.migrating_to() && i < 10000; i++)
+        tree.get(i);
+    ASSERT_EQ(tree.migrating_to(), Adaptive::Representation::flat);
+
+    // A change to a key the copy has already passed.
+    for (int i = 0; i < 100; i++)
+        tree.get(i);
+    int first = expected.begin()->first;
+    tree[first] = "late";
+    expected[first] = "late";
+    EXPECT_FALSE(tree.migrating_to());
+    EXPECT_EQ(tree.representation(), Adaptive::Representation::tree);
+    EXPECT_NE(tree.reason().find("writes resumed"), std::string::npos);
+    run(tree, expected, rng, 5000, 30);
+    expect_same(tree, expected);
+    settle(tree, expected, rng, 0, Adaptive::Representation::flat);
+    expect_same(tree, expected);
+}
+
+TEST(AdaptiveTest, SmallMapsStayTrees)
+{
+    Adaptive tree;
+    for (int i = 0; i < 100; i++)
+        tree[i] = "x";
+    for (int i = 0; i < 3 * int(Adaptive::window); i++)
+        EXPECT_TRUE(tree.contains(i % 100));
+    EXPECT_EQ(tree.representation(), Adaptive::Representation::tree);
+    EXPECT_FALSE(tree.migrating_to());
+}
+
+// Keys loaded in order would chain a plain tree, making the load
+// quadratic; the tree representation keeps itself balanced.
+TEST(AdaptiveTest, SortedLoadsStayBalanced)
+{
+    Adaptive tree;
+    std::map<int, std::string> expected;
+    for (int i = 0; i < 50000; i++)
+    {
+        tree[i] = "v";
+        expected[i] = "v";
+    }
+    for (int i = 0; i < 50000; i += 2)
+    {
+        tree.erase(i);
+        expected.erase(i);
+    }
+    expect_same(tree, expected);
+}
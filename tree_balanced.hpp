@@ -0,0 +1,182 @@
+// A BinaryTree that keeps itself balanced, scapegoat style.
+//
+// A plain BinaryTree takes keys in whatever shape they come, so
+// keys that arrive in order (timestamps, counters, sorted loads)
+// make one long chain: every insert walks all of it, and the
+// recursive search in BinaryTreeNode can run out of stack.
+//
+// BalancedTree inserts and erases by walking down with a loop, and
+// keeps the depth of every node within log base 1/alpha of the
+// size.  When an insert lands deeper than that, it goes back up
+// its path to the nearest ancestor whose subtree is too deep for
+// its own size (the scapegoat; the root is one if nothing lower
+// is) and rebuilds just that subtree perfectly balanced.  Erases
+// never make the tree deeper, but once it has shrunk well below
+// the size it was balanced for the whole tree is rebuilt.  That
+// costs O(log N) amortized per operation, with no balance
+// information kept in the nodes at all.
+//
+// Rebuilding only relinks nodes, it never moves them, so pointers
+// to values stay good until their own key is erased, just as with
+// a plain BinaryTree.  Unlike BinaryTree::erase, erasing a key with
+// two children moves the neighbouring node into its place rather
+// than copying the neighbour's key and value over.
+//
+// Keys are compared with operator< alone, without the cached key
+// prefix that BinaryTree's own search uses.
+
+#ifndef TREE_BALANCED_HPP
+#define TREE_BALANCED_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+template <class K, class V>
+class BalancedTree : protected BinaryTree<K, V>
+{
+    using Base = BinaryTree<K, V>;
+    using Node = BinaryTreeNode<K, V>;
+    using Base::key_of;
+    using Base::left_of;
+    using Base::right_of;
+    using Base::value_of;
+
+public:
+    // How lopsided a subtree may be: neither side holds more than
+    // alpha of it, which allows a depth of log base 1/alpha of N.
+    static constexpr double alpha = 2.0 / 3.0;
+
+    BalancedTree() : largest(0)
+    {
+    }
+
+    using Base::begin;
+    using Base::end;
+    using Base::get;
+    using Base::height;
+    using Base::iterator_end;
+    using Base::lower_bound;
+    using Base::size;
+
+    // The deepest a node may be in a tree of n keys.
+    static size_t depth_limit(size_t n)
+    {
+        return n < 2 ? 0 : size_t(std::log(double(n)) / std::log(1 / alpha));
+    }
+
+    V &operator[](const K &key)
+    {
+        path.clear();
+        Node **link = &this->root;
+        while (*link)
+        {
+            Node *node = *link;
+            path.push_back(link);
+            if (key < key_of(node))
+                link = &left_of(node);
+            else if (key_of(node) < key)
+                link = &right_of(node);
+            else
+                return value_of(node);
+        }
+        Node *added = this->pool.create(key);
+        *link = added;
+        largest = std::max(largest, size());
+        if (path.size() > depth_limit(size()))
+            rebuild_scapegoat(added);
+        this->modified();
+        return value_of(added);
+    }
+
+    bool contains(const K &key)
+    {
+        return get(key) != nullptr;
+    }
+
+    void erase(const K &key)
+    {
+        Node **link = &this->root;
+        while (*link && (key < key_of(*link) || key_of(*link) < key))
+            link = key < key_of(*link) ? &left_of(*link) : &right_of(*link);
+        if (!*link)
+            return;
+        *link = this->unlink(*link);
+        this->modified();
+        if (size() < alpha * largest)
+        {
+            rebuild(&this->root);
+            largest = size();
+        }
+    }
+
+    // As BinaryTree::erase_if, which leaves the survivors balanced.
+    template <class F>
+    size_t erase_if(F fn)
+    {
+        size_t removed = Base::erase_if(fn);
+        if (removed)
+            largest = size();
+        return removed;
+    }
+
+    // Hands every node over to a plain BinaryTree (to pass to a
+    // BinaryTreeReclaimer, say) and leaves this tree empty.
+    BinaryTree<K, V> release()
+    {
+        largest = 0;
+        return Base(std::move(static_cast<Base &>(*this)));
+    }
+
+private:
+    // path holds the links down to the node just added, which sits
+    // path.size() levels below the root.  Walking back up, adding
+    // up subtree sizes as we go, the first ancestor whose subtree
+    // is deeper than its size allows is the scapegoat.
+    void rebuild_scapegoat(Node *added)
+    {
+        size_t below = 1;
+        Node *child = added;
+        for (size_t i = path.size(); i-- > 0;)
+        {
+            Node *ancestor = *path[i];
+            Node *sibling = left_of(ancestor) == child ? right_of(ancestor) : left_of(ancestor);
+            below += 1 + (sibling ? Base::count_subtree(sibling) : 0);
+            if (path.size() - i > depth_limit(below))
+            {
+                rebuild(path[i]);
+                return;
+            }
+            child = ancestor;
+        }
+    }
+
+    // Relinks the subtree hanging from link into a balanced shape.
+    void rebuild(Node **link)
+    {
+        nodes.clear();
+        std::vector<Node *> todo;
+        Node *node = *link;
+        while (node || !todo.empty())
+        {
+            for (; node; node = left_of(node))
+                todo.push_back(node);
+            node = todo.back();
+            todo.pop_back();
+            nodes.push_back(node);
+            node = right_of(node);
+        }
+        *link = Base::relink(nodes, 0, nodes.size());
+    }
+
+    // The most keys the tree has held since it was last rebuilt.
+    size_t largest;
+    // Scratch space, kept to save reallocating it every time.
+    std::vector<Node **> path;
+    std::vector<Node *> nodes;
+};
+
+#endif // TREE_BALANCED_HPP
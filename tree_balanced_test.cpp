@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_balanced.hpp"
+
+TEST(BalancedTest, SortedInsertsStayShallow)
+{
+    BalancedTree<int, int> t;
+    const int n = 100000;
+    for (int i = 0; i < n; i++)
+        t[i] = 2 * i;
+    EXPECT_EQ(t.size(), size_t(n));
+    EXPECT_LE(t.height(), (BalancedTree<int, int>::depth_limit(n) + 1));
+    int expect = 0;
+    for (auto [key, value] : t)
+    {
+        EXPECT_EQ(key, expect);
+        EXPECT_EQ(value, 2 * expect);
+        expect++;
+    }
+    EXPECT_EQ(expect, n);
+
+    // Descending, into the same tree.
+    for (int i = -1; i >= -n; i--)
+        t[i] = 0;
+    EXPECT_LE(t.height(), (BalancedTree<int, int>::depth_limit(2 * n) + 1));
+}
+
+TEST(BalancedTest, MatchesMap)
+{
+    BalancedTree<std::string, int> t;
+    std::map<std::string, int> m;
+    std::mt19937_64 rng(3);
+    for (int i = 0; i < 20000; i++)
+    {
+        std::string key = std::to_string(rng() % 3000);
+        if (rng() % 3 == 0)
+        {
+            t.erase(key);
+            m.erase(key);
+        }
+        else
+        {
+            t[key] = i;
+            m[key] = i;
+        }
+    }
+    ASSERT_EQ(t.size(), m.size());
+    auto it = m.begin();
+    for (auto [key, value] : t)
+    {
+        EXPECT_EQ(key, it->first);
+        EXPECT_EQ(value, it->second);
+        ++it;
+    }
+    for (auto &[key, value] : m)
+    {
+        ASSERT_TRUE(t.contains(key));
+        EXPECT_EQ(*t.get(key), value);
+    }
+    EXPECT_FALSE(t.contains("x"));
+    EXPECT_LE(t.height(), (BalancedTree<std::string, int>::depth_limit(t.size()) + 1));
+}
+
+TEST(BalancedTest, RebuildsDontMoveValues)
+{
+    BalancedTree<int, int> t;
+    int *first = &t[0];
+    for (int i = 1; i < 10000; i++)
+        t[i] = i;
+    for (int i = 1; i < 9000; i++)
+        t.erase(i);
+    EXPECT_EQ(&t[0], first);
+    EXPECT_EQ(t.size(), 1001u);
+    EXPECT_EQ(t.erase_if([](int key, int &) { return key % 2; }), 500u);
+    EXPECT_EQ(*t.get(9998), 9998);
+    EXPECT_EQ(t.get(9999), nullptr);
+}
@@ -0,0 +1,56 @@
+// Scan throughput for the tree iterator.  This builds a tree much
+// bigger than the last level cache, inserting keys in random
+// order so the in-order walk jumps all over memory, and then
+// times full scans.  It is built twice, as treebench (with the
+// iterator's prefetching) and treebench_noprefetch (without), so
+// the two can be compared on the same machine.  It then runs
+// the same scans again after compact() for reference.
+//
+// Usage: treebench [entries] [passes]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <vector>
+#include "tree.hpp"
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 4000000;
+    int passes = argc > 2 ? std::atoi(argv[2]) : 5;
+
+    std::vector<uint64_t> keys(entries);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64{42});
+    BinaryTree<uint64_t, uint64_t> tree;
+    for (auto k : keys)
+        tree[k] = k;
+
+    auto scan = [&]() {
+        double best = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t sum = 0;
+            for (const auto &[key, value] : tree)
+                sum += value;
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+            if (sum != entries * (entries - 1) / 2)
+            {
+                std::printf("bad scan\n");
+                std::exit(1);
+            }
+            best = std::max(best, entries / took.count());
+        }
+        return best / 1e6;
+    };
+
+    std::printf("prefetch=%d entries=%zu\n", TREE_PREFETCH, entries);
+    std::printf("  scattered scan: %.1f Mentries/s\n", scan());
+    tree.compact();
+    std::printf("  compacted scan: %.1f Mentries/s\n", scan());
+    return 0;
+}
@@ -0,0 +1,350 @@
+// The C interface from tree_capi.h.  Both handle types are thin
+// wrappers around a BinaryTree, and the batch calls share their
+// implementation through the templates below.
+//
+// Every entry point catches whatever the C++ side throws (in
+// practice std::bad_alloc) and turns it into the error return
+// documented in the header; exceptions must never unwind into C.
+
+#include <algorithm>
+#include <exception>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "tree.hpp"
+#include "tree_capi.h"
+
+// Each handle counts the calls that added or removed keys, and a
+// cursor remembers the count it started from.  That is what ends a
+// cursor once its tree changes: the checked iterators would catch
+// it too, but they are compiled out of release builds.
+struct tree_u64
+{
+    BinaryTree<uint64_t, uint64_t> tree;
+    size_t changes = 0;
+};
+
+struct tree_u64_cursor
+{
+    BinaryTreeIterator<uint64_t, uint64_t> it;
+    const tree_u64 *owner;
+    size_t seen;
+};
+
+struct tree_bytes
+{
+    BinaryTree<std::string, std::string> tree;
+    size_t changes = 0;
+};
+
+struct tree_bytes_cursor
+{
+    BinaryTreeIterator<std::string, std::string> it;
+    const tree_bytes *owner;
+    size_t seen;
+};
+
+namespace
+{
+    // Puts or deletes a whole batch through apply_sorted: sort the
+    // batch by key (stably, so the last change to a key wins), fold
+    // it to one change per key and merge it into the tree in one
+    // pass.  change(i) gives the optional value for keys[i].
+    template <class K, class V, class KeyOf, class ChangeOf>
+    void apply_batch(BinaryTree<K, V> &tree, size_t n, KeyOf key_of, ChangeOf change_of)
+    {
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return key_of(a) < key_of(b); });
+        std::vector<std::pair<K, std::optional<V>>> changes;
+        changes.reserve(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (i + 1 < n && !(key_of(order[i]) < key_of(order[i + 1])))
+                continue;
+            changes.emplace_back(key_of(order[i]), change_of(order[i]));
+        }
+        tree.apply_sorted(changes.begin(), changes.end());
+    }
+
+    // Runs fn, turning anything it throws into the failed result.
+    template <class R, class F>
+    R guarded(R failed, F fn) noexcept
+    {
+        try
+        {
+            return fn();
+        }
+        catch (...)
+        {
+            return failed;
+        }
+    }
+
+    // Runs a call that may add or remove keys, counting it as a
+    // change if it did, even if it then failed part way.
+    template <class Handle, class F>
+    void changing(Handle *handle, F fn)
+    {
+        size_t before = handle->tree.size();
+        try
+        {
+            fn();
+        }
+        catch (...)
+        {
+            handle->changes += handle->tree.size() != before;
+            throw;
+        }
+        handle->changes += handle->tree.size() != before;
+    }
+
+    // Copies up to max entries out of a cursor.  Once the tree has
+    // changed under it the cursor is over, and stays over.
+    template <class Cursor, class Out>
+    size_t cursor_next(Cursor *cursor, size_t max, Out out)
+    {
+        if (cursor->owner->changes != cursor->seen)
+        {
+            cursor->it = decltype(cursor->it)();
+            return 0;
+        }
+        size_t count = 0;
+        for (; count < max && cursor->it != std::default_sentinel; ++cursor->it)
+        {
+            auto [key, value] = *cursor->it;
+            out(count++, key, value);
+        }
+        return count;
+    }
+
+    std::string to_string(tree_slice slice)
+    {
+        return std::string((const char *)slice.data, slice.len);
+    }
+
+    tree_slice to_slice(const std::string &s)
+    {
+        return tree_slice{s.data(), s.size()};
+    }
+}
+
+extern "C" {
+
+tree_u64 *tree_u64_new(void)
+{
+    return new (std::nothrow) tree_u64;
+}
+
+void tree_u64_free(tree_u64 *tree)
+{
+    delete tree;
+}
+
+size_t tree_u64_size(const tree_u64 *tree)
+{
+    return tree->tree.size();
+}
+
+int tree_u64_put(tree_u64 *tree, uint64_t key, uint64_t value)
+{
+    return guarded(-1, [&] {
+        changing(tree, [&] { tree->tree[key] = value; });
+        return 0;
+    });
+}
+
+int tree_u64_get(tree_u64 *tree, uint64_t key, uint64_t *value)
+{
+    uint64_t *found = tree->tree.get(key);
+    if (found)
+        *value = *found;
+    return found != nullptr;
+}
+
+int tree_u64_delete(tree_u64 *tree, uint64_t key)
+{
+    return guarded(-1, [&] {
+        size_t before = tree->tree.size();
+        changing(tree, [&] { tree->tree.erase(key); });
+        return int(tree->tree.size() != before);
+    });
+}
+
+int tree_u64_put_batch(tree_u64 *tree, const uint64_t *keys, const uint64_t *values, size_t n)
+{
+    return guarded(-1, [&] {
+        changing(tree, [&] {
+            apply_batch(tree->tree, n, [&](size_t i) { return keys[i]; },
+                        [&](size_t i) { return std::optional<uint64_t>(values[i]); });
+        });
+        return 0;
+    });
+}
+
+size_t tree_u64_get_batch(tree_u64 *tree, const uint64_t *keys, uint64_t *values, unsigned char *found, size_t n)
+{
+    size_t hits = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t *value = tree->tree.get(keys[i]);
+        if (value)
+        {
+            values[i] = *value;
+            hits++;
+        }
+        if (found)
+            found[i] = value != nullptr;
+    }
+    return hits;
+}
+
+size_t tree_u64_delete_batch(tree_u64 *tree, const uint64_t *keys, size_t n)
+{
+    return guarded(TREE_ERROR, [&] {
+        size_t before = tree->tree.size();
+        changing(tree, [&] {
+            apply_batch(tree->tree, n, [&](size_t i) { return keys[i]; },
+                        [](size_t) { return std::optional<uint64_t>(); });
+        });
+        return before - tree->tree.size();
+    });
+}
+
+tree_u64_cursor *tree_u64_cursor_open(tree_u64 *tree, uint64_t lo)
+{
+    return guarded<tree_u64_cursor *>(nullptr, [&] {
+        return new tree_u64_cursor{tree->tree.lower_bound(lo), tree, tree->changes};
+    });
+}
+
+size_t tree_u64_cursor_next(tree_u64_cursor *cursor, uint64_t *keys, uint64_t *values, size_t max)
+{
+    return guarded<size_t>(0, [&] {
+        return cursor_next(cursor, max, [&](size_t i, uint64_t key, uint64_t value) {
+            keys[i] = key;
+            values[i] = value;
+        });
+    });
+}
+
+void tree_u64_cursor_close(tree_u64_cursor *cursor)
+{
+    delete cursor;
+}
+
+tree_bytes *tree_bytes_new(void)
+{
+    return new (std::nothrow) tree_bytes;
+}
+
+void tree_bytes_free(tree_bytes *tree)
+{
+    delete tree;
+}
+
+size_t tree_bytes_size(const tree_bytes *tree)
+{
+    return tree->tree.size();
+}
+
+int tree_bytes_put(tree_bytes *tree, tree_slice key, tree_slice value)
+{
+    return guarded(-1, [&] {
+        changing(tree, [&] { tree->tree[to_string(key)].assign((const char *)value.data, value.len); });
+        return 0;
+    });
+}
+
+int tree_bytes_get(tree_bytes *tree, tree_slice key, tree_slice *value)
+{
+    return guarded(-1, [&] {
+        std::string *found = tree->tree.get(to_string(key));
+        if (found)
+            *value = to_slice(*found);
+        return int(found != nullptr);
+    });
+}
+
+int tree_bytes_delete(tree_bytes *tree, tree_slice key)
+{
+    return guarded(-1, [&] {
+        size_t before = tree->tree.size();
+        changing(tree, [&] { tree->tree.erase(to_string(key)); });
+        return int(tree->tree.size() != before);
+    });
+}
+
+int tree_bytes_put_batch(tree_bytes *tree, const tree_slice *keys, const tree_slice *values, size_t n)
+{
+    return guarded(-1, [&] {
+        std::vector<std::string> owned(n);
+        for (size_t i = 0; i < n; i++)
+            owned[i] = to_string(keys[i]);
+        changing(tree, [&] {
+            apply_batch(tree->tree, n, [&](size_t i) -> const std::string & { return owned[i]; },
+                        [&](size_t i) { return std::optional<std::string>(to_string(values[i])); });
+        });
+        return 0;
+    });
+}
+
+size_t tree_bytes_get_batch(tree_bytes *tree, const tree_slice *keys, tree_slice *values, size_t n)
+{
+    return guarded(TREE_ERROR, [&] {
+        size_t hits = 0;
+        std::string key;
+        for (size_t i = 0; i < n; i++)
+        {
+            key.assign((const char *)keys[i].data, keys[i].len);
+            std::string *value = tree->tree.get(key);
+            values[i] = value ? to_slice(*value) : tree_slice{nullptr, 0};
+            hits += value != nullptr;
+        }
+        return hits;
+    });
+}
+
+size_t tree_bytes_delete_batch(tree_bytes *tree, const tree_slice *keys, size_t n)
+{
+    return guarded(TREE_ERROR, [&] {
+        std::vector<std::string> owned(n);
+        for (size_t i = 0; i < n; i++)
+            owned[i] = to_string(keys[i]);
+        size_t before = tree->tree.size();
+        changing(tree, [&] {
+            apply_batch(tree->tree, n, [&](size_t i) -> const std::string & { return owned[i]; },
+                        [](size_t) { return std::optional<std::string>(); });
+        });
+        return before - tree->tree.size();
+    });
+}
+
+tree_bytes_cursor *tree_bytes_cursor_open(tree_bytes *tree, tree_slice lo)
+{
+    return guarded<tree_bytes_cursor *>(nullptr, [&] {
+        if (!lo.data)
+            return new tree_bytes_cursor{tree->tree.begin(), tree, tree->changes};
+        return new tree_bytes_cursor{tree->tree.lower_bound(to_string(lo)), tree, tree->changes};
+    });
+}
+
+size_t tree_bytes_cursor_next(tree_bytes_cursor *cursor, tree_slice *keys, tree_slice *values, size_t max)
+{
+    return guarded<size_t>(0, [&] {
+        return cursor_next(cursor, max, [&](size_t i, const std::string &key, const std::string &value) {
+            keys[i] = to_slice(key);
+            values[i] = to_slice(value);
+        });
+    });
+}
+
+void tree_bytes_cursor_close(tree_bytes_cursor *cursor)
+{
+    delete cursor;
+}
+
+}
@@ -0,0 +1,103 @@
+/* A C interface to the BinaryTree in tree.hpp, so that C code
+   can use it too.  The tree itself is a C++ template, so this
+   provides two ready made instantiations behind opaque handles:
+
+     tree_u64    uint64_t keys to uint64_t values
+     tree_bytes  byte string keys to byte string values (keys are
+                 ordered like memcmp, shorter first on a tie)
+
+   Every call crosses from C into C++, so besides the single key
+   calls there are batch calls that take whole arrays and do
+   thousands of operations per crossing, and cursors that hand back
+   a range scan in chunks.
+
+   As with the C++ iterators, adding or removing keys invalidates
+   any open cursor on that tree; its next call then returns 0, in
+   release builds as well as debug ones.  Close a tree's cursors
+   before freeing it.  Slices returned by tree_bytes calls point
+   into the tree and stay good until the next call that modifies
+   it: any put or delete, single or batch, including a put that
+   only overwrites an existing key's value (which can move that
+   value).  Look a value up again after any of those.
+
+   No C++ exception ever escapes into C.  Calls that can fail
+   (which in practice means running out of memory) report it: the
+   int calls return -1, the size_t ones TREE_ERROR, and the ones
+   returning handles NULL.  A failed batch may have been applied
+   in part. */
+
+#ifndef TREE_CAPI_H
+#define TREE_CAPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TREE_ERROR ((size_t)-1)
+
+typedef struct tree_u64 tree_u64;
+typedef struct tree_u64_cursor tree_u64_cursor;
+
+tree_u64 *tree_u64_new(void);
+void tree_u64_free(tree_u64 *tree);
+size_t tree_u64_size(const tree_u64 *tree);
+
+/* Single key calls.  get and delete return 1 if the key was there,
+   put returns 0. */
+int tree_u64_put(tree_u64 *tree, uint64_t key, uint64_t value);
+int tree_u64_get(tree_u64 *tree, uint64_t key, uint64_t *value);
+int tree_u64_delete(tree_u64 *tree, uint64_t key);
+
+/* Batch calls over n keys.  If a key appears more than once in a
+   put batch the last value wins; put_batch returns 0.  get_batch
+   sets found[i] to 1 or 0 (found may be NULL) and returns how many
+   were found; delete_batch returns how many were removed. */
+int tree_u64_put_batch(tree_u64 *tree, const uint64_t *keys, const uint64_t *values, size_t n);
+size_t tree_u64_get_batch(tree_u64 *tree, const uint64_t *keys, uint64_t *values, unsigned char *found, size_t n);
+size_t tree_u64_delete_batch(tree_u64 *tree, const uint64_t *keys, size_t n);
+
+/* A cursor over the keys >= lo, in order.  next copies up to max
+   entries out and returns how many; 0 means the scan is over. */
+tree_u64_cursor *tree_u64_cursor_open(tree_u64 *tree, uint64_t lo);
+size_t tree_u64_cursor_next(tree_u64_cursor *cursor, uint64_t *keys, uint64_t *values, size_t max);
+void tree_u64_cursor_close(tree_u64_cursor *cursor);
+
+/* A byte string: len bytes at data. */
+typedef struct tree_slice
+{
+    const void *data;
+    size_t len;
+} tree_slice;
+
+typedef struct tree_bytes tree_bytes;
+typedef struct tree_bytes_cursor tree_bytes_cursor;
+
+tree_bytes *tree_bytes_new(void);
+void tree_bytes_free(tree_bytes *tree);
+size_t tree_bytes_size(const tree_bytes *tree);
+
+int tree_bytes_put(tree_bytes *tree, tree_slice key, tree_slice value);
+int tree_bytes_get(tree_bytes *tree, tree_slice key, tree_slice *value);
+int tree_bytes_delete(tree_bytes *tree, tree_slice key);
+
+/* As for tree_u64.  Missing keys come back from get_batch with a
+   NULL data pointer. */
+int tree_bytes_put_batch(tree_bytes *tree, const tree_slice *keys, const tree_slice *values, size_t n);
+size_t tree_bytes_get_batch(tree_bytes *tree, const tree_slice *keys, tree_slice *values, size_t n);
+size_t tree_bytes_delete_batch(tree_bytes *tree, const tree_slice *keys, size_t n);
+
+/* lo.data may be NULL to start from the first key.  The slices
+   next fills in point into the tree, and like those from get they
+   are good until the next put or delete. */
+tree_bytes_cursor *tree_bytes_cursor_open(tree_bytes *tree, tree_slice lo);
+size_t tree_bytes_cursor_next(tree_bytes_cursor *cursor, tree_slice *keys, tree_slice *values, size_t max);
+void tree_bytes_cursor_close(tree_bytes_cursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TREE_CAPI_H */
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tree_capi.h"
+
+static tree_slice slice(const char *s)
+{
+    return tree_slice{s, std::strlen(s)};
+}
+
+static std::string str(tree_slice s)
+{
+    return std::string((const char *)s.data, s.len);
+}
+
+TEST(CapiTest, U64)
+{
+    tree_u64 *t = tree_u64_new();
+    tree_u64_put(t, 5, 50);
+    uint64_t value = 0;
+    EXPECT_EQ(tree_u64_get(t, 5, &value), 1);
+    EXPECT_EQ(value, 50u);
+    EXPECT_EQ(tree_u64_get(t, 6, &value), 0);
+
+    std::vector<uint64_t> keys = {9, 1, 7, 3, 9}, values = {90, 10, 70, 30, 91};
+    tree_u64_put_batch(t, keys.data(), values.data(), keys.size());
+    EXPECT_EQ(tree_u64_size(t), 5u);
+
+    std::vector<uint64_t> want = {1, 2, 9}, got(3);
+    unsigned char found[3];
+    EXPECT_EQ(tree_u64_get_batch(t, want.data(), got.data(), found, 3), 2u);
+    EXPECT_EQ(found[0], 1);
+    EXPECT_EQ(found[1], 0);
+    EXPECT_EQ(got[2], 91u);
+
+    uint64_t out_keys[2], out_values[2];
+    std::vector<uint64_t> scanned;
+    tree_u64_cursor *c = tree_u64_cursor_open(t, 4);
+    size_t n;
+    while ((n = tree_u64_cursor_next(c, out_keys, out_values, 2)) > 0)
+        scanned.insert(scanned.end(), out_keys, out_keys + n);
+    tree_u64_cursor_close(c);
+    EXPECT_EQ(scanned, std::vector<uint64_t>({5, 7, 9}));
+
+    // An insert ends an open scan; changing a value doesn't.
+    c = tree_u64_cursor_open(t, 0);
+    EXPECT_EQ(tree_u64_cursor_next(c, out_keys, out_values, 1), 1u);
+    EXPECT_EQ(tree_u64_put(t, 5, 51), 0);
+    EXPECT_EQ(tree_u64_cursor_next(c, out_keys, out_values, 1), 1u);
+    EXPECT_EQ(tree_u64_put(t, 6, 60), 0);
+    EXPECT_EQ(tree_u64_cursor_next(c, out_keys, out_values, 2), 0u);
+    tree_u64_cursor_close(c);
+    EXPECT_EQ(tree_u64_delete(t, 6), 1);
+
+    std::vector<uint64_t> gone = {1, 2, 3};
+    EXPECT_EQ(tree_u64_delete_batch(t, gone.data(), gone.size()), 2u);
+    EXPECT_EQ(tree_u64_delete(t, 5), 1);
+    EXPECT_EQ(tree_u64_delete(t, 5), 0);
+    EXPECT_EQ(tree_u64_size(t), 2u);
+    tree_u64_free(t);
+}
+
+TEST(CapiTest, Bytes)
+{
+    tree_bytes *t = tree_bytes_new();
+    tree_bytes_put(t, slice("b"), slice("bee"));
+    std::vector<tree_slice> keys = {slice("c"), slice("a"), slice("b")};
+    std::vector<tree_slice> values = {slice("sea"), slice("ay"), slice("be")};
+    tree_bytes_put_batch(t, keys.data(), values.data(), keys.size());
+    EXPECT_EQ(tree_bytes_size(t), 3u);
+
+    tree_slice value;
+    EXPECT_EQ(tree_bytes_get(t, slice("b"), &value), 1);
+    EXPECT_EQ(str(value), "be");
+    std::vector<tree_slice> want = {slice("a"), slice("zz")}, got(2);
+    EXPECT_EQ(tree_bytes_get_batch(t, want.data(), got.data(), 2), 1u);
+    EXPECT_EQ(str(got[0]), "ay");
+    EXPECT_EQ(got[1].data, nullptr);
+
+    tree_slice out_keys[8], out_values[8];
+    tree_bytes_cursor *c = tree_bytes_cursor_open(t, tree_slice{nullptr, 0});
+    EXPECT_EQ(tree_bytes_cursor_next(c, out_keys, out_values, 8), 3u);
+    EXPECT_EQ(str(out_keys[0]) + str(out_keys[1]) + str(out_keys[2]), "abc");
+    tree_bytes_cursor_close(c);
+
+    // Changing the tree ends any open scan, whether or not the
+    // iterators are checked.
+    c = tree_bytes_cursor_open(t, slice("b"));
+    EXPECT_EQ(tree_bytes_cursor_next(c, out_keys, out_values, 1), 1u);
+    EXPECT_EQ(tree_bytes_delete(t, slice("a")), 1);
+    EXPECT_EQ(tree_bytes_cursor_next(c, out_keys, out_values, 8), 0u);
+    EXPECT_EQ(tree_bytes_cursor_next(c, out_keys, out_values, 8), 0u);
+    tree_bytes_cursor_close(c);
+    EXPECT_EQ(tree_bytes_delete_batch(t, keys.data(), keys.size()), 2u);
+    EXPECT_EQ(tree_bytes_size(t), 0u);
+    tree_bytes_free(t);
+}
+
+// A slice from get survives other reads, but an overwrite of the
+// same key (which adds no key) can move the value, so it has to
+// be looked up again.
+TEST(CapiTest, SlicesLastUntilTheNextPut)
+{
+    tree_bytes *t = tree_bytes_new();
+    tree_bytes_put(t, slice("k"), slice("short"));
+    tree_bytes_put(t, slice("j"), slice("other"));
+    tree_slice value, other;
+    ASSERT_EQ(tree_bytes_get(t, slice("k"), &value), 1);
+    ASSERT_EQ(tree_bytes_get(t, slice("j"), &other), 1);
+    tree_slice out_keys[4], out_values[4];
+    tree_bytes_cursor *c = tree_bytes_cursor_open(t, tree_slice{nullptr, 0});
+    EXPECT_EQ(tree_bytes_cursor_next(c, out_keys, out_values, 4), 2u);
+    tree_bytes_cursor_close(c);
+    EXPECT_EQ(str(value), "short");
+
+    std::string longer(1000, 'x');
+    EXPECT_EQ(tree_bytes_put(t, slice("k"), tree_slice{longer.data(), longer.size()}), 0);
+    EXPECT_EQ(tree_bytes_size(t), 2u);
+    ASSERT_EQ(tree_bytes_get(t, slice("k"), &value), 1);
+    EXPECT_EQ(str(value), longer);
+    ASSERT_EQ(tree_bytes_get(t, slice("j"), &other), 1);
+    EXPECT_EQ(str(other), "other");
+    tree_bytes_free(t);
+}
@@ -0,0 +1,268 @@
+// Change data capture for BinaryTree.  A ChangeLoggedTree
+// publishes every assignment and erase as a numbered record on a
+// lock-free ring buffer, and consumers on other threads drain the
+// records in batches and apply them to replicas (or use them to
+// keep derived indexes up to date) instead of copying the whole
+// tree every so often.
+//
+// The ring has exactly one producer (the thread writing to the
+// tree, which has to be a single thread anyway since BinaryTree
+// isn't thread safe) and one consumer.  If the consumer falls so
+// far behind that the ring fills up, records are dropped rather
+// than stalling the writer; the gap in sequence numbers tells the
+// replica it has to start over from a full copy.
+
+#ifndef TREE_CDC_HPP
+#define TREE_CDC_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "tree.hpp"
+
+enum class ChangeOp
+{
+    assign,
+    erase
+};
+
+// One change: key was set to value, or key was erased (in which
+// case value is just a default).  seq numbers count up from 1
+// with no gaps.
+template <class K, class V>
+struct ChangeRecord
+{
+    uint64_t seq = 0;
+    ChangeOp op = ChangeOp::assign;
+    K key{};
+    V value{};
+};
+
+// A single producer, single consumer ring of change records.
+template <class K, class V>
+class ChangeLog
+{
+public:
+    // The capacity is rounded up to a power of two.
+    explicit ChangeLog(size_t capacity = 1 << 16) : head(0), tail(0), dropped_count(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+        slots.resize(size);
+        mask = size - 1;
+    }
+    ChangeLog(const ChangeLog &) = delete;
+    ChangeLog &operator=(const ChangeLog &) = delete;
+
+    // Producer side.  Returns false (and counts the record as
+    // dropped) if the ring is full.
+    bool publish(ChangeRecord<K, V> record)
+    {
+        uint64_t at = tail.load(std::memory_order_relaxed);
+        if (at - head.load(std::memory_order_acquire) == slots.size())
+        {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[at & mask] = std::move(record);
+        tail.store(at + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.  Appends up to max records to out, oldest
+    // first, and returns how many that was.
+    size_t drain(std::vector<ChangeRecord<K, V>> &out, size_t max = SIZE_MAX)
+    {
+        uint64_t from = head.load(std::memory_order_relaxed);
+        uint64_t to = tail.load(std::memory_order_acquire);
+        size_t count = std::min<uint64_t>(to - from, max);
+        for (size_t i = 0; i < count; i++)
+            out.push_back(std::move(slots[(from + i) & mask]));
+        head.store(from + count, std::memory_order_release);
+        return count;
+    }
+
+    // How many records are waiting to be drained.
+    size_t pending() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    uint64_t dropped() const
+    {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::vector<ChangeRecord<K, V>> slots;
+    size_t mask;
+    // The producer and consumer each own one of these, so keep
+    // them on separate cache lines.
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint64_t> dropped_count;
+};
+
+// A BinaryTree whose changes all go out on a ChangeLog.  Since
+// BinaryTree's [] hands out a reference we would never see the
+// assignment through, this [] hands out a small proxy instead
+// which logs when it is assigned to.  Changes made some other way
+// (through tree() or an iterator) are not logged.
+template <class K, class V>
+class ChangeLoggedTree
+{
+public:
+    class Assignment
+    {
+    public:
+        Assignment &operator=(const V &value)
+        {
+            owner.assign(key, value);
+            return *this;
+        }
+        // Reading a missing key adds it with a default value,
+        // just like BinaryTree's [], and that gets logged too.
+        operator const V &() const
+        {
+            if (!owner.data.contains(key))
+                owner.assign(key, V{});
+            return owner.data[key];
+        }
+
+    private:
+        friend class ChangeLoggedTree;
+        Assignment(ChangeLoggedTree &owner, const K &key) : owner(owner), key(key)
+        {
+        }
+        ChangeLoggedTree &owner;
+        K key;
+    };
+
+    explicit ChangeLoggedTree(size_t log_capacity = 1 << 16) : changes(log_capacity), next_seq(1)
+    {
+    }
+
+    Assignment operator[](const K &key)
+    {
+        return Assignment(*this, key);
+    }
+
+    void assign(const K &key, const V &value)
+    {
+        data[key] = value;
+        changes.publish({next_seq++, ChangeOp::assign, key, value});
+    }
+
+    // Erases key, logging it only if the key was actually there.
+    void erase(const K &key)
+    {
+        if (!data.contains(key))
+            return;
+        data.erase(key);
+        changes.publish({next_seq++, ChangeOp::erase, key, V{}});
+    }
+
+    bool contains(const K &key)
+    {
+        return data.contains(key);
+    }
+
+    // The tree itself, for reading.
+    BinaryTree<K, V> &tree()
+    {
+        return data;
+    }
+
+    ChangeLog<K, V> &log()
+    {
+        return changes;
+    }
+
+    // The sequence number the next change will get.
+    uint64_t sequence() const
+    {
+        return next_seq;
+    }
+
+private:
+    BinaryTree<K, V> data;
+    ChangeLog<K, V> changes;
+    uint64_t next_seq;
+};
+
+// A read replica fed from a ChangeLog.  Each batch is folded down
+// to the last change per key, sorted, and merged into the tree with
+// BinaryTree::apply_sorted, so the top of the tree is walked once
+// per batch rather than once per change.
+template <class K, class V>
+class ChangeReplica
+{
+public:
+    ChangeReplica() : next_seq(1)
+    {
+    }
+
+    // Applies a batch of records, which must carry on from the
+    // last batch.  Throws std::runtime_error if records are
+    // missing, in which case the replica needs rebuilding from a
+    // full copy (and reset() to the sequence that copy is at).
+    void apply_batch(std::vector<ChangeRecord<K, V>> &batch)
+    {
+        if (batch.empty())
+            return;
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (batch[i].seq != next_seq + i)
+                throw std::runtime_error("Change log gap, replica needs a resync");
+        }
+        next_seq += batch.size();
+
+        // A stable sort keeps each key's changes in sequence
+        // order, so the last one for a key is the one that counts.
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const auto &a, const auto &b) { return a.key < b.key; });
+        std::vector<std::pair<K, std::optional<V>>> merged;
+        merged.reserve(batch.size());
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (i + 1 < batch.size() && !(batch[i].key < batch[i + 1].key))
+                continue;
+            if (batch[i].op == ChangeOp::assign)
+                merged.emplace_back(std::move(batch[i].key), std::move(batch[i].value));
+            else
+                merged.emplace_back(std::move(batch[i].key), std::nullopt);
+        }
+        data.apply_sorted(merged.begin(), merged.end());
+    }
+
+    // Drains everything waiting in log and applies it.
+    void catch_up(ChangeLog<K, V> &log)
+    {
+        std::vector<ChangeRecord<K, V>> batch;
+        log.drain(batch);
+        apply_batch(batch);
+    }
+
+    // After rebuilding the tree from a full copy, sets the sequence
+    // number of the first change that copy doesn't include.
+    void reset(uint64_t sequence)
+    {
+        next_seq = sequence;
+    }
+
+    BinaryTree<K, V> &tree()
+    {
+        return data;
+    }
+
+private:
+    BinaryTree<K, V> data;
+    uint64_t next_seq;
+};
+
+#endif // TREE_CDC_HPP
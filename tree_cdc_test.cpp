@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include "tree_cdc.hpp"
+
+static std::string dump(BinaryTree<int, int> &t)
+{
+    std::string res = "";
+    for (const auto &[key, value] : t)
+        res += std::to_string(key) + "=" + std::to_string(value) + " ";
+    return res;
+}
+
+TEST(CdcTest, ApplySorted)
+{
+    BinaryTree<int, int> b;
+    std::map<int, int> expect;
+    std::mt19937 rng(3);
+    for (int round = 0; round < 20; round++)
+    {
+        std::map<int, std::optional<int>> batch;
+        for (int i = 0; i < 50; i++)
+        {
+            int k = rng() % 200;
+            if (rng() % 3)
+                batch[k] = (int)(rng() % 1000);
+            else
+                batch[k] = std::nullopt;
+        }
+        std::vector<std::pair<int, std::optional<int>>> sorted(batch.begin(), batch.end());
+        b.apply_sorted(sorted.begin(), sorted.end());
+        for (auto &[k, v] : sorted)
+        {
+            if (v)
+                expect[k] = *v;
+            else
+                expect.erase(k);
+        }
+        EXPECT_EQ(b.size(), expect.size());
+        auto it = expect.begin();
+        for (const auto &[key, value] : b)
+        {
+            ASSERT_NE(it, expect.end());
+            EXPECT_EQ(key, it->first);
+            EXPECT_EQ(value, it->second);
+            ++it;
+        }
+    }
+}
+
+TEST(CdcTest, ReplicaFollowsLog)
+{
+    ChangeLoggedTree<int, int> primary;
+    ChangeReplica<int, int> replica;
+    primary[1] = 10;
+    primary[2] = 20;
+    primary.assign(3, 30);
+    primary[2] = 21;
+    primary.erase(1);
+    primary.erase(99);
+    int read = primary[4];
+    EXPECT_EQ(read, 0);
+    EXPECT_EQ(primary.log().pending(), 6u);
+
+    replica.catch_up(primary.log());
+    EXPECT_EQ(dump(replica.tree()), dump(primary.tree()));
+    EXPECT_EQ(dump(replica.tree()), "2=21 3=30 4=0 ");
+
+    // A gap means the replica has to resync.
+    std::vector<ChangeRecord<int, int>> late = {{100, ChangeOp::assign, 5, 5}};
+    EXPECT_THROW(replica.apply_batch(late), std::runtime_error);
+}
+
+TEST(CdcTest, OverflowIsReported)
+{
+    ChangeLoggedTree<int, int> primary(4);
+    for (int i = 0; i < 6; i++)
+        primary[i] = i;
+    EXPECT_EQ(primary.log().dropped(), 2u);
+    ChangeReplica<int, int> replica;
+    replica.catch_up(primary.log());
+    primary[9] = 9;
+    EXPECT_THROW(replica.catch_up(primary.log()), std::runtime_error);
+}
+
+TEST(CdcTest, ConcurrentConsumer)
+{
+    ChangeLoggedTree<int, int> primary(1 << 20);
+    ChangeReplica<int, int> replica;
+    std::atomic<bool> done{false};
+    std::thread consumer([&]() {
+        while (!done.load() || primary.log().pending())
+            replica.catch_up(primary.log());
+    });
+    for (int i = 0; i < 20000; i++)
+    {
+        primary[(i * 7919) % 5000] = i;
+        if (i % 3 == 0)
+            primary.erase((i * 31) % 5000);
+    }
+    done = true;
+    consumer.join();
+    EXPECT_EQ(primary.log().dropped(), 0u);
+    EXPECT_EQ(dump(replica.tree()), dump(primary.tree()));
+}
@@ -0,0 +1,373 @@
+// A tree of string values where the values nobody has looked at
+// for a while are kept compressed.
+//
+// Every entry has an access bit that get() and assign() set.  A
+// clock hand goes round the entries in key order: entries whose
+// bit is set get it cleared and stay as they are, while entries
+// whose bit is still clear from the hand's last visit are cold.
+// Cold values are packed together, in key order, into blocks of
+// about block_size bytes, and each block is compressed with a
+// small built-in LZ77 codec.
+//
+// The hand moves clock_steps entries on every operation, so the
+// work is spread evenly: no operation pays for more than those
+// few entries plus, now and then, compressing one block.  sweep()
+// takes the hand all the way round at once, for when a pause is
+// fine (or with clock_steps 0, the only way round).
+//
+// Reading a cold value decompresses its block (the most recent
+// block is kept decompressed, so neighbouring reads are cheap) and
+// makes the value hot again.  A block is freed once none of its
+// values are still cold.
+
+#ifndef TREE_COLDTIER_HPP
+#define TREE_COLDTIER_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tree.hpp"
+
+// The codec: a byte oriented LZ77 in the spirit of LZ4.  The
+// output is a series of (literal length, literals, match length,
+// match offset) groups, all lengths as varints, ending with a
+// match length of zero.
+namespace tree_lz
+{
+    inline void put_varint(std::string &out, size_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((char)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((char)value);
+    }
+
+    inline size_t get_varint(const std::string &in, size_t &at)
+    {
+        size_t value = 0;
+        for (int shift = 0; at < in.size(); shift += 7)
+        {
+            unsigned char byte = in[at++];
+            value |= (size_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Truncated compressed block");
+    }
+
+    inline uint32_t read32(const char *p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline std::string compress(const std::string &in)
+    {
+        constexpr int bits = 12;
+        constexpr size_t min_match = 4, max_offset = 65535;
+        std::vector<int64_t> table(1 << bits, -1);
+        std::string out;
+        size_t n = in.size(), i = 0, anchor = 0;
+        while (i + min_match <= n)
+        {
+            uint32_t word = read32(in.data() + i);
+            size_t slot = (word * 2654435761u) >> (32 - bits);
+            int64_t candidate = table[slot];
+            table[slot] = i;
+            if (candidate < 0 || i - candidate > max_offset || read32(in.data() + candidate) != word)
+            {
+                i++;
+                continue;
+            }
+            size_t length = min_match;
+            while (i + length < n && in[candidate + length] == in[i + length])
+                length++;
+            put_varint(out, i - anchor);
+            out.append(in, anchor, i - anchor);
+            put_varint(out, length);
+            put_varint(out, i - candidate);
+            i += length;
+            anchor = i;
+        }
+        put_varint(out, n - anchor);
+        out.append(in, anchor, n - anchor);
+        put_varint(out, 0);
+        return out;
+    }
+
+    inline std::string decompress(const std::string &in)
+    {
+        std::string out;
+        size_t at = 0;
+        while (true)
+        {
+            size_t literals = get_varint(in, at);
+            if (at + literals > in.size())
+                throw std::runtime_error("Corrupt compressed block");
+            out.append(in, at, literals);
+            at += literals;
+            size_t length = get_varint(in, at);
+            if (length == 0)
+                return out;
+            size_t offset = get_varint(in, at);
+            if (offset == 0 || offset > out.size())
+                throw std::runtime_error("Corrupt compressed block");
+            // Byte by byte, since a match may overlap its own output.
+            size_t from = out.size() - offset;
+            for (size_t j = 0; j < length; j++)
+                out.push_back(out[from + j]);
+        }
+    }
+}
+
+template <class K>
+class ColdValueTree
+{
+    static constexpr uint32_t hot = UINT32_MAX;
+
+    struct Slot
+    {
+        std::string value;   // The value, while hot.
+        uint32_t block = hot; // Otherwise the block it's in...
+        uint32_t index = 0;  // ...and where in the block.
+        bool accessed = true;
+    };
+
+    struct Block
+    {
+        std::string compressed;
+        size_t live = 0; // Values in here that are still cold.
+    };
+
+public:
+    explicit ColdValueTree(size_t clock_steps = 0, size_t block_size = 64 * 1024)
+        : clock_steps(clock_steps), block_size(block_size), pending_bytes(0), cached_block(hot)
+    {
+    }
+
+    void assign(const K &key, const std::string &value)
+    {
+        Slot &slot = data[key];
+        release(slot);
+        slot.value = value;
+        slot.accessed = true;
+        tick();
+    }
+
+    // The value for key, or null.  A cold value is decompressed
+    // and becomes hot again.  The pointer is good until the next
+    // call that changes the tree or sweeps.
+    const std::string *get(const K &key)
+    {
+        Slot *slot = data.get(key);
+        if (!slot)
+            return nullptr;
+        if (slot->block != hot)
+        {
+            std::string value = cold_value(slot->block, slot->index);
+            release(*slot);
+            slot->value = std::move(value);
+        }
+        slot->accessed = true;
+        tick();
+        return &slot->value;
+    }
+
+    bool contains(const K &key)
+    {
+        return data.contains(key);
+    }
+
+    void erase(const K &key)
+    {
+        Slot *slot = data.get(key);
+        if (!slot)
+            return;
+        release(*slot);
+        data.erase(key);
+        tick();
+    }
+
+    size_t size() const
+    {
+        return data.size();
+    }
+
+    // One whole turn of the clock, starting from the first key:
+    // clear the access bit of every hot entry that has it, and
+    // compress the ones that don't.
+    void sweep()
+    {
+        hand.reset();
+        pending.clear();
+        pending_bytes = 0;
+        advance(SIZE_MAX);
+    }
+
+    // Bytes held by hot values, and by compressed blocks.
+    size_t hot_bytes()
+    {
+        size_t total = 0;
+        for (const auto &[key, slot] : data)
+            total += slot.block == hot ? slot.value.capacity() : 0;
+        return total;
+    }
+    size_t cold_bytes() const
+    {
+        size_t total = 0;
+        for (const auto &block : blocks)
+            total += block ? block->compressed.size() : 0;
+        return total;
+    }
+
+    bool is_cold(const K &key)
+    {
+        Slot *slot = data.get(key);
+        return slot && slot->block != hot;
+    }
+
+private:
+    void tick()
+    {
+        if (clock_steps)
+            advance(clock_steps);
+    }
+
+    // Moves the hand on by up to steps entries, stopping early at
+    // the end of a turn.  Cold values are only noted as they are
+    // passed (by key, since the tree may change before the block
+    // fills) and compressed together once there are enough.
+    void advance(size_t steps)
+    {
+        auto it = hand ? data.lower_bound(*hand) : data.begin();
+        if (hand && it != std::default_sentinel && !(*hand < (*it).first))
+            ++it;
+        for (; steps > 0 && it != std::default_sentinel; steps--, ++it)
+        {
+            auto [key, slot] = *it;
+            hand = key;
+            if (slot.block != hot)
+                continue;
+            if (slot.accessed)
+            {
+                slot.accessed = false;
+                continue;
+            }
+            pending.push_back(key);
+            pending_bytes += slot.value.size();
+            if (pending_bytes >= block_size)
+                seal();
+        }
+        if (it == std::default_sentinel)
+        {
+            seal();
+            hand.reset();
+        }
+    }
+
+    // Compresses the pending values into a new block, skipping any
+    // that were used, changed or erased since the hand passed them.
+    void seal()
+    {
+        std::string raw;
+        std::vector<Slot *> members;
+        for (const K &key : pending)
+        {
+            Slot *slot = data.get(key);
+            if (!slot || slot->block != hot || slot->accessed)
+                continue;
+            tree_lz::put_varint(raw, slot->value.size());
+            raw += slot->value;
+            members.push_back(slot);
+        }
+        pending.clear();
+        pending_bytes = 0;
+        if (members.empty())
+            return;
+        uint32_t id = new_block();
+        blocks[id]->compressed = tree_lz::compress(raw);
+        blocks[id]->live = members.size();
+        for (uint32_t i = 0; i < members.size(); i++)
+        {
+            members[i]->block = id;
+            members[i]->index = i;
+            std::string().swap(members[i]->value);
+        }
+    }
+
+    // If slot is cold, it is about to stop being so: let its
+    // block know, freeing the block if it was the last one.
+    void release(Slot &slot)
+    {
+        if (slot.block == hot)
+            return;
+        uint32_t id = slot.block;
+        slot.block = hot;
+        if (--blocks[id]->live == 0)
+        {
+            blocks[id].reset();
+            free_blocks.push_back(id);
+            if (cached_block == id)
+                cached_block = hot;
+        }
+    }
+
+    uint32_t new_block()
+    {
+        if (!free_blocks.empty())
+        {
+            uint32_t id = free_blocks.back();
+            free_blocks.pop_back();
+            blocks[id] = std::make_unique<Block>();
+            return id;
+        }
+        blocks.push_back(std::make_unique<Block>());
+        return blocks.size() - 1;
+    }
+
+    // Fetches value index out of block id, via the cache of the
+    // last block we decompressed.
+    std::string cold_value(uint32_t id, uint32_t index)
+    {
+        if (cached_block != id)
+        {
+            cached = tree_lz::decompress(blocks[id]->compressed);
+            cached_offsets.clear();
+            size_t at = 0;
+            while (at < cached.size())
+            {
+                size_t length = tree_lz::get_varint(cached, at);
+                cached_offsets.push_back({at, length});
+                at += length;
+            }
+            cached_block = id;
+        }
+        return cached.substr(cached_offsets[index].first, cached_offsets[index].second);
+    }
+
+    BinaryTree<K, Slot> data;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<uint32_t> free_blocks;
+    size_t clock_steps;
+    size_t block_size;
+
+    // The last key the hand passed (none at the start of a turn),
+    // and the cold keys it has passed since the last block.
+    std::optional<K> hand;
+    std::vector<K> pending;
+    size_t pending_bytes;
+
+    uint32_t cached_block;
+    std::string cached;
+    std::vector<std::pair<size_t, size_t>> cached_offsets;
+};
+
+#endif // TREE_COLDTIER_HPP
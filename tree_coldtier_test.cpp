@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_coldtier.hpp"
+
+TEST(ColdTierTest, Codec)
+{
+    std::mt19937 rng(1);
+    std::vector<std::string> inputs = {"", "a", "abcabcabcabcabcabc", std::string(10000, 'x')};
+    std::string noise;
+    for (int i = 0; i < 5000; i++)
+        noise.push_back((char)rng());
+    inputs.push_back(noise);
+    for (const auto &in : inputs)
+        EXPECT_EQ(tree_lz::decompress(tree_lz::compress(in)), in);
+    EXPECT_LT(tree_lz::compress(inputs[3]).size(), 100u);
+    EXPECT_THROW(tree_lz::decompress("\x05"), std::runtime_error);
+}
+
+TEST(ColdTierTest, ColdValuesCompressAndComeBack)
+{
+    ColdValueTree<int> t(0, 4096);
+    auto value_for = [](int k) {
+        return "{\"user\": " + std::to_string(k) + ", \"status\": \"active\", \"plan\": \"basic\"}";
+    };
+    for (int k = 0; k < 2000; k++)
+        t.assign(k, value_for(k));
+    size_t raw = t.hot_bytes();
+
+    // The first sweep only clears the access bits...
+    t.sweep();
+    EXPECT_FALSE(t.is_cold(5));
+    t.get(5);
+    // ...and the second compresses everything not used since.
+    t.sweep();
+    EXPECT_FALSE(t.is_cold(5));
+    EXPECT_TRUE(t.is_cold(6));
+    EXPECT_GT(t.cold_bytes(), 0u);
+    EXPECT_LT(t.cold_bytes() * 3, raw);
+
+    for (int k = 0; k < 2000; k += 7)
+    {
+        ASSERT_NE(t.get(k), nullptr);
+        EXPECT_EQ(*t.get(k), value_for(k));
+        EXPECT_FALSE(t.is_cold(k));
+    }
+    t.assign(8, "new");
+    EXPECT_EQ(*t.get(8), "new");
+    t.erase(9);
+    EXPECT_EQ(t.get(9), nullptr);
+    EXPECT_EQ(t.size(), 1999u);
+
+    // Once every value in a block has come back, the block goes.
+    for (int k = 0; k < 2000; k++)
+        t.get(k);
+    EXPECT_EQ(t.cold_bytes(), 0u);
+}
+
+TEST(ColdTierTest, AutomaticSweeps)
+{
+    ColdValueTree<int> t(16);
+    for (int k = 0; k < 1000; k++)
+        t.assign(k, std::string(100, 'a' + k % 26));
+    EXPECT_TRUE(t.is_cold(0));
+    EXPECT_EQ(*t.get(0), std::string(100, 'a'));
+}
+
+// The clock moves a few entries per operation, so no single
+// lookup ends up compressing the whole tree.
+TEST(ColdTierTest, NoOperationSweepsEverything)
+{
+    ColdValueTree<int> t(16, 256);
+    auto cold = [&] {
+        int n = 0;
+        for (int k = 0; k < 2000; k++)
+            n += t.is_cold(k);
+        return n;
+    };
+    std::vector<int> keys(2000);
+    for (int k = 0; k < 2000; k++)
+        keys[k] = k;
+    std::mt19937 rng(4);
+    for (int round = 0; round < 2; round++)
+    {
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (int k : keys)
+            t.assign(k, std::string(100, 'a' + k % 26));
+    }
+    int most = 0;
+    for (int i = 0; i < 500; i++)
+    {
+        int before = cold();
+        t.get(1999);
+        int after = cold();
+        most = std::max(most, after - before);
+    }
+    // At most the entries passed this time, plus the two or three
+    // from earlier operations that complete a block with them.
+    EXPECT_GT(most, 0);
+    EXPECT_LE(most, 16 + 3);
+    // And in the end everything else does go cold.
+    EXPECT_EQ(cold(), 1999);
+    EXPECT_EQ(*t.get(0), std::string(100, 'a'));
+}
@@ -0,0 +1,261 @@
+// Two ways to share one BinaryTree between threads.
+//
+// LockedTree is the obvious one: a mutex around every call.  Under
+// contention most of the time goes on handing the lock from thread
+// to thread rather than on the tree itself.
+//
+// CombiningTree uses flat combining instead.  Each thread gets a
+// slot (through a Handle) and posts its operation there.  Whichever
+// thread gets the lock becomes the combiner: it collects every
+// pending operation from all the slots, sorts them by key, runs
+// them against the tree in that order (so consecutive operations
+// share the top of the tree in cache) and posts each result back
+// to its slot.  The other threads just wait for their slot to say
+// done, so the lock changes hands once per batch instead of once
+// per operation.
+
+#ifndef TREE_COMBINING_HPP
+#define TREE_COMBINING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+template <class K, class V>
+class LockedTree
+{
+public:
+    void assign(const K &key, const V &value)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        tree[key] = value;
+    }
+
+    void erase(const K &key)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        tree.erase(key);
+    }
+
+    bool contains(const K &key)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return tree.contains(key);
+    }
+
+    std::optional<V> get(const K &key)
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        V *value = tree.get(key);
+        return value ? std::optional<V>(*value) : std::nullopt;
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        return tree.size();
+    }
+
+private:
+    std::mutex lock;
+    BinaryTree<K, V> tree;
+};
+
+template <class K, class V>
+class CombiningTree
+{
+    enum class Op
+    {
+        assign,
+        erase,
+        get
+    };
+
+    enum State
+    {
+        free_slot,
+        idle,
+        pending,
+        done
+    };
+
+    // One per thread, on its own cache line so that threads
+    // waiting on their slots don't disturb each other.
+    struct alignas(64) Slot
+    {
+        std::atomic<int> state{free_slot};
+        Op op = Op::get;
+        K key{};
+        V value{};
+        std::optional<V> result;
+        // What the operation threw, if it did, for its own thread
+        // to rethrow.
+        std::exception_ptr error;
+    };
+
+public:
+    // A thread's way in to the tree.  Each thread that uses the
+    // tree needs its own, and a Handle must not be shared.
+    class Handle
+    {
+    public:
+        Handle(const Handle &) = delete;
+        Handle &operator=(const Handle &) = delete;
+        Handle(Handle &&other) noexcept : owner(other.owner), slot(other.slot)
+        {
+            other.slot = nullptr;
+        }
+        ~Handle()
+        {
+            if (slot)
+                slot->state.store(free_slot, std::memory_order_release);
+        }
+
+        void assign(const K &key, const V &value)
+        {
+            owner->run(*slot, Op::assign, key, &value);
+        }
+
+        void erase(const K &key)
+        {
+            owner->run(*slot, Op::erase, key, nullptr);
+        }
+
+        bool contains(const K &key)
+        {
+            return get(key).has_value();
+        }
+
+        std::optional<V> get(const K &key)
+        {
+            owner->run(*slot, Op::get, key, nullptr);
+            return std::move(slot->result);
+        }
+
+    private:
+        friend class CombiningTree;
+        Handle(CombiningTree *owner, Slot *slot) : owner(owner), slot(slot)
+        {
+        }
+
+        CombiningTree *owner;
+        Slot *slot;
+    };
+
+    // max_threads is how many Handles can be out at once.
+    explicit CombiningTree(size_t max_threads = 64) : slots(new Slot[max_threads]), slot_count(max_threads)
+    {
+        batch.reserve(max_threads);
+    }
+    CombiningTree(const CombiningTree &) = delete;
+    CombiningTree &operator=(const CombiningTree &) = delete;
+
+    Handle handle()
+    {
+        for (size_t i = 0; i < slot_count; i++)
+        {
+            int expected = free_slot;
+            if (slots[i].state.compare_exchange_strong(expected, idle, std::memory_order_acquire))
+                return Handle(this, &slots[i]);
+        }
+        throw std::runtime_error("CombiningTree has no free slots");
+    }
+
+    // Only safe when no other thread is using the tree.
+    size_t size() const
+    {
+        return tree.size();
+    }
+
+private:
+    void run(Slot &slot, Op op, const K &key, const V *value)
+    {
+        slot.op = op;
+        slot.key = key;
+        if (value)
+            slot.value = *value;
+        slot.state.store(pending, std::memory_order_release);
+        for (int spins = 0; slot.state.load(std::memory_order_acquire) != done; spins++)
+        {
+            std::unique_lock<std::mutex> hold(lock, std::try_to_lock);
+            if (hold.owns_lock())
+                combine();
+            else if (spins > 64)
+                std::this_thread::yield();
+        }
+        slot.state.store(idle, std::memory_order_relaxed);
+        if (slot.error)
+            std::rethrow_exception(std::exchange(slot.error, nullptr));
+    }
+
+    // Runs everything pending, a few rounds in case more comes in
+    // while we work.  Called with the lock held.
+    void combine()
+    {
+        for (int round = 0; round < 3; round++)
+        {
+            batch.clear();
+            for (size_t i = 0; i < slot_count; i++)
+            {
+                if (slots[i].state.load(std::memory_order_acquire) == pending)
+                    batch.push_back(&slots[i]);
+            }
+            if (batch.empty())
+                return;
+            // A thread never has two operations pending, so equal
+            // keys come from different threads and can go in any order.
+            std::sort(batch.begin(), batch.end(), [](const Slot *a, const Slot *b) { return a->key < b->key; });
+            for (Slot *slot : batch)
+            {
+                // An operation that throws (out of memory, or a
+                // throwing copy of V) fails only itself: the error
+                // goes back to its thread and the batch carries on.
+                try
+                {
+                    apply(*slot);
+                }
+                catch (...)
+                {
+                    slot->error = std::current_exception();
+                }
+                slot->state.store(done, std::memory_order_release);
+            }
+        }
+    }
+
+    void apply(Slot &slot)
+    {
+        switch (slot.op)
+        {
+        case Op::assign:
+            tree[slot.key] = slot.value;
+            break;
+        case Op::erase:
+            tree.erase(slot.key);
+            break;
+        case Op::get:
+        {
+            V *found = tree.get(slot.key);
+            slot.result = found ? std::optional<V>(*found) : std::nullopt;
+            break;
+        }
+        }
+    }
+
+    std::mutex lock;
+    BinaryTree<K, V> tree;
+    std::unique_ptr<Slot[]> slots;
+    size_t slot_count;
+    std::vector<Slot *> batch;
+};
+
+#endif // TREE_COMBINING_HPP
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "tree_combining.hpp"
+
+TEST(CombiningTest, SingleThread)
+{
+    CombiningTree<int, int> t;
+    auto h = t.handle();
+    for (int i = 0; i < 100; i++)
+        h.assign(i, i * 2);
+    h.erase(50);
+    EXPECT_EQ(t.size(), 99u);
+    EXPECT_FALSE(h.contains(50));
+    EXPECT_EQ(h.get(7), 14);
+    EXPECT_EQ(h.get(500), std::nullopt);
+}
+
+TEST(CombiningTest, ManyThreads)
+{
+    const int threads = 8, per_thread = 2000;
+    CombiningTree<uint64_t, uint64_t> t(threads);
+    LockedTree<uint64_t, uint64_t> l;
+    std::vector<std::thread> workers;
+    for (int id = 0; id < threads; id++)
+    {
+        workers.emplace_back([&, id]() {
+            auto h = t.handle();
+            // Each thread owns the keys equal to id mod threads, so
+            // it can check its own reads exactly.
+            for (uint64_t i = 0; i < per_thread; i++)
+            {
+                uint64_t key = i * threads + id;
+                h.assign(key, key + 1);
+                l.assign(key, key + 1);
+                ASSERT_EQ(h.get(key), key + 1);
+                if (i % 3 == 0)
+                {
+                    h.erase(key);
+                    l.erase(key);
+                    ASSERT_FALSE(h.contains(key));
+                }
+            }
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    EXPECT_EQ(t.size(), l.size());
+    auto h = t.handle();
+    for (uint64_t key = 0; key < threads * per_thread; key++)
+        ASSERT_EQ(h.get(key), l.get(key));
+}
+
+TEST(CombiningTest, RunsOutOfSlots)
+{
+    CombiningTree<int, int> t(2);
+    auto a = t.handle();
+    {
+        auto b = t.handle();
+        EXPECT_THROW(t.handle(), std::runtime_error);
+    }
+    // b gave its slot back.
+    auto c = t.handle();
+    c.assign(1, 1);
+    EXPECT_TRUE(a.contains(1));
+}
+
+// A value whose default constructor can be made to throw, as if
+// the tree had run out of memory making a node for it.
+static std::atomic<bool> refuse{false};
+struct Fussy
+{
+    Fussy() : v(0)
+    {
+        if (refuse)
+            throw std::runtime_error("no");
+    }
+    Fussy(int v) : v(v)
+    {
+    }
+    int v;
+};
+
+TEST(CombiningTest, ThrowingOperationsFailOnlyThemselves)
+{
+    CombiningTree<int, Fussy> t;
+    auto h = t.handle();
+    h.assign(1, Fussy(10));
+    refuse = true;
+    EXPECT_THROW(h.assign(2, Fussy(20)), std::runtime_error);
+    refuse = false;
+
+    // The lock was let go, and the error doesn't stick around.
+    std::thread other([&] {
+        auto mine = t.handle();
+        mine.assign(3, Fussy(30));
+        EXPECT_EQ(mine.get(1)->v, 10);
+    });
+    other.join();
+    h.assign(2, Fussy(20));
+    EXPECT_EQ(h.get(2)->v, 20);
+    EXPECT_EQ(t.size(), 3u);
+}
@@ -0,0 +1,556 @@
+// A read-only, disk resident copy of a BinaryTree, and an
+// asynchronous page reader to go with it.
+//
+// DiskTree::write() stores a tree's entries in key order packed
+// into 4K pages, followed by the first key of every page.  Opening
+// the file reads just that list of first keys (the "inner levels"
+// of the tree) into memory; a lookup then does its descent through
+// those in memory and only needs one page read at the bottom.
+//
+// Looking keys up one at a time serializes on those page reads.
+// get_batch() instead works out every page a batch of lookups
+// needs up front, puts all of the reads in flight at once through
+// io_uring, and finishes each lookup as its page comes in.  Range
+// scans likewise read their upcoming pages a window at a time.
+// Where io_uring isn't available (older kernels, or sandboxes that
+// block it) the same reads are done one at a time with pread.
+//
+// Keys and values have to be trivially copyable, since they are
+// written to the file as raw bytes.
+
+#ifndef TREE_DISK_HPP
+#define TREE_DISK_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "tree.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define TREE_HAVE_IO_URING 1
+#else
+#define TREE_HAVE_IO_URING 0
+#endif
+
+// One page to read: length bytes at offset in the file, into buffer.
+struct PageRead
+{
+    uint64_t offset;
+    char *buffer;
+    size_t length;
+};
+
+// Closes a file descriptor when it goes out of scope, so that
+// nothing leaks when a write throws halfway.
+struct FileCloser
+{
+    int fd;
+    ~FileCloser()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+// Reads batches of pages, using io_uring when it can.
+class PageReader
+{
+public:
+    // depth is how many reads can be in flight at once.  With
+    // try_uring false it always uses pread.
+    explicit PageReader(unsigned depth = 64, bool try_uring = true) : ring_fd(-1)
+    {
+#if TREE_HAVE_IO_URING
+        if (try_uring)
+            setup(depth);
+#else
+        (void)depth;
+        (void)try_uring;
+#endif
+    }
+    PageReader(const PageReader &) = delete;
+    PageReader &operator=(const PageReader &) = delete;
+    ~PageReader()
+    {
+#if TREE_HAVE_IO_URING
+        if (ring_fd >= 0)
+        {
+            munmap(sq_ring, sq_ring_size);
+            if (cq_ring != sq_ring)
+                munmap(cq_ring, cq_ring_size);
+            munmap(sqes, sqes_size);
+            close(ring_fd);
+        }
+#endif
+    }
+
+    bool uring() const
+    {
+        return ring_fd >= 0;
+    }
+
+    // Reads every page in reads from fd, calling done(i) as read i
+    // completes (in whatever order they complete).  Throws
+    // std::runtime_error if a read fails or comes up short.
+    template <class F>
+    void read(int fd, const std::vector<PageRead> &reads, F done)
+    {
+#if TREE_HAVE_IO_URING
+        if (ring_fd >= 0)
+            return read_uring(fd, reads, done);
+#endif
+        for (size_t i = 0; i < reads.size(); i++)
+        {
+            check(pread_page(fd, reads[i]), reads[i]);
+            done(i);
+        }
+    }
+
+private:
+    // pread, with failures as -errno the way io_uring reports them.
+    static long pread_page(int fd, const PageRead &read)
+    {
+        long got = pread(fd, read.buffer, read.length, read.offset);
+        return got < 0 ? -errno : got;
+    }
+
+    static void check(long result, const PageRead &read)
+    {
+        if (result < 0)
+            throw std::runtime_error("Page read failed at offset " + std::to_string(read.offset) + ": " +
+                                     std::strerror(-result));
+        if (result != (long)read.length)
+            throw std::runtime_error("Page read failed at offset " + std::to_string(read.offset));
+    }
+
+#if TREE_HAVE_IO_URING
+    // Sets up the submission and completion rings, leaving ring_fd
+    // at -1 if the kernel says no.
+    void setup(unsigned depth)
+    {
+        io_uring_params params{};
+        int fd = syscall(__NR_io_uring_setup, depth, &params);
+        if (fd < 0)
+            return;
+        if (!can_read(fd))
+        {
+            close(fd);
+            return;
+        }
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+        {
+            close(fd);
+            return;
+        }
+        cq_ring = sq_ring;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+        {
+            cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+            {
+                munmap(sq_ring, sq_ring_size);
+                close(fd);
+                return;
+            }
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+        {
+            munmap(sq_ring, sq_ring_size);
+            if (cq_ring != sq_ring)
+                munmap(cq_ring, cq_ring_size);
+            close(fd);
+            return;
+        }
+        char *sq = (char *)sq_ring, *cq = (char *)cq_ring;
+        sq_head = (unsigned *)(sq + params.sq_off.head);
+        sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + params.sq_off.array);
+        cq_head = (unsigned *)(cq + params.cq_off.head);
+        cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        slots = params.sq_entries;
+        ring_fd = fd;
+    }
+
+    template <class F>
+    void read_uring(int fd, const std::vector<PageRead> &reads, F &done)
+    {
+        // Once anything goes wrong nothing more is queued, but the
+        // reads already in flight are still written into the
+        // caller's buffers, so they are all waited for (and their
+        // completions taken off the ring) before throwing.
+        std::exception_ptr failure;
+        size_t next = 0, in_flight = 0;
+        unsigned unsubmitted = 0;
+        while (in_flight || (!failure && next < reads.size()))
+        {
+            // Queue up as many reads as there is room for...
+            unsigned tail = *sq_tail;
+            while (!failure && next < reads.size() && in_flight + unsubmitted < slots)
+            {
+                unsigned index = tail & sq_mask;
+                io_uring_sqe &sqe = sqes[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fd;
+                sqe.addr = (uint64_t)reads[next].buffer;
+                sqe.len = reads[next].length;
+                sqe.off = reads[next].offset;
+                sqe.user_data = next;
+                sq_array[index] = index;
+                tail++;
+                unsubmitted++;
+                next++;
+            }
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            // ...then hand them over and wait for at least one.
+            long entered;
+            do
+            {
+                entered = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            } while (entered < 0 && errno == EINTR);
+            if (entered >= 0)
+            {
+                in_flight += entered;
+                unsubmitted -= entered;
+            }
+            else
+            {
+                if (!failure)
+                    failure = std::make_exception_ptr(std::runtime_error("io_uring_enter failed"));
+                // Take back whatever the kernel hasn't picked up, so
+                // a later read() doesn't submit it, and wait for the
+                // rest by watching the ring.
+                __atomic_store_n(sq_tail, __atomic_load_n(sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+                unsubmitted = 0;
+                while (in_flight && *cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+                    sched_yield();
+            }
+
+            unsigned head = *cq_head;
+            while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe &cqe = cqes[head & cq_mask];
+                size_t i = cqe.user_data;
+                long result = cqe.res;
+                head++;
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+                in_flight--;
+                if (failure)
+                    continue;
+                try
+                {
+                    // Kernels before 5.6 don't know IORING_OP_READ;
+                    // setup() checks, but just in case, do it by hand.
+                    if (result == -EINVAL)
+                        result = pread_page(fd, reads[i]);
+                    check(result, reads[i]);
+                    done(i);
+                }
+                catch (...)
+                {
+                    failure = std::current_exception();
+                }
+            }
+        }
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+    // Whether the kernel can do IORING_OP_READ.  The probe itself
+    // is newer than io_uring, so kernels without it (before 5.6)
+    // don't have the opcode either.
+    static bool can_read(int fd)
+    {
+        constexpr unsigned ops = 256;
+        std::vector<char> space(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op), 0);
+        auto *probe = (io_uring_probe *)space.data();
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, ops) < 0)
+            return false;
+        return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    unsigned sq_mask = 0, cq_mask = 0, slots = 0;
+#endif
+    int ring_fd;
+};
+
+template <class K, class V>
+class DiskTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "DiskTree stores keys and values as raw bytes");
+
+    struct Entry
+    {
+        K key;
+        V value;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t count;
+        uint64_t per_page;
+        uint64_t pages;
+        uint64_t entry_size;
+    };
+
+public:
+    static constexpr size_t page_size = 4096;
+    static constexpr size_t per_page = page_size / sizeof(Entry);
+    static_assert(per_page > 0, "Entries must fit in a page");
+
+    // Writes the contents of tree to path.  The file is one header
+    // page, then the entries in key order packed into pages, then
+    // the first key of every page.
+    template <class Tree>
+    static void write(const std::string &path, Tree &tree)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Can't create " + path);
+        FileCloser closer{fd};
+        std::vector<char> page(page_size, 0);
+        std::vector<K> fences;
+        uint64_t count = 0;
+        size_t used = 0;
+        auto flush = [&]() {
+            if (::write(fd, page.data(), page_size) != (ssize_t)page_size)
+                throw std::runtime_error("Short write to " + path);
+            std::fill(page.begin(), page.end(), 0);
+            used = 0;
+        };
+        flush(); // Room for the header, filled in at the end.
+        for (const auto &[key, value] : tree)
+        {
+            if (used == 0)
+                fences.push_back(key);
+            Entry entry{key, value};
+            std::memcpy(page.data() + used * sizeof(Entry), &entry, sizeof(Entry));
+            count++;
+            if (++used == per_page)
+                flush();
+        }
+        if (used)
+            flush();
+        size_t fence_bytes = fences.size() * sizeof(K);
+        if (fence_bytes && ::write(fd, fences.data(), fence_bytes) != (ssize_t)fence_bytes)
+            throw std::runtime_error("Short write to " + path);
+        Header header{{'B', 'T', 'R', 'E', 'E', 'D', 'S', 'K'}, count, per_page, fences.size(), sizeof(Entry)};
+        if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+            throw std::runtime_error("Short write to " + path);
+    }
+
+    // Opens a file written by write().  With try_uring false, reads
+    // always use pread.
+    explicit DiskTree(const std::string &path, bool try_uring = true, unsigned depth = 64)
+        : reader(depth, try_uring), window(depth)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Can't open " + path);
+        Header header;
+        if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            std::memcmp(header.magic, "BTREEDSK", 8) != 0 ||
+            header.per_page != per_page || header.entry_size != sizeof(Entry))
+        {
+            ::close(fd);
+            throw std::runtime_error(path + " is not a DiskTree file of this type");
+        }
+        count = header.count;
+        fences.resize(header.pages);
+        size_t fence_bytes = fences.size() * sizeof(K);
+        if (fence_bytes && pread(fd, fences.data(), fence_bytes, (header.pages + 1) * page_size) != (ssize_t)fence_bytes)
+        {
+            ::close(fd);
+            throw std::runtime_error("Truncated DiskTree file " + path);
+        }
+    }
+    DiskTree(const DiskTree &) = delete;
+    DiskTree &operator=(const DiskTree &) = delete;
+    ~DiskTree()
+    {
+        ::close(fd);
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool uring() const
+    {
+        return reader.uring();
+    }
+
+    // A single lookup, one synchronous page read.
+    std::optional<V> get(const K &key)
+    {
+        size_t page = page_for(key);
+        if (page == npos)
+            return std::nullopt;
+        std::vector<char> buffer(page_size);
+        std::vector<PageRead> reads{{offset(page), buffer.data(), page_size}};
+        reader.read(fd, reads, [](size_t) {});
+        return search(buffer.data(), page, key);
+    }
+
+    // Looks up every key in keys, with all of the page reads in
+    // flight together.  Each lookup is finished off as soon as the
+    // page it needs arrives.
+    std::vector<std::optional<V>> get_batch(const std::vector<K> &keys)
+    {
+        std::vector<std::optional<V>> results(keys.size());
+        std::vector<std::pair<size_t, size_t>> wants; // (page, which key)
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            size_t page = page_for(keys[i]);
+            if (page != npos)
+                wants.push_back({page, i});
+        }
+        std::sort(wants.begin(), wants.end());
+
+        // One read per distinct page, remembering which run of
+        // wants is waiting on it.
+        std::vector<char> buffers;
+        std::vector<PageRead> reads;
+        std::vector<std::pair<size_t, size_t>> waiting;
+        for (size_t i = 0; i < wants.size(); i++)
+        {
+            if (i == 0 || wants[i].first != wants[i - 1].first)
+            {
+                reads.push_back({offset(wants[i].first), nullptr, page_size});
+                waiting.push_back({i, i});
+            }
+            waiting.back().second = i + 1;
+        }
+        buffers.resize(reads.size() * page_size);
+        for (size_t i = 0; i < reads.size(); i++)
+            reads[i].buffer = buffers.data() + i * page_size;
+
+        reader.read(fd, reads, [&](size_t r) {
+            for (size_t w = waiting[r].first; w < waiting[r].second; w++)
+                results[wants[w].second] = search(reads[r].buffer, wants[w].first, keys[wants[w].second]);
+        });
+        return results;
+    }
+
+    // Calls fn(key, value) for every entry with lo <= key < hi, in
+    // order.  The pages are read a window at a time, all of a
+    // window's reads in flight together.
+    template <class F>
+    void scan(const K &lo, const K &hi, F fn)
+    {
+        size_t first = page_for(lo);
+        if (first == npos)
+            first = 0;
+        std::vector<char> buffers(window * page_size);
+        for (size_t start = first; start < fences.size(); start += window)
+        {
+            std::vector<PageRead> reads;
+            for (size_t page = start; page < std::min(start + window, fences.size()); page++)
+            {
+                if (!(fences[page] < hi))
+                    break;
+                reads.push_back({offset(page), buffers.data() + (page - start) * page_size, page_size});
+            }
+            if (reads.empty())
+                return;
+            reader.read(fd, reads, [](size_t) {});
+            for (size_t r = 0; r < reads.size(); r++)
+            {
+                size_t page = start + r;
+                for (size_t i = 0; i < entries_on(page); i++)
+                {
+                    Entry entry;
+                    std::memcpy(&entry, reads[r].buffer + i * sizeof(Entry), sizeof(Entry));
+                    if (!(entry.key < hi))
+                        return;
+                    if (!(entry.key < lo))
+                        fn(entry.key, entry.value);
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t npos = SIZE_MAX;
+
+    // The page key would be on: the last one whose first key is
+    // not greater than it.
+    size_t page_for(const K &key) const
+    {
+        auto it = std::upper_bound(fences.begin(), fences.end(), key);
+        return it == fences.begin() ? npos : (it - fences.begin()) - 1;
+    }
+
+    static uint64_t offset(size_t page)
+    {
+        return (page + 1) * page_size;
+    }
+
+    size_t entries_on(size_t page) const
+    {
+        return std::min<size_t>(per_page, count - page * per_page);
+    }
+
+    // Binary search of one page.
+    std::optional<V> search(const char *data, size_t page, const K &key) const
+    {
+        size_t lo = 0, hi = entries_on(page);
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo) / 2;
+            Entry entry;
+            std::memcpy(&entry, data + mid * sizeof(Entry), sizeof(Entry));
+            if (entry.key < key)
+                lo = mid + 1;
+            else if (key < entry.key)
+                hi = mid;
+            else
+                return entry.value;
+        }
+        return std::nullopt;
+    }
+
+    PageReader reader;
+    size_t window;
+    int fd;
+    uint64_t count;
+    std::vector<K> fences;
+};
+
+#endif // TREE_DISK_HPP
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include "tree_disk.hpp"
+
+TEST(DiskTest, LookupsAndScans)
+{
+    std::string path = testing::TempDir() + "tree_disk_test.bin";
+    BinaryTree<uint64_t, uint64_t> b;
+    std::mt19937_64 rng(5);
+    for (int i = 0; i < 5000; i++)
+    {
+        uint64_t k = rng() % 20000;
+        b[k * 2] = k * 3;
+    }
+    DiskTree<uint64_t, uint64_t>::write(path, b);
+
+    for (bool uring : {true, false})
+    {
+        DiskTree<uint64_t, uint64_t> d(path, uring, 8);
+        if (!uring)
+        {
+            EXPECT_FALSE(d.uring());
+        }
+        EXPECT_EQ(d.size(), b.size());
+
+        std::vector<uint64_t> keys;
+        for (uint64_t k = 0; k < 40010; k += 7)
+            keys.push_back(k);
+        auto found = d.get_batch(keys);
+        ASSERT_EQ(found.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (b.contains(keys[i]))
+            {
+                ASSERT_TRUE(found[i].has_value());
+                EXPECT_EQ(*found[i], b[keys[i]]);
+            }
+            else
+            {
+                EXPECT_FALSE(found[i].has_value());
+            }
+        }
+        EXPECT_EQ(d.get(keys[3]).has_value(), b.contains(keys[3]));
+
+        std::vector<uint64_t> expect, got;
+        for (const auto &[key, value] : b)
+        {
+            if (key >= 1000 && key < 30000)
+                expect.push_back(key);
+        }
+        d.scan(1000, 30000, [&](uint64_t key, uint64_t value) {
+            EXPECT_EQ(value, key / 2 * 3);
+            got.push_back(key);
+        });
+        EXPECT_EQ(got, expect);
+    }
+    std::remove(path.c_str());
+    EXPECT_THROW((DiskTree<uint64_t, uint64_t>(path)), std::runtime_error);
+}
+
+TEST(DiskTest, FailedBatchesLeaveTheReaderClean)
+{
+    std::string path = testing::TempDir() + "tree_disk_reader_test.bin";
+    std::vector<char> data(64 * 4096);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = char(i / 4096);
+    FILE *out = std::fopen(path.c_str(), "wb");
+    ASSERT_TRUE(out);
+    std::fwrite(data.data(), 1, data.size(), out);
+    std::fclose(out);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+
+    for (bool uring : {true, false})
+    {
+        PageReader reader(8, uring);
+        std::vector<std::vector<char>> buffers(40, std::vector<char>(4096));
+        std::vector<PageRead> reads;
+        for (size_t i = 0; i < buffers.size(); i++)
+            reads.push_back({i * 4096, buffers[i].data(), 4096});
+
+        // A read past the end of the file fails the batch...
+        reads[5].offset = 1000 * 4096;
+        EXPECT_THROW(reader.read(fd, reads, [](size_t) {}), std::runtime_error);
+        // ...and so does a callback that throws.
+        reads[5].offset = 5 * 4096;
+        EXPECT_THROW(reader.read(fd, reads, [](size_t i) {
+            if (i == 3)
+                throw std::logic_error("stop");
+        }), std::logic_error);
+
+        // Neither leaves completions behind for the next batch.
+        std::vector<bool> seen(reads.size());
+        reader.read(fd, reads, [&](size_t i) {
+            EXPECT_FALSE(seen[i]);
+            seen[i] = true;
+            EXPECT_EQ(buffers[i][0], char(i));
+        });
+        EXPECT_EQ(std::count(seen.begin(), seen.end(), true), 40);
+    }
+    ::close(fd);
+    std::remove(path.c_str());
+}
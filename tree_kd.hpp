@@ -0,0 +1,307 @@
+// A k-d tree: points in D dimensions, each with a value, for box
+// queries and nearest neighbour searches.
+//
+// It is a BinaryTree underneath, keyed by the point, and uses the
+// same nodes, pool and iterator; only the order is different.  A
+// node at depth d splits on dimension d % D: points in its left
+// subtree are no bigger than it in that dimension, and points in
+// its right subtree no smaller.  Iterating visits every point
+// once, in no particular order.
+//
+// build() makes a balanced tree in one go, splitting each level at
+// the median.  insert() just walks down to a leaf, and once a leaf
+// ends up much deeper than a balanced tree would be, it rebuilds
+// the nearest subtree above the leaf that is too deep for its size,
+// scapegoat style, which keeps inserts O(log N) amortized however
+// the points arrive.  erase() rebuilds the subtree under the erased
+// point.
+
+#ifndef TREE_KD_HPP
+#define TREE_KD_HPP
+
+#include <algorithm>
+#include <array>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+template <size_t D, class V, class T = double>
+class KdTree : protected BinaryTree<std::array<T, D>, V>
+{
+public:
+    using Point = std::array<T, D>;
+
+private:
+    using Base = BinaryTree<Point, V>;
+    using Node = BinaryTreeNode<Point, V>;
+    using Base::key_of;
+    using Base::left_of;
+    using Base::right_of;
+    using Base::value_of;
+
+public:
+    KdTree() : rebuild_count(0)
+    {
+    }
+
+    using Base::begin;
+    using Base::end;
+    using Base::size;
+
+    // Replaces everything with the given points.  If a point is
+    // given twice, which value it keeps is unspecified.
+    void build(std::vector<std::pair<Point, V>> points)
+    {
+        std::sort(points.begin(), points.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        points.erase(std::unique(points.begin(), points.end(),
+                                 [](const auto &a, const auto &b) { return a.first == b.first; }),
+                     points.end());
+        clear();
+        this->pool.reserve(points.size());
+        this->root = build(points.begin(), points.end(), 0);
+        this->modified();
+    }
+
+    // Adds point, or sets its value if it is already there.
+    void insert(const Point &point, const V &value)
+    {
+        // Points equal to a split value can be on either side, so
+        // the walk down below won't always meet an existing copy.
+        if (V *found = get(point))
+        {
+            *found = value;
+            return;
+        }
+        path.clear();
+        Node **link = &this->root;
+        while (*link)
+        {
+            Node *node = *link;
+            size_t dim = path.size() % D;
+            path.push_back(link);
+            link = point[dim] < key_of(node)[dim] ? &left_of(node) : &right_of(node);
+        }
+        Node *added = this->pool.create(point);
+        value_of(added) = value;
+        *link = added;
+        this->modified();
+        if (path.size() > max_depth(this->size()))
+            rebuild_scapegoat(added);
+    }
+
+    // Removes point, if it is there, and rebuilds the subtree it
+    // was at the top of.
+    void erase(const Point &point)
+    {
+        Node **link = find(&this->root, point, 0);
+        if (!link)
+            return;
+        size_t depth = link_depth;
+        Node *node = *link;
+        std::vector<std::pair<Point, V>> rest;
+        collect(left_of(node), rest);
+        collect(right_of(node), rest);
+        left_of(node) = right_of(node) = nullptr;
+        node->freetree(this->pool);
+        *link = build(rest.begin(), rest.end(), depth);
+        this->modified();
+    }
+
+    // The value at point, or null.
+    V *get(const Point &point)
+    {
+        Node **link = find(&this->root, point, 0);
+        return link ? &value_of(*link) : nullptr;
+    }
+
+    bool contains(const Point &point)
+    {
+        return get(point) != nullptr;
+    }
+
+    // Calls fn(point, value) for every point with lo <= point <= hi
+    // in every dimension.
+    template <class F>
+    void box(const Point &lo, const Point &hi, F fn)
+    {
+        box(this->root, 0, lo, hi, fn);
+    }
+
+    // The k points nearest to query (by Euclidean distance),
+    // nearest first.
+    std::vector<std::pair<Point, V>> nearest(const Point &query, size_t k)
+    {
+        Heap heap;
+        if (k > 0)
+            nearest(this->root, 0, query, k, heap);
+        std::vector<std::pair<Point, V>> found(heap.size());
+        for (size_t i = found.size(); i-- > 0; heap.pop())
+            found[i] = {key_of(heap.top().second), value_of(heap.top().second)};
+        return found;
+    }
+
+    // How many subtrees insert() has rebuilt.
+    size_t rebuilds() const
+    {
+        return rebuild_count;
+    }
+
+private:
+    // The best k so far, by squared distance, worst on top.
+    using Heap = std::priority_queue<std::pair<T, Node *>>;
+
+    // Deep enough to be worth a rebuild for a subtree of n points:
+    // twice a balanced tree's depth, plus some slack for small trees.
+    static size_t max_depth(size_t n)
+    {
+        size_t depth = 0;
+        for (; n; n >>= 1)
+            depth++;
+        return 2 * depth + 8;
+    }
+
+    // path holds the links down to the point just added.  Walking
+    // back up, counting subtree sizes as we go, the first ancestor
+    // the new point is too far below for its subtree's size is the
+    // one to rebuild.  The root always is, if nothing lower is.
+    // Picking the nearest means a subtree of s points is only
+    // rebuilt after something like s inserts have gone into it.
+    void rebuild_scapegoat(Node *added)
+    {
+        size_t below = 1;
+        Node *child = added;
+        for (size_t i = path.size(); i-- > 0;)
+        {
+            Node *ancestor = *path[i];
+            Node *sibling = left_of(ancestor) == child ? right_of(ancestor) : left_of(ancestor);
+            below += 1 + (sibling ? Base::count_subtree(sibling) : 0);
+            if (path.size() - i > max_depth(below))
+            {
+                rebuild(path[i], i);
+                rebuild_count++;
+                return;
+            }
+            child = ancestor;
+        }
+    }
+
+    void clear()
+    {
+        if (this->root)
+            this->root->freetree(this->pool);
+        this->root = nullptr;
+    }
+
+    template <class It>
+    Node *build(It first, It last, size_t depth)
+    {
+        if (first == last)
+            return nullptr;
+        size_t dim = depth % D;
+        It mid = first + (last - first) / 2;
+        std::nth_element(first, mid, last, [dim](const auto &a, const auto &b) { return a.first[dim] < b.first[dim]; });
+        Node *node = this->pool.create(std::move(mid->first));
+        value_of(node) = std::move(mid->second);
+        left_of(node) = build(first, mid, depth + 1);
+        right_of(node) = build(mid + 1, last, depth + 1);
+        return node;
+    }
+
+    // Moves a subtree's points out and frees its nodes.
+    void collect(Node *node, std::vector<std::pair<Point, V>> &out)
+    {
+        if (!node)
+            return;
+        collect(left_of(node), out);
+        collect(right_of(node), out);
+        out.emplace_back(std::move(key_of(node)), std::move(value_of(node)));
+        this->pool.destroy(node);
+    }
+
+    void rebuild(Node **link, size_t depth)
+    {
+        std::vector<std::pair<Point, V>> points;
+        collect(*link, points);
+        *link = build(points.begin(), points.end(), depth);
+        this->modified();
+    }
+
+    // The link that holds point, or null.  A point equal to a
+    // node's split value can be on either side, so both are tried.
+    // Sets link_depth to the depth of what it returns.
+    Node **find(Node **link, const Point &point, size_t depth)
+    {
+        Node *node = *link;
+        if (!node)
+            return nullptr;
+        if (key_of(node) == point)
+        {
+            link_depth = depth;
+            return link;
+        }
+        size_t dim = depth % D;
+        Node **found = nullptr;
+        if (!(key_of(node)[dim] < point[dim]))
+            found = find(&left_of(node), point, depth + 1);
+        if (!found && !(point[dim] < key_of(node)[dim]))
+            found = find(&right_of(node), point, depth + 1);
+        return found;
+    }
+
+    template <class F>
+    void box(Node *node, size_t depth, const Point &lo, const Point &hi, F &fn)
+    {
+        while (node)
+        {
+            const Point &p = key_of(node);
+            bool inside = true;
+            for (size_t i = 0; i < D && inside; i++)
+                inside = !(p[i] < lo[i]) && !(hi[i] < p[i]);
+            if (inside)
+                fn(static_cast<const Point &>(p), value_of(node));
+            size_t dim = depth++ % D;
+            bool go_left = !(p[dim] < lo[dim]);
+            bool go_right = !(hi[dim] < p[dim]);
+            if (go_left && go_right)
+                box(left_of(node), depth, lo, hi, fn);
+            node = go_right ? right_of(node) : go_left ? left_of(node) : nullptr;
+        }
+    }
+
+    void nearest(Node *node, size_t depth, const Point &query, size_t k, Heap &heap)
+    {
+        if (!node)
+            return;
+        const Point &p = key_of(node);
+        T distance = 0;
+        for (size_t i = 0; i < D; i++)
+            distance += (p[i] - query[i]) * (p[i] - query[i]);
+        if (heap.size() < k)
+        {
+            heap.push({distance, node});
+        }
+        else if (distance < heap.top().first)
+        {
+            heap.pop();
+            heap.push({distance, node});
+        }
+        // The side query is on first, then the other side only if
+        // the splitting plane is closer than the worst we have.
+        size_t dim = depth % D;
+        T gap = query[dim] - p[dim];
+        Node *near = gap < 0 ? left_of(node) : right_of(node);
+        Node *far = gap < 0 ? right_of(node) : left_of(node);
+        nearest(near, depth + 1, query, k, heap);
+        if (heap.size() < k || gap * gap < heap.top().first)
+            nearest(far, depth + 1, query, k, heap);
+    }
+
+    size_t rebuild_count;
+    size_t link_depth = 0;
+    // insert()'s path, kept to save reallocating it every time.
+    std::vector<Node **> path;
+};
+
+#endif // TREE_KD_HPP
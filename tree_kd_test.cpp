@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <random>
+#include <map>
+#include <set>
+#include <vector>
+#include "tree_kd.hpp"
+
+namespace
+{
+    using Point = std::array<double, 3>;
+
+    double distance2(const Point &a, const Point &b)
+    {
+        double d = 0;
+        for (size_t i = 0; i < 3; i++)
+            d += (a[i] - b[i]) * (a[i] - b[i]);
+        return d;
+    }
+}
+
+TEST(KdTest, MatchesBruteForce)
+{
+    std::mt19937_64 rng(21);
+    // Small integer coordinates, so there are plenty of ties on
+    // the split values.
+    auto random_point = [&]() { return Point{double(rng() % 20), double(rng() % 20), double(rng() % 20)}; };
+
+    std::vector<std::pair<Point, int>> start;
+    for (int i = 0; i < 1000; i++)
+        start.push_back({random_point(), i});
+    KdTree<3, int> t;
+    t.build(start);
+    std::map<Point, int> m;
+    for (auto &[p, v] : start)
+        m.emplace(p, v);
+    for (auto &[p, v] : m)
+        t.insert(p, v);
+    ASSERT_EQ(t.size(), m.size());
+
+    for (int i = 0; i < 3000; i++)
+    {
+        Point p = random_point();
+        if (rng() % 2)
+        {
+            t.insert(p, i);
+            m[p] = i;
+        }
+        else
+        {
+            t.erase(p);
+            m.erase(p);
+        }
+        ASSERT_EQ(t.size(), m.size());
+    }
+    for (auto &[p, v] : m)
+        ASSERT_EQ(*t.get(p), v);
+
+    size_t seen = 0;
+    for (auto [p, v] : t)
+    {
+        EXPECT_EQ(m.at(p), v);
+        seen++;
+    }
+    EXPECT_EQ(seen, m.size());
+
+    for (int q = 0; q < 50; q++)
+    {
+        Point a = random_point(), b = random_point();
+        Point lo, hi;
+        for (size_t i = 0; i < 3; i++)
+        {
+            lo[i] = std::min(a[i], b[i]);
+            hi[i] = std::max(a[i], b[i]);
+        }
+        std::set<Point> found;
+        t.box(lo, hi, [&](const Point &p, int) { EXPECT_TRUE(found.insert(p).second); });
+        std::set<Point> expect;
+        for (auto &[p, v] : m)
+        {
+            if (p[0] >= lo[0] && p[0] <= hi[0] && p[1] >= lo[1] && p[1] <= hi[1] && p[2] >= lo[2] && p[2] <= hi[2])
+                expect.insert(p);
+        }
+        EXPECT_EQ(found, expect);
+
+        Point query{rng() % 200 / 10.0, rng() % 200 / 10.0, rng() % 200 / 10.0};
+        auto near = t.nearest(query, 10);
+        std::vector<double> brute;
+        for (auto &[p, v] : m)
+            brute.push_back(distance2(p, query));
+        std::sort(brute.begin(), brute.end());
+        ASSERT_EQ(near.size(), 10u);
+        for (size_t i = 0; i < near.size(); i++)
+        {
+            EXPECT_EQ(distance2(near[i].first, query), brute[i]);
+            EXPECT_EQ(m.at(near[i].first), near[i].second);
+        }
+    }
+}
+
+TEST(KdTest, SortedInsertsRebuild)
+{
+    KdTree<2, int> t;
+    for (int i = 0; i < 5000; i++)
+        t.insert({double(i), double(i)}, i);
+    EXPECT_GT(t.rebuilds(), 0u);
+    EXPECT_EQ(t.size(), 5000u);
+    auto near = t.nearest({2500.2, 2500.2}, 3);
+    ASSERT_EQ(near.size(), 3u);
+    EXPECT_EQ(near[0].second, 2500);
+    EXPECT_TRUE(t.nearest({0, 0}, 0).empty());
+}
@@ -0,0 +1,329 @@
+// Order preserving key encodings.
+//
+// Keys like std::tuple<std::string, int64_t, double> compare
+// through a chain of operator< calls, one per element, and
+// doubles don't even compare properly: NaN is unordered against
+// everything (which breaks the tree's assumptions), and -0.0 and
+// 0.0 are equal but have different bits.  The encodings here turn
+// such keys into something that compares with one plain operation
+// and gives the same order as the original keys:
+//
+//   - integers, floats and doubles become a uint64_t (long double
+//     doesn't fit, so it has no encoding),
+//   - anything else (strings, tuples, pairs) becomes a byte string
+//     that orders with memcmp, which std::string's operator< is.
+//
+// Signed integers have their sign bit flipped.  Floating point
+// numbers have their sign bit flipped if positive and all their
+// bits flipped if negative.  -0.0 is encoded as 0.0, and every NaN
+// as the same NaN, which sorts after +infinity, so NaN keys work
+// and are all the same key.  Strings have each 0 byte written as
+// 0 0xff and end with 0 0, so a string that is a prefix of another
+// still sorts first even when more tuple elements follow it.
+//
+// NormalizedTree is a BinaryTree keyed by the encoding, which
+// takes and hands back the original keys.  A string encoding also
+// gets the cached prefix compare from BinaryTreeKeyPrefix.
+
+#ifndef TREE_KEYS_HPP
+#define TREE_KEYS_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "tree.hpp"
+
+namespace tree_key
+{
+    // long double is left out: it has more bits than a uint64_t can
+    // hold, so distinct keys would collide.
+    template <class T>
+    inline constexpr bool is_scalar_v =
+        std::is_integral_v<T> || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+    // Scalars to and from an order preserving uint64_t.
+    template <class T>
+    uint64_t to_u64(T value)
+    {
+        static_assert(is_scalar_v<T>, "Only integers, float and double encode to an integer");
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            double d = value;
+            if (std::isnan(d))
+                d = std::numeric_limits<double>::quiet_NaN();
+            else if (d == 0)
+                d = 0.0;
+            uint64_t bits;
+            std::memcpy(&bits, &d, sizeof bits);
+            if (bits >> 63)
+                return ~bits;
+            // A NaN with its sign bit set was made positive above.
+            return bits | (uint64_t(1) << 63);
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+            return uint64_t(int64_t(value)) ^ (uint64_t(1) << 63);
+        }
+        else
+        {
+            return uint64_t(value);
+        }
+    }
+
+    template <class T>
+    T from_u64(uint64_t code)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+        {
+            uint64_t bits = code >> 63 ? code & ~(uint64_t(1) << 63) : ~code;
+            double d;
+            std::memcpy(&d, &bits, sizeof d);
+            return T(d);
+        }
+        else if constexpr (std::is_signed_v<T>)
+        {
+            return T(int64_t(code ^ (uint64_t(1) << 63)));
+        }
+        else
+        {
+            return T(code);
+        }
+    }
+
+    template <class T>
+    struct Codec;
+
+    // Scalars go into byte strings as their big-endian code, using
+    // only as many bytes as the type needs.
+    template <class T>
+    constexpr size_t scalar_bytes()
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            return 8;
+        else
+            return sizeof(T);
+    }
+
+    template <class T>
+    void put(std::string &out, const T &value)
+    {
+        Codec<T>::put(out, value);
+    }
+
+    template <class T>
+    T get(const std::string &in, size_t &at)
+    {
+        return Codec<T>::get(in, at);
+    }
+
+    template <class T>
+    struct Codec
+    {
+        static_assert(is_scalar_v<T>, "No key encoding for this type");
+
+        static void put(std::string &out, T value)
+        {
+            constexpr size_t n = scalar_bytes<T>();
+            uint64_t code;
+            // Narrow signed types are offset by their own range.
+            if constexpr (n < 8 && std::is_signed_v<T>)
+                code = uint64_t(int64_t(value) + (int64_t(1) << (8 * n - 1)));
+            else
+                code = to_u64(value);
+            for (size_t i = 0; i < n; i++)
+                out.push_back(char(code >> (8 * (n - 1 - i))));
+        }
+
+        static T get(const std::string &in, size_t &at)
+        {
+            constexpr size_t n = scalar_bytes<T>();
+            if (at + n > in.size())
+                throw std::runtime_error("Truncated key encoding");
+            uint64_t code = 0;
+            for (size_t i = 0; i < n; i++)
+                code = code << 8 | (unsigned char)in[at++];
+            if constexpr (n < 8 && std::is_signed_v<T>)
+                return T(int64_t(code) - (int64_t(1) << (8 * n - 1)));
+            else
+                return from_u64<T>(code);
+        }
+    };
+
+    template <>
+    struct Codec<std::string>
+    {
+        static void put(std::string &out, const std::string &value)
+        {
+            for (char c : value)
+            {
+                out.push_back(c);
+                if (c == 0)
+                    out.push_back(char(0xff));
+            }
+            out.push_back(0);
+            out.push_back(0);
+        }
+
+        static std::string get(const std::string &in, size_t &at)
+        {
+            std::string value;
+            while (at + 1 < in.size())
+            {
+                char c = in[at++];
+                if (c != 0)
+                {
+                    value.push_back(c);
+                    continue;
+                }
+                if (in[at++] == 0)
+                    return value;
+                value.push_back(0);
+            }
+            throw std::runtime_error("Truncated key encoding");
+        }
+    };
+
+    template <class... T>
+    struct Codec<std::tuple<T...>>
+    {
+        static void put(std::string &out, const std::tuple<T...> &value)
+        {
+            std::apply([&](const T &...parts) { (tree_key::put(out, parts), ...); }, value);
+        }
+
+        static std::tuple<T...> get(const std::string &in, size_t &at)
+        {
+            // Braces, so the parts are read left to right.
+            return std::tuple<T...>{tree_key::get<T>(in, at)...};
+        }
+    };
+
+    template <class A, class B>
+    struct Codec<std::pair<A, B>>
+    {
+        static void put(std::string &out, const std::pair<A, B> &value)
+        {
+            tree_key::put(out, value.first);
+            tree_key::put(out, value.second);
+        }
+
+        static std::pair<A, B> get(const std::string &in, size_t &at)
+        {
+            A first = tree_key::get<A>(in, at);
+            B second = tree_key::get<B>(in, at);
+            return {std::move(first), std::move(second)};
+        }
+    };
+
+    // The encoding NormalizedTree uses: an integer for scalars, a
+    // byte string for everything else.
+    template <class K>
+    using encoded_t = std::conditional_t<is_scalar_v<K>, uint64_t, std::string>;
+
+    template <class K>
+    encoded_t<K> encode(const K &key)
+    {
+        if constexpr (is_scalar_v<K>)
+        {
+            return to_u64(key);
+        }
+        else
+        {
+            std::string out;
+            put(out, key);
+            return out;
+        }
+    }
+
+    template <class K>
+    K decode(const encoded_t<K> &code)
+    {
+        if constexpr (is_scalar_v<K>)
+        {
+            return from_u64<K>(code);
+        }
+        else
+        {
+            size_t at = 0;
+            K key = get<K>(code, at);
+            if (at != code.size())
+                throw std::runtime_error("Trailing bytes in key encoding");
+            return key;
+        }
+    }
+}
+
+// A BinaryTree keyed by tree_key::encode(key).  Iteration hands
+// back decoded keys, so a NaN comes back as the canonical NaN and
+// -0.0 as 0.0.
+template <class K, class V>
+class NormalizedTree
+{
+public:
+    using encoded_type = tree_key::encoded_t<K>;
+
+    V &operator[](const K &key)
+    {
+        return data[tree_key::encode(key)];
+    }
+
+    V *get(const K &key)
+    {
+        return data.get(tree_key::encode(key));
+    }
+
+    bool contains(const K &key)
+    {
+        return data.contains(tree_key::encode(key));
+    }
+
+    void erase(const K &key)
+    {
+        data.erase(tree_key::encode(key));
+    }
+
+    size_t size() const
+    {
+        return data.size();
+    }
+
+    // Calls fn(key, value) for every key in [lo, hi), in order.
+    template <class F>
+    void scan(const K &lo, const K &hi, F fn)
+    {
+        encoded_type end = tree_key::encode(hi);
+        for (auto it = data.lower_bound(tree_key::encode(lo)); it != data.end(); ++it)
+        {
+            auto [code, value] = *it;
+            if (!(code < end))
+                break;
+            fn(tree_key::decode<K>(code), value);
+        }
+    }
+
+    // Calls fn(key, value) for every key, in order.
+    template <class F>
+    void for_each(F fn)
+    {
+        for (auto [code, value] : data)
+            fn(tree_key::decode<K>(code), value);
+    }
+
+    // The tree underneath, keyed by the encoding.
+    BinaryTree<encoded_type, V> &tree()
+    {
+        return data;
+    }
+
+private:
+    BinaryTree<encoded_type, V> data;
+};
+
+#endif // TREE_KEYS_HPP
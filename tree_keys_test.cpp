@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "tree_keys.hpp"
+
+TEST(KeysTest, ScalarsKeepTheirOrder)
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> doubles = {-inf, -1e300, -1.5, -1e-310, 0.0, 1e-310, 1.5, 1e300, inf};
+    for (size_t i = 0; i + 1 < doubles.size(); i++)
+        EXPECT_LT(tree_key::to_u64(doubles[i]), tree_key::to_u64(doubles[i + 1]));
+    for (double d : doubles)
+        EXPECT_EQ(tree_key::from_u64<double>(tree_key::to_u64(d)), d);
+
+    // -0.0 is 0.0, and all NaNs are one key after +infinity.
+    EXPECT_EQ(tree_key::to_u64(-0.0), tree_key::to_u64(0.0));
+    uint64_t nan = tree_key::to_u64(std::numeric_limits<double>::quiet_NaN());
+    EXPECT_EQ(tree_key::to_u64(-std::numeric_limits<double>::quiet_NaN()), nan);
+    EXPECT_GT(nan, tree_key::to_u64(inf));
+    EXPECT_TRUE(std::isnan(tree_key::from_u64<double>(nan)));
+
+    std::vector<int64_t> ints = {INT64_MIN, -5, -1, 0, 1, 5, INT64_MAX};
+    for (size_t i = 0; i + 1 < ints.size(); i++)
+        EXPECT_LT(tree_key::to_u64(ints[i]), tree_key::to_u64(ints[i + 1]));
+    for (int64_t v : ints)
+        EXPECT_EQ(tree_key::from_u64<int64_t>(tree_key::to_u64(v)), v);
+}
+
+// A long double can't squeeze into 64 bits without distinct keys
+// colliding, so it has no encoding at all.
+static_assert(tree_key::is_scalar_v<float> && tree_key::is_scalar_v<double>);
+static_assert(!tree_key::is_scalar_v<long double>);
+
+TEST(KeysTest, BytesKeepTheirOrder)
+{
+    using Key = std::tuple<std::string, int64_t, double, int8_t>;
+    std::vector<std::string> strings = {"", std::string(1, '\0'), std::string("a\0b", 3), "a", "ab", "b", "\xff"};
+    std::mt19937_64 rng(7);
+    std::vector<Key> keys;
+    for (int i = 0; i < 3000; i++)
+    {
+        keys.emplace_back(strings[rng() % strings.size()], int64_t(rng() % 7) - 3, double(int(rng() % 5) - 2) / 2,
+                          int8_t(rng()));
+    }
+    std::vector<std::string> codes;
+    for (const auto &k : keys)
+    {
+        codes.push_back(tree_key::encode(k));
+        EXPECT_EQ(tree_key::decode<Key>(codes.back()), k);
+    }
+    for (size_t i = 0; i + 1 < keys.size(); i++)
+    {
+        EXPECT_EQ(keys[i] < keys[i + 1], codes[i] < codes[i + 1]);
+        EXPECT_EQ(keys[i] == keys[i + 1], codes[i] == codes[i + 1]);
+    }
+    EXPECT_THROW(tree_key::decode<Key>(codes[0].substr(0, codes[0].size() - 1)), std::runtime_error);
+}
+
+TEST(KeysTest, NormalizedTree)
+{
+    NormalizedTree<double, int> d;
+    d[2.5] = 1;
+    d[-0.0] = 2;
+    d[0.0] = 3;
+    d[std::nan("1")] = 4;
+    d[-std::nan("2")] = 5;
+    d[-7.0] = 6;
+    EXPECT_EQ(d.size(), 4u);
+    EXPECT_EQ(*d.get(-0.0), 3);
+    EXPECT_EQ(*d.get(std::numeric_limits<double>::quiet_NaN()), 5);
+    std::vector<double> order;
+    d.for_each([&](double k, int) { order.push_back(k); });
+    ASSERT_EQ(order.size(), 4u);
+    EXPECT_EQ(order[0], -7.0);
+    EXPECT_EQ(order[1], 0.0);
+    EXPECT_EQ(order[2], 2.5);
+    EXPECT_TRUE(std::isnan(order[3]));
+
+    NormalizedTree<std::tuple<std::string, int64_t, double>, int> t;
+    for (int i = 0; i < 100; i++)
+        t[{i % 2 ? "odd" : "even", i / 10, -i * 0.5}] = i;
+    EXPECT_TRUE(t.contains({"odd", 0, -0.5}));
+    t.erase({"odd", 0, -0.5});
+    EXPECT_FALSE(t.contains({"odd", 0, -0.5}));
+    std::vector<int> seen;
+    t.scan({"odd", 2, -1e9}, {"odd", 3, -1e9}, [&](const auto &, int v) { seen.push_back(v); });
+    EXPECT_EQ(seen, std::vector<int>({29, 27, 25, 23, 21}));
+}
@@ -0,0 +1,374 @@
+// A key/value tree where every node also carries a hash of its
+// whole subtree (a Merkle tree).  Two trees holding the same data
+// have the same root hash, and diff() can skip any pair of
+// subtrees whose hashes match, so comparing two replicas (or two
+// snapshots) costs time proportional to how much differs rather
+// than to how big they are.
+//
+// That only works if equal contents always give equal shapes,
+// which is not true of BinaryTree (its shape depends on the order
+// keys went in).  So this is a treap whose priorities come from
+// hashing the keys: the shape is then a function of the key set
+// alone, and happens to be balanced (expected O(log N) depth) too.
+//
+// Values can't be handed out by reference like BinaryTree's []
+// since every change has to update the hashes on the way back up,
+// so writes go through assign() and erase().
+//
+// Hashes are only comparable between processes if Hash and VHash
+// give the same answers in each; std::hash does for integers and
+// for std::string in libstdc++, but supply your own otherwise.
+
+#ifndef TREE_MERKLE_HPP
+#define TREE_MERKLE_HPP
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// What diff() found for a key.
+enum class MerkleDiff
+{
+    only_in_a,
+    only_in_b,
+    value_differs
+};
+
+template <class K, class V, class Hash = std::hash<K>, class VHash = std::hash<V>>
+class MerkleTree
+{
+    struct Node
+    {
+        Node(const K &k, const V &v, uint64_t p) : key(k), value(v), priority(p), digest(0), left(nullptr), right(nullptr)
+        {
+        }
+        K key;
+        V value;
+        uint64_t priority;
+        uint64_t digest;
+        Node *left;
+        Node *right;
+    };
+
+public:
+    MerkleTree() : root(nullptr), count(0)
+    {
+    }
+    MerkleTree(const MerkleTree &) = delete;
+    MerkleTree &operator=(const MerkleTree &) = delete;
+    ~MerkleTree()
+    {
+        // Iterative so a huge tree can't overflow the stack.
+        std::vector<Node *> todo;
+        if (root)
+            todo.push_back(root);
+        while (!todo.empty())
+        {
+            Node *node = todo.back();
+            todo.pop_back();
+            if (node->left)
+                todo.push_back(node->left);
+            if (node->right)
+                todo.push_back(node->right);
+            delete node;
+        }
+    }
+
+    // Sets key to value, inserting it if it isn't there.
+    void assign(const K &key, const V &value)
+    {
+        root = insert(root, key, value);
+    }
+
+    // Removes key if it is there.
+    void erase(const K &key)
+    {
+        root = remove(root, key);
+    }
+
+    // A pointer to key's value, or null if it isn't there.
+    const V *get(const K &key) const
+    {
+        Node *node = root;
+        while (node)
+        {
+            if (key < node->key)
+                node = node->left;
+            else if (node->key < key)
+                node = node->right;
+            else
+                return &node->value;
+        }
+        return nullptr;
+    }
+
+    bool contains(const K &key) const
+    {
+        return get(key) != nullptr;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // The hash of the whole tree.  Equal contents give equal digests.
+    uint64_t digest() const
+    {
+        return root ? root->digest : 0;
+    }
+
+    // Calls fn(key, value) for every entry in order.
+    template <class F>
+    void for_each(F fn) const
+    {
+        std::vector<const Node *> path;
+        const Node *node = root;
+        while (node || !path.empty())
+        {
+            while (node)
+            {
+                path.push_back(node);
+                node = node->left;
+            }
+            node = path.back();
+            path.pop_back();
+            fn(node->key, node->value);
+            node = node->right;
+        }
+    }
+
+    // Reports every key whose presence or value differs between
+    // a and b, in key order, as fn(key, MerkleDiff).  Subtrees with
+    // equal digests are skipped without being looked at.
+    template <class F>
+    static void diff(const MerkleTree &a, const MerkleTree &b, F fn)
+    {
+        diff_range({a.root, nullptr, nullptr}, {b.root, nullptr, nullptr}, nullptr, nullptr, fn);
+    }
+
+private:
+    // splitmix64's finaliser, used to spread out the hashes.
+    static uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    static uint64_t priority_of(const K &key)
+    {
+        return mix(Hash{}(key) + 0x9e3779b97f4a7c15ULL);
+    }
+
+    static uint64_t entry_hash(const Node *node)
+    {
+        return mix(Hash{}(node->key)) ^ mix(VHash{}(node->value) + 0x632be59bd9b4e019ULL);
+    }
+
+    static uint64_t digest_of(const Node *node)
+    {
+        return node ? node->digest : 0;
+    }
+
+    static void rehash(Node *node)
+    {
+        uint64_t children = mix(digest_of(node->left) + 0x9e3779b97f4a7c15ULL * (digest_of(node->right) + 1));
+        node->digest = mix(entry_hash(node) ^ children);
+    }
+
+    // Whether a belongs above b in the treap.  Ties on priority are
+    // broken by key so the shape is still unique.
+    static bool above(const Node *a, const Node *b)
+    {
+        return a->priority > b->priority || (a->priority == b->priority && a->key < b->key);
+    }
+
+    static Node *rotate_right(Node *node)
+    {
+        Node *top = node->left;
+        node->left = top->right;
+        top->right = node;
+        rehash(node);
+        rehash(top);
+        return top;
+    }
+
+    static Node *rotate_left(Node *node)
+    {
+        Node *top = node->right;
+        node->right = top->left;
+        top->left = node;
+        rehash(node);
+        rehash(top);
+        return top;
+    }
+
+    // Inserts or updates key under node, rotating the new node up
+    // to where its priority says it goes, and fixing the digests
+    // on the way back up.
+    Node *insert(Node *node, const K &key, const V &value)
+    {
+        if (!node)
+        {
+            node = new Node(key, value, priority_of(key));
+            count++;
+        }
+        else if (key < node->key)
+        {
+            node->left = insert(node->left, key, value);
+            if (above(node->left, node))
+                return rotate_right(node);
+        }
+        else if (node->key < key)
+        {
+            node->right = insert(node->right, key, value);
+            if (above(node->right, node))
+                return rotate_left(node);
+        }
+        else
+        {
+            node->value = value;
+        }
+        rehash(node);
+        return node;
+    }
+
+    // Removes key under node.  The node to go is rotated down,
+    // always lifting whichever child belongs higher, until it has
+    // at most one child and can simply be unlinked.
+    Node *remove(Node *node, const K &key)
+    {
+        if (!node)
+            return nullptr;
+        if (key < node->key)
+        {
+            node->left = remove(node->left, key);
+        }
+        else if (node->key < key)
+        {
+            node->right = remove(node->right, key);
+        }
+        else if (!node->left || !node->right)
+        {
+            Node *child = node->left ? node->left : node->right;
+            delete node;
+            count--;
+            return child;
+        }
+        else if (above(node->left, node->right))
+        {
+            node = rotate_right(node);
+            node->right = remove(node->right, key);
+        }
+        else
+        {
+            node = rotate_left(node);
+            node->left = remove(node->left, key);
+        }
+        rehash(node);
+        return node;
+    }
+
+    // A subtree together with the bounds its ancestors put on
+    // its keys (exclusive, null meaning unbounded).
+    struct Cursor
+    {
+        const Node *node;
+        const K *lo;
+        const K *hi;
+    };
+
+    // Moves c down to the highest node with a key in (lo, hi),
+    // which is the root of the treap for just those keys.
+    static void settle(Cursor &c, const K *lo, const K *hi)
+    {
+        while (c.node)
+        {
+            if (lo && !(*lo < c.node->key))
+                c = {c.node->right, &c.node->key, c.hi};
+            else if (hi && !(c.node->key < *hi))
+                c = {c.node->left, c.lo, &c.node->key};
+            else
+                break;
+        }
+    }
+
+    // Whether every key in c's subtree lies in (lo, hi), in
+    // which case its digest describes exactly those keys.
+    static bool inside(const Cursor &c, const K *lo, const K *hi)
+    {
+        return (!lo || (c.lo && !(*c.lo < *lo))) && (!hi || (c.hi && !(*hi < *c.hi)));
+    }
+
+    // Reports all keys of c's subtree that lie in (lo, hi).
+    template <class F>
+    static void report(const Node *node, const K *lo, const K *hi, MerkleDiff what, F &fn)
+    {
+        if (!node)
+            return;
+        bool above_lo = !lo || *lo < node->key;
+        bool below_hi = !hi || node->key < *hi;
+        if (above_lo)
+            report(node->left, lo, hi, what, fn);
+        if (above_lo && below_hi)
+            fn(node->key, what);
+        if (below_hi)
+            report(node->right, lo, hi, what, fn);
+    }
+
+    // Compares the keys in (lo, hi) of the two subtrees.  Both
+    // shapes are fixed by their key sets, so if the two tops hold
+    // the same key their left and right sides line up and can be
+    // compared pairwise.  If not, the higher of the two tops can't
+    // be in the other tree at all (it would have been on top
+    // there too), so it is reported and we carry on either side
+    // of it.
+    template <class F>
+    static void diff_range(Cursor x, Cursor y, const K *lo, const K *hi, F &fn)
+    {
+        settle(x, lo, hi);
+        settle(y, lo, hi);
+        if (!x.node && !y.node)
+            return;
+        if (!y.node)
+            return report(x.node, lo, hi, MerkleDiff::only_in_a, fn);
+        if (!x.node)
+            return report(y.node, lo, hi, MerkleDiff::only_in_b, fn);
+        if (x.node->digest == y.node->digest && inside(x, lo, hi) && inside(y, lo, hi))
+            return;
+
+        const K *key;
+        if (!(x.node->key < y.node->key) && !(y.node->key < x.node->key))
+        {
+            key = &x.node->key;
+            diff_range({x.node->left, x.lo, key}, {y.node->left, y.lo, key}, lo, key, fn);
+            if (entry_hash(x.node) != entry_hash(y.node))
+                fn(*key, MerkleDiff::value_differs);
+            diff_range({x.node->right, key, x.hi}, {y.node->right, key, y.hi}, key, hi, fn);
+        }
+        else if (above(x.node, y.node))
+        {
+            key = &x.node->key;
+            diff_range({x.node->left, x.lo, key}, y, lo, key, fn);
+            fn(*key, MerkleDiff::only_in_a);
+            diff_range({x.node->right, key, x.hi}, y, key, hi, fn);
+        }
+        else
+        {
+            key = &y.node->key;
+            diff_range(x, {y.node->left, y.lo, key}, lo, key, fn);
+            fn(*key, MerkleDiff::only_in_b);
+            diff_range(x, {y.node->right, key, y.hi}, key, hi, fn);
+        }
+    }
+
+    Node *root;
+    size_t count;
+};
+
+#endif // TREE_MERKLE_HPP
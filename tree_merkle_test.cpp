@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_merkle.hpp"
+
+typedef std::vector<std::pair<int, MerkleDiff>> Diffs;
+
+static Diffs diff(const MerkleTree<int, int> &a, const MerkleTree<int, int> &b)
+{
+    Diffs out;
+    MerkleTree<int, int>::diff(a, b, [&](const int &key, MerkleDiff what) { out.push_back({key, what}); });
+    return out;
+}
+
+TEST(MerkleTest, ShapeIndependentOfInsertOrder)
+{
+    auto rng = std::default_random_engine{};
+    std::vector<int> keys(500);
+    for (int i = 0; i < 500; i++)
+        keys[i] = i;
+    MerkleTree<int, int> a, b;
+    for (auto k : keys)
+        a.assign(k, k * 2);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (auto k : keys)
+        b.assign(k, k * 2);
+    b.assign(1000, 1);
+    b.erase(1000);
+    EXPECT_EQ(a.size(), 500u);
+    EXPECT_EQ(a.digest(), b.digest());
+    EXPECT_TRUE(diff(a, b).empty());
+
+    b.assign(7, 0);
+    EXPECT_NE(a.digest(), b.digest());
+    EXPECT_EQ(diff(a, b), Diffs({{7, MerkleDiff::value_differs}}));
+    b.assign(7, 14);
+    EXPECT_EQ(a.digest(), b.digest());
+
+    std::string order;
+    MerkleTree<std::string, int> s;
+    s.assign("b", 2);
+    s.assign("a", 1);
+    s.assign("c", 3);
+    s.for_each([&](const std::string &key, int value) { order += key + std::to_string(value); });
+    EXPECT_EQ(order, "a1b2c3");
+    EXPECT_EQ(*s.get("b"), 2);
+    EXPECT_FALSE(s.contains("d"));
+}
+
+TEST(MerkleTest, DiffMatchesBruteForce)
+{
+    std::mt19937 rng(7);
+    for (int round = 0; round < 50; round++)
+    {
+        MerkleTree<int, int> a, b;
+        std::map<int, int> ma, mb;
+        for (int i = 0; i < 300; i++)
+        {
+            int k = rng() % 400, v = rng() % 3;
+            a.assign(k, v);
+            b.assign(k, v);
+            ma[k] = mb[k] = v;
+        }
+        for (int i = 0; i < 10; i++)
+        {
+            int k = rng() % 400, v = rng() % 3;
+            switch (rng() % 4)
+            {
+            case 0: a.assign(k, v); ma[k] = v; break;
+            case 1: b.assign(k, v); mb[k] = v; break;
+            case 2: a.erase(k); ma.erase(k); break;
+            default: b.erase(k); mb.erase(k); break;
+            }
+        }
+
+        Diffs expect;
+        for (int k = 0; k < 400; k++)
+        {
+            bool ina = ma.count(k), inb = mb.count(k);
+            if (ina && !inb)
+                expect.push_back({k, MerkleDiff::only_in_a});
+            else if (!ina && inb)
+                expect.push_back({k, MerkleDiff::only_in_b});
+            else if (ina && ma[k] != mb[k])
+                expect.push_back({k, MerkleDiff::value_differs});
+        }
+        EXPECT_EQ(diff(a, b), expect);
+        EXPECT_EQ(a.digest() == b.digest(), expect.empty());
+    }
+}
@@ -0,0 +1,181 @@
+// A tree with a second, ordered index on some projection of its
+// values: a score, a timestamp, whatever proj(value) gives.
+//
+// The entries themselves live in the secondary index, a tree
+// ordered by (proj(value), key), and the primary tree just maps
+// each key to its current projection.  So:
+//
+//   - top_k() and by_value() walk the secondary index directly,
+//     O(log N + k), instead of scanning and sorting every entry,
+//   - a lookup by key is two descents, one in each tree.
+//
+// Values can't be changed in place, since the index would then
+// be out of date; they change through assign() or modify(), which
+// take the entry out of the index and put it back where it now
+// belongs.
+//
+// Projections often only go up (timestamps, running totals), which
+// would grow a plain BinaryTree into one long chain, so both trees
+// are BalancedTrees.
+//
+// K and V must be default constructible: by_value() searches with
+// a default key, and modify() starts a new entry from a default
+// value.
+
+#ifndef TREE_MULTIINDEX_HPP
+#define TREE_MULTIINDEX_HPP
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "tree_balanced.hpp"
+
+template <class K, class V, class Proj>
+class IndexedTree
+{
+    using P = std::decay_t<std::invoke_result_t<Proj &, const V &>>;
+
+    // Ordered by projection, then key.  A bound sorts before every
+    // real entry with the same projection, so lower_bound on one
+    // finds the first entry with that projection whatever the keys.
+    struct IndexKey
+    {
+        P projected;
+        K key;
+        bool bound = false;
+
+        bool operator<(const IndexKey &other) const
+        {
+            if (projected < other.projected)
+                return true;
+            if (other.projected < projected)
+                return false;
+            if (bound != other.bound)
+                return bound;
+            return !bound && key < other.key;
+        }
+    };
+
+public:
+    explicit IndexedTree(Proj proj = Proj()) : proj(std::move(proj))
+    {
+    }
+
+    void assign(const K &key, V value)
+    {
+        P projected = proj(value);
+        replace(key, std::move(projected), std::move(value));
+    }
+
+    // Calls fn(value) on a copy of key's value (a default one if key
+    // isn't there yet), then stores and reindexes it.  If fn or the
+    // projection throws, the entry is left as it was.
+    template <class F>
+    void modify(const K &key, F fn)
+    {
+        const V *old = get(key);
+        V value = old ? *old : V{};
+        fn(value);
+        P projected = proj(value);
+        replace(key, std::move(projected), std::move(value));
+    }
+
+    void erase(const K &key)
+    {
+        P *projected = primary.get(key);
+        if (!projected)
+            return;
+        secondary.erase(IndexKey{*projected, key});
+        primary.erase(key);
+    }
+
+    // Key's value, or null.  Good until the tree next changes.
+    const V *get(const K &key)
+    {
+        P *projected = primary.get(key);
+        return projected ? secondary.get(IndexKey{*projected, key}) : nullptr;
+    }
+
+    bool contains(const K &key)
+    {
+        return primary.contains(key);
+    }
+
+    size_t size() const
+    {
+        return primary.size();
+    }
+
+    // Calls fn(key, value) for the k entries with the largest
+    // projections, largest first.  Ties come out in descending
+    // key order.
+    template <class F>
+    void top_k(size_t k, F fn)
+    {
+        auto it = secondary.iterator_end();
+        if (k > 0)
+            --it;
+        for (size_t i = 0; i < k && it != std::default_sentinel; i++, --it)
+        {
+            auto [index, value] = *it;
+            fn(static_cast<const K &>(index.key), static_cast<const V &>(value));
+        }
+    }
+
+    // Calls fn(key, value) for every entry with lo <= proj(value)
+    // < hi, in order of projection.
+    template <class F>
+    void by_value(const P &lo, const P &hi, F fn)
+    {
+        for (auto it = secondary.lower_bound(IndexKey{lo, K{}, true}); it != std::default_sentinel; ++it)
+        {
+            auto [index, value] = *it;
+            if (!(index.projected < hi))
+                break;
+            fn(static_cast<const K &>(index.key), static_cast<const V &>(value));
+        }
+    }
+
+private:
+    // Stores key's new value under its new projection.  The new
+    // secondary entry goes in first and the old one comes out last,
+    // so if anything throws part way both trees still agree: either
+    // on the old entry or, for a new key, on nothing.  (That relies
+    // on assigning a P not throwing, as it can't for the usual
+    // numbers and timestamps.)
+    void replace(const K &key, P projected, V value)
+    {
+        std::optional<P> before;
+        if (P *old = primary.get(key))
+            before = *old;
+        IndexKey where{projected, key};
+        if (before && !(*before < projected) && !(projected < *before))
+        {
+            // Same place in the index: just the value changes.
+            *secondary.get(where) = std::move(value);
+            return;
+        }
+        V &slot = secondary[where];
+        try
+        {
+            slot = std::move(value);
+            primary[key] = std::move(projected);
+        }
+        catch (...)
+        {
+            secondary.erase(where);
+            if (!before)
+                primary.erase(key);
+            throw;
+        }
+        if (before)
+            secondary.erase(IndexKey{*before, key});
+    }
+
+    Proj proj;
+    BalancedTree<K, P> primary;
+    BalancedTree<IndexKey, V> secondary;
+};
+
+#endif // TREE_MULTIINDEX_HPP
@@ -0,0 +1,167 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "tree_multiindex.hpp"
+
+struct Stats
+{
+    int score = 0;
+    std::string name;
+};
+
+struct ByScore
+{
+    int operator()(const Stats &s) const
+    {
+        return s.score;
+    }
+};
+
+TEST(MultiIndexTest, TopKAndByValue)
+{
+    IndexedTree<int, Stats, ByScore> t;
+    std::map<int, Stats> m;
+    std::mt19937_64 rng(11);
+    for (int i = 0; i < 3000; i++)
+    {
+        int user = rng() % 500;
+        switch (rng() % 4)
+        {
+        case 0:
+            t.erase(user);
+            m.erase(user);
+            break;
+        case 1:
+            t.modify(user, [](Stats &s) { s.score += 10; });
+            m[user].score += 10;
+            break;
+        default:
+        {
+            Stats s{int(rng() % 1000), "u" + std::to_string(user)};
+            t.assign(user, s);
+            m[user] = s;
+        }
+        }
+        ASSERT_EQ(t.size(), m.size());
+    }
+
+    // Everyone, sorted the slow way: by score then user, descending.
+    std::vector<std::pair<int, int>> expect;
+    for (const auto &[user, s] : m)
+        expect.push_back({s.score, user});
+    std::sort(expect.rbegin(), expect.rend());
+
+    std::vector<std::pair<int, int>> top;
+    t.top_k(100, [&](int user, const Stats &s) { top.push_back({s.score, user}); });
+    ASSERT_EQ(top.size(), 100u);
+    EXPECT_TRUE(std::equal(top.begin(), top.end(), expect.begin()));
+
+    std::vector<std::pair<int, int>> all;
+    t.top_k(100000, [&](int user, const Stats &s) { all.push_back({s.score, user}); });
+    EXPECT_EQ(all, expect);
+
+    std::vector<std::pair<int, int>> range;
+    t.by_value(200, 300, [&](int user, const Stats &s) { range.push_back({s.score, user}); });
+    std::vector<std::pair<int, int>> expect_range;
+    for (auto it = expect.rbegin(); it != expect.rend(); ++it)
+    {
+        if (it->first >= 200 && it->first < 300)
+            expect_range.push_back(*it);
+    }
+    EXPECT_EQ(range, expect_range);
+
+    for (const auto &[user, s] : m)
+    {
+        const Stats *found = t.get(user);
+        ASSERT_NE(found, nullptr);
+        EXPECT_EQ(found->score, s.score);
+        EXPECT_EQ(found->name, s.name);
+    }
+    EXPECT_EQ(t.get(1000), nullptr);
+}
+
+TEST(MultiIndexTest, Empty)
+{
+    IndexedTree<int, Stats, ByScore> t;
+    int calls = 0;
+    t.top_k(5, [&](int, const Stats &) { calls++; });
+    t.by_value(0, 100, [&](int, const Stats &) { calls++; });
+    EXPECT_EQ(calls, 0);
+    t.modify(1, [](Stats &s) { s.score = 5; });
+    t.top_k(0, [&](int, const Stats &) { calls++; });
+    EXPECT_EQ(calls, 0);
+    EXPECT_EQ(t.get(1)->score, 5);
+}
+
+// Scores that only ever go up would chain a plain tree; these
+// stay balanced however many come in.
+TEST(MultiIndexTest, RisingScoresStayShallow)
+{
+    IndexedTree<int, Stats, ByScore> t;
+    const int n = 50000;
+    for (int i = 0; i < n; i++)
+        t.assign(i, Stats{i, ""});
+    for (int i = 0; i < n; i += 2)
+        t.modify(i, [&](Stats &s) { s.score += n; });
+    std::vector<int> top;
+    t.top_k(3, [&](int key, const Stats &) { top.push_back(key); });
+    EXPECT_EQ(top, (std::vector<int>{n - 2, n - 4, n - 6}));
+    int seen = 0;
+    t.by_value(n - 10, n, [&](int key, const Stats &s) {
+        EXPECT_EQ(key, s.score);
+        seen++;
+    });
+    EXPECT_EQ(seen, 5);
+    EXPECT_EQ(t.size(), size_t(n));
+}
+
+// A projection that refuses negative scores.
+struct NoNegatives
+{
+    int operator()(const Stats &s) const
+    {
+        if (s.score < 0)
+            throw std::invalid_argument("negative score");
+        return s.score;
+    }
+};
+
+// Whatever throws, the entry stays where it was and both indexes
+// agree on it.
+TEST(MultiIndexTest, ThrowsLeaveEntriesAlone)
+{
+    IndexedTree<int, Stats, NoNegatives> t;
+    t.assign(1, Stats{10, "a"});
+    t.assign(2, Stats{20, "b"});
+
+    EXPECT_THROW(t.modify(1, [](Stats &s) { s.score = -5; }), std::invalid_argument);
+    EXPECT_THROW(t.modify(1, [](Stats &s) {
+        s.score = 99;
+        throw std::runtime_error("changed my mind");
+    }),
+                 std::runtime_error);
+    EXPECT_THROW(t.assign(2, Stats{-1, "c"}), std::invalid_argument);
+    EXPECT_THROW(t.assign(3, Stats{-1, "d"}), std::invalid_argument);
+    EXPECT_THROW(t.modify(4, [](Stats &s) { s.score = -1; }), std::invalid_argument);
+
+    EXPECT_EQ(t.size(), 2u);
+    EXPECT_FALSE(t.contains(3));
+    EXPECT_FALSE(t.contains(4));
+    ASSERT_NE(t.get(1), nullptr);
+    EXPECT_EQ(t.get(1)->score, 10);
+    ASSERT_NE(t.get(2), nullptr);
+    EXPECT_EQ(t.get(2)->name, "b");
+    std::vector<int> order;
+    t.top_k(10, [&](int key, const Stats &) { order.push_back(key); });
+    EXPECT_EQ(order, (std::vector<int>{2, 1}));
+
+    // And a successful move still drops the old index entry.
+    t.modify(1, [](Stats &s) { s.score = 30; });
+    order.clear();
+    t.top_k(10, [&](int key, const Stats &) { order.push_back(key); });
+    EXPECT_EQ(order, (std::vector<int>{1, 2}));
+}
@@ -0,0 +1,408 @@
+// NUMA placement for BinaryTree.  On a multi-socket machine a
+// tree whose nodes all live on one memory node makes every other
+// socket pay a remote access on each level of every lookup.
+// This header offers two ways around that:
+//
+// A: NumaReplicatedTree keeps one full copy of the tree per
+// memory node.  Reads go to the copy local to the calling CPU,
+// writes are applied to every copy.  This is for read-mostly
+// data where the extra memory and slower writes are worth it.
+//
+// B: NumaLocalTree is a BinaryTree that remembers the
+// node it was created on and keeps all of its allocations there,
+// no matter which thread happens to insert into it.  This is for
+// sharded setups where each thread owns its own tree.
+//
+// Placement uses the kernel memory policy syscalls (the same
+// ones libnuma's mbind/set_mempolicy wrap) so there is nothing
+// extra to link.  On machines with a single node, on non-Linux
+// systems, or in containers where the syscalls are refused,
+// everything quietly falls back to ordinary allocation.
+
+#ifndef TREE_NUMA_HPP
+#define TREE_NUMA_HPP
+
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace tree_numa
+{
+    // Memory policy modes, as in <linux/mempolicy.h>.
+    constexpr int policy_default = 0;
+    constexpr int policy_preferred = 1;
+
+    // Parses a sysfs list such as "0-3,8-11" into the ids it names.
+    inline std::vector<int> parse_list(const std::string &text)
+    {
+        std::vector<int> ids;
+        std::stringstream in(text);
+        std::string range;
+        while (std::getline(in, range, ','))
+        {
+            if (range.empty() || range == "\n")
+                continue;
+            auto dash = range.find('-');
+            int lo = std::stoi(range.substr(0, dash));
+            int hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+            for (int i = lo; i <= hi; i++)
+                ids.push_back(i);
+        }
+        return ids;
+    }
+
+    // The machine topology, read once from sysfs.  If sysfs isn't
+    // there we pretend to be a single node machine.
+    struct Topology
+    {
+        int nodes = 1;
+        std::vector<int> cpu_node;
+
+        Topology()
+        {
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string text;
+            if (!(online && std::getline(online, text)))
+                return;
+            auto ids = parse_list(text);
+            if (ids.empty())
+                return;
+            nodes = ids.back() + 1;
+            for (int node : ids)
+            {
+                std::ifstream cpus("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string cpulist;
+                if (!(cpus && std::getline(cpus, cpulist)))
+                    continue;
+                for (int cpu : parse_list(cpulist))
+                {
+                    if (cpu >= (int)cpu_node.size())
+                        cpu_node.resize(cpu + 1, 0);
+                    cpu_node[cpu] = node;
+                }
+            }
+        }
+    };
+
+    inline const Topology &topology()
+    {
+        static const Topology topo;
+        return topo;
+    }
+
+    // How many memory nodes there are (always at least one).
+    inline int node_count()
+    {
+        return topology().nodes;
+    }
+
+    // The node of the CPU this thread is running on right now.
+    inline int current_node()
+    {
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        const auto &map = topology().cpu_node;
+        if (cpu >= 0 && cpu < (int)map.size())
+            return map[cpu];
+#endif
+        return 0;
+    }
+
+    // A thread's allocation policy: the mode, and the nodes it
+    // applies to as a bit mask.
+    struct Policy
+    {
+        int mode = policy_default;
+        unsigned long mask[4] = {};
+    };
+
+    constexpr unsigned long mask_bits = 8 * sizeof(unsigned long) * 4;
+
+    // Sets this thread's allocation policy.  Returns false if the
+    // kernel doesn't support (or won't allow) it, in which case
+    // nothing changed.
+    inline bool set_policy(const Policy &policy)
+    {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+        if (node_count() < 2)
+            return false;
+        bool any = policy.mode != policy_default;
+        return syscall(SYS_set_mempolicy, policy.mode, any ? policy.mask : nullptr, any ? mask_bits + 1 : 0) == 0;
+#else
+        (void)policy;
+        return false;
+#endif
+    }
+
+    inline bool set_policy(int mode, int node)
+    {
+        Policy policy;
+        policy.mode = mode;
+        if (mode != policy_default)
+        {
+            const unsigned long bits = 8 * sizeof(unsigned long);
+            if (node < 0 || node >= (int)mask_bits)
+                return false;
+            policy.mask[node / bits] = 1UL << (node % bits);
+        }
+        return set_policy(policy);
+    }
+
+    // Reads this thread's allocation policy back.  Returns false
+    // if the kernel won't say.
+    inline bool get_policy(Policy &policy)
+    {
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+        if (node_count() < 2)
+            return false;
+        return syscall(SYS_get_mempolicy, &policy.mode, policy.mask, mask_bits + 1, nullptr, 0) == 0;
+#else
+        (void)policy;
+        return false;
+#endif
+    }
+
+    // While one of these is alive, pages this thread faults in
+    // come from the given node (if it has room).  It puts back
+    // whatever policy the thread had before when it goes out of
+    // scope, so scopes can nest.  Note that the allocator may
+    // still hand back memory it already has, so placement is best
+    // effort for memory that was freed and reused.
+    class NodeScope
+    {
+    public:
+        explicit NodeScope(int node) : bound(get_policy(saved) && set_policy(policy_preferred, node))
+        {
+        }
+        ~NodeScope()
+        {
+            if (bound)
+                set_policy(saved);
+        }
+        NodeScope(const NodeScope &) = delete;
+        NodeScope &operator=(const NodeScope &) = delete;
+
+        bool active() const
+        {
+            return bound;
+        }
+
+    private:
+        Policy saved;
+        bool bound;
+    };
+}
+
+// One replica of the tree per memory node.  Readers call local()
+// and get the copy on their own socket, writers go through
+// assign() and erase() which update every copy, each one while
+// bound to its own node so the new nodes land in the right place.
+template <class K, class V>
+class NumaReplicatedTree
+{
+public:
+    // A read-only view of one replica.  It hands out const keys
+    // and values and has no way to add or remove keys, so nothing
+    // done through it can leave the replicas out of sync.
+    class Replica
+    {
+    public:
+        class Iterator
+        {
+        public:
+            using value_type = std::pair<K, V>;
+            using reference = std::pair<const K &, const V &>;
+            using difference_type = std::ptrdiff_t;
+
+            Iterator() = default;
+            explicit Iterator(BinaryTreeIterator<K, V> it) : it(std::move(it))
+            {
+            }
+
+            reference operator*() const
+            {
+                auto [key, value] = *it;
+                return reference(key, value);
+            }
+            Iterator &operator++()
+            {
+                ++it;
+                return *this;
+            }
+            void operator++(int)
+            {
+                ++it;
+            }
+            bool operator==(std::default_sentinel_t) const
+            {
+                return it == std::default_sentinel;
+            }
+
+        private:
+            BinaryTreeIterator<K, V> it;
+        };
+
+        explicit Replica(BinaryTree<K, V> &tree) : tree(&tree)
+        {
+        }
+
+        // Key's value, or null.  Good until the next write.
+        const V *get(const K &key) const
+        {
+            return tree->get(key);
+        }
+
+        bool contains(const K &key) const
+        {
+            return tree->contains(key);
+        }
+
+        size_t size() const
+        {
+            return tree->size();
+        }
+
+        size_t count_range(const K &lo, const K &hi) const
+        {
+            return tree->count_range(lo, hi);
+        }
+
+        Iterator begin() const
+        {
+            return Iterator(tree->begin());
+        }
+        std::default_sentinel_t end() const
+        {
+            return std::default_sentinel;
+        }
+        Iterator lower_bound(const K &key) const
+        {
+            return Iterator(tree->lower_bound(key));
+        }
+
+    private:
+        BinaryTree<K, V> *tree;
+    };
+
+    NumaReplicatedTree() : replicas(tree_numa::node_count())
+    {
+    }
+
+    // Sets key to value in every replica.
+    void assign(const K &key, const V &value)
+    {
+        for (int node = 0; node < (int)replicas.size(); node++)
+        {
+            tree_numa::NodeScope scope(node);
+            replicas[node][key] = value;
+        }
+    }
+
+    // Removes key from every replica.
+    void erase(const K &key)
+    {
+        for (auto &replica : replicas)
+            replica.erase(key);
+    }
+
+    bool contains(const K &key)
+    {
+        return local().contains(key);
+    }
+
+    // The replica on the caller's node, for reading.  Changes go
+    // through assign() and erase().
+    Replica local()
+    {
+        return replica(tree_numa::current_node());
+    }
+
+    Replica replica(int node)
+    {
+        if (node < 0 || node >= (int)replicas.size())
+            node = 0;
+        return Replica(replicas[node]);
+    }
+
+    int replica_count() const
+    {
+        return (int)replicas.size();
+    }
+
+private:
+    std::vector<BinaryTree<K, V>> replicas;
+};
+
+// A tree pinned to the node it was created on.  Every call that
+// can allocate nodes (operator[], apply_sorted, compact) is done
+// while bound to that home node, so a shard stays local to its
+// owning thread even if some other thread fills it in.  The tree
+// is inherited privately so that there is no way to insert
+// around the placement through a BinaryTree reference; the calls
+// that don't allocate are passed straight through.
+template <class K, class V>
+class NumaLocalTree : private BinaryTree<K, V>
+{
+    using Base = BinaryTree<K, V>;
+
+public:
+    NumaLocalTree() : home(tree_numa::current_node())
+    {
+    }
+    explicit NumaLocalTree(int node) : home(node)
+    {
+    }
+
+    V &operator[](const K &key)
+    {
+        tree_numa::NodeScope scope(home);
+        return Base::operator[](key);
+    }
+
+    template <class It>
+    void apply_sorted(It first, It last)
+    {
+        tree_numa::NodeScope scope(home);
+        Base::apply_sorted(first, last);
+    }
+
+    void compact(BinaryTreeLayout layout = BinaryTreeLayout::depth_first)
+    {
+        tree_numa::NodeScope scope(home);
+        Base::compact(layout);
+    }
+
+    using Base::begin;
+    using Base::contains;
+    using Base::count_range;
+    using Base::end;
+    using Base::erase;
+    using Base::erase_if;
+    using Base::export_columns;
+    using Base::get;
+    using Base::iterator_end;
+    using Base::lower_bound;
+    using Base::size;
+
+    int home_node() const
+    {
+        return home;
+    }
+
+private:
+    int home;
+};
+
+#endif // TREE_NUMA_HPP
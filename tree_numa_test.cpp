@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "tree_numa.hpp"
+
+TEST(NumaTest, ParseList)
+{
+    EXPECT_EQ(tree_numa::parse_list("0"), std::vector<int>({0}));
+    EXPECT_EQ(tree_numa::parse_list("0-2,5"), std::vector<int>({0, 1, 2, 5}));
+    EXPECT_GE(tree_numa::node_count(), 1);
+    EXPECT_GE(tree_numa::current_node(), 0);
+    EXPECT_LT(tree_numa::current_node(), tree_numa::node_count());
+}
+
+TEST(NumaTest, ReplicasStayInSync)
+{
+    NumaReplicatedTree<std::string, int> t;
+    EXPECT_EQ(t.replica_count(), tree_numa::node_count());
+    t.assign("A", 1);
+    t.assign("B", 2);
+    t.assign("C", 3);
+    t.assign("B", 20);
+    t.erase("C");
+    for (int node = 0; node < t.replica_count(); node++)
+    {
+        std::string res = "";
+        for (const auto &[key, value] : t.replica(node))
+        {
+            res += key + std::to_string(value);
+        }
+        EXPECT_EQ(res, "A1B20");
+    }
+    EXPECT_TRUE(t.contains("A"));
+    EXPECT_FALSE(t.contains("C"));
+}
+
+// Replicas are for reading: they give out const values and have
+// no way to add or remove a key behind the other replicas' backs.
+TEST(NumaTest, ReplicasAreReadOnly)
+{
+    using Tree = NumaReplicatedTree<int, int>;
+    static_assert(std::is_same_v<decltype(std::declval<Tree::Replica &>().get(0)), const int *>);
+    static_assert(!std::is_convertible_v<Tree::Replica, BinaryTree<int, int> &>);
+    Tree t;
+    for (int i = 0; i < 10; i++)
+        t.assign(i, i * i);
+    auto local = t.local();
+    EXPECT_EQ(local.size(), 10u);
+    EXPECT_EQ(*local.get(3), 9);
+    EXPECT_EQ(local.get(10), nullptr);
+    EXPECT_EQ(local.count_range(2, 5), 3u);
+    int expect = 4;
+    for (auto it = local.lower_bound(4); it != local.end(); ++it)
+    {
+        auto [key, value] = *it;
+        static_assert(std::is_same_v<decltype(value), const int &>);
+        EXPECT_EQ(key, expect);
+        EXPECT_EQ(value, expect * expect);
+        expect++;
+    }
+    EXPECT_EQ(expect, 10);
+}
+
+TEST(NumaTest, LocalTree)
+{
+    NumaLocalTree<int, int> t;
+    EXPECT_EQ(t.home_node(), tree_numa::current_node());
+    for (int i = 0; i < 100; i++)
+        t[(i * 37) % 100] = i;
+    int expect = 0;
+    for (const auto &[key, value] : t)
+    {
+        EXPECT_EQ(key, expect++);
+    }
+    EXPECT_EQ(expect, 100);
+}
+
+TEST(NumaTest, LocalTreeHasNoUnplacedInserts)
+{
+    // Nothing can get at the base class's insert paths.
+    static_assert(!std::is_convertible_v<NumaLocalTree<int, int> &, BinaryTree<int, int> &>);
+    NumaLocalTree<int, int> t;
+    std::vector<std::pair<int, std::optional<int>>> batch;
+    for (int i = 0; i < 50; i++)
+        batch.emplace_back(i, i * 2);
+    t.apply_sorted(batch.begin(), batch.end());
+    t.compact();
+    EXPECT_EQ(t.size(), 50u);
+    EXPECT_EQ(*t.get(49), 98);
+}
+
+TEST(NumaTest, ScopesRestoreThePolicyBefore)
+{
+    tree_numa::Policy before;
+    if (!tree_numa::get_policy(before))
+        GTEST_SKIP() << "no memory policy support here";
+    {
+        tree_numa::NodeScope outer(0);
+        tree_numa::Policy mid;
+        ASSERT_TRUE(tree_numa::get_policy(mid));
+        {
+            tree_numa::NodeScope inner(tree_numa::node_count() - 1);
+        }
+        tree_numa::Policy after_inner;
+        ASSERT_TRUE(tree_numa::get_policy(after_inner));
+        EXPECT_EQ(after_inner.mode, mid.mode);
+        EXPECT_EQ(after_inner.mask[0], mid.mask[0]);
+    }
+    tree_numa::Policy after;
+    ASSERT_TRUE(tree_numa::get_policy(after));
+    EXPECT_EQ(after.mode, before.mode);
+}
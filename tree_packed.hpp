@@ -0,0 +1,259 @@
+// A frozen copy of a BinaryTree<uint64_t, V> that stores its keys
+// compressed, for key sets like timestamps where neighbouring keys
+// are close together.
+//
+// The keys are cut into blocks of 128.  Each block stores its first
+// key, and every key in it as an offset from that first key (frame
+// of reference), bit packed at the smallest width that fits the
+// biggest offset.  A block of timestamps a few seconds apart needs
+// a dozen or so bits per key instead of 64.  Blocks whose offsets
+// don't fit in 32 bits just store the keys as they are.
+//
+// The packing is laid out for SIMD: the block's keys are dealt out
+// round robin into 4 lanes, and each lane is packed into its own
+// run of 32 bit words, interleaved so that word w of lanes 0..3
+// sit next to each other.  Unpacking then does the same shifts
+// on 4 neighbouring words at every step, a loop the compiler turns
+// into vector instructions (SSE2 or better) without any intrinsics
+// here.  There is one unpacking routine per width, so all the
+// shifts are constants.
+//
+// Lookups binary search the blocks' first keys and then the packed
+// offsets in place, pulling single offsets out without unpacking
+// the block; scans unpack a block at a time.
+
+#ifndef TREE_PACKED_HPP
+#define TREE_PACKED_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace tree_pack
+{
+    constexpr size_t block_keys = 128;
+    constexpr size_t lanes = 4;
+    constexpr size_t per_lane = block_keys / lanes;
+
+    // Packs 128 offsets at width bits each: width 32 bit words per
+    // lane, so 4 * width words in all.
+    inline void pack(const uint64_t *offsets, unsigned width, uint32_t *out)
+    {
+        std::fill(out, out + lanes * width, 0);
+        if (width == 0)
+            return;
+        for (size_t k = 0; k < per_lane; k++)
+        {
+            size_t bit = k * width, w = bit / 32, shift = bit % 32;
+            for (size_t l = 0; l < lanes; l++)
+            {
+                uint64_t v = offsets[k * lanes + l];
+                out[w * lanes + l] |= uint32_t(v << shift);
+                if (shift + width > 32)
+                    out[(w + 1) * lanes + l] |= uint32_t(v >> (32 - shift));
+            }
+        }
+    }
+
+    // Offset i of a packed block.
+    inline uint32_t extract(const uint32_t *in, unsigned width, size_t i)
+    {
+        if (width == 0)
+            return 0;
+        size_t k = i / lanes, l = i % lanes;
+        size_t bit = k * width, w = bit / 32, shift = bit % 32;
+        uint64_t v = in[w * lanes + l] >> shift;
+        if (shift + width > 32)
+            v |= uint64_t(in[(w + 1) * lanes + l]) << (32 - shift);
+        return uint32_t(v & ((uint64_t(1) << width) - 1));
+    }
+
+    // Unpacks 128 offsets.  All the arithmetic is on 32 bit lanes,
+    // the same for four neighbouring words at a time, and the inner
+    // loops have no branches; with in and out declared not to
+    // overlap, they vectorize even at -O2.
+    template <unsigned Width>
+    void unpack(const uint32_t *__restrict in, uint32_t *__restrict out)
+    {
+        if constexpr (Width == 0)
+        {
+            std::fill(out, out + block_keys, 0);
+        }
+        else
+        {
+            constexpr uint32_t mask = Width == 32 ? ~uint32_t(0) : (uint32_t(1) << Width) - 1;
+            for (size_t k = 0; k < per_lane; k++)
+            {
+                const size_t bit = k * Width, w = bit / 32, shift = bit % 32;
+                const uint32_t *low = in + w * lanes, *high = low + lanes;
+                uint32_t *to = out + k * lanes;
+                if (shift + Width > 32)
+                {
+                    for (size_t l = 0; l < lanes; l++)
+                        to[l] = (low[l] >> shift | high[l] << (32 - shift)) & mask;
+                }
+                else
+                {
+                    for (size_t l = 0; l < lanes; l++)
+                        to[l] = low[l] >> shift & mask;
+                }
+            }
+        }
+    }
+
+    using Unpacker = void (*)(const uint32_t *, uint32_t *);
+
+    template <size_t... Width>
+    constexpr std::array<Unpacker, sizeof...(Width)> make_unpackers(std::index_sequence<Width...>)
+    {
+        return {&unpack<Width>...};
+    }
+
+    // unpackers[w] unpacks a block packed at width w.
+    inline constexpr auto unpackers = make_unpackers(std::make_index_sequence<33>());
+}
+
+template <class V>
+class PackedKeyTree
+{
+    struct Block
+    {
+        uint64_t offset; // Where the block's data starts, in words.
+        unsigned width;  // Bits per key, or 64 for keys stored as is.
+    };
+
+public:
+    explicit PackedKeyTree(BinaryTree<uint64_t, V> &tree) : count(tree.size())
+    {
+        std::vector<uint64_t> keys(count);
+        values.resize(count);
+        tree.export_columns(keys.data(), values.data());
+        uint64_t offsets[tree_pack::block_keys];
+        for (size_t start = 0; start < count; start += tree_pack::block_keys)
+        {
+            size_t n = std::min(tree_pack::block_keys, count - start);
+            uint64_t first = keys[start], last = keys[start + n - 1];
+            firsts.push_back(first);
+            if (last - first > UINT32_MAX)
+            {
+                // Two words per key, low half first.
+                blocks.push_back({data.size(), 64});
+                for (size_t i = 0; i < tree_pack::block_keys; i++)
+                {
+                    uint64_t key = keys[start + std::min(i, n - 1)];
+                    data.push_back(uint32_t(key));
+                    data.push_back(uint32_t(key >> 32));
+                }
+                continue;
+            }
+            // A short last block repeats its last key as padding.
+            for (size_t i = 0; i < tree_pack::block_keys; i++)
+                offsets[i] = keys[start + std::min(i, n - 1)] - first;
+            unsigned width = std::bit_width(last - first);
+            blocks.push_back({data.size(), width});
+            data.resize(data.size() + tree_pack::lanes * width);
+            tree_pack::pack(offsets, width, data.data() + blocks.back().offset);
+        }
+    }
+
+    const V *get(uint64_t key) const
+    {
+        size_t b = std::upper_bound(firsts.begin(), firsts.end(), key) - firsts.begin();
+        if (b == 0)
+            return nullptr;
+        b--;
+        size_t lo = 0, hi = block_size(b);
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (key_at(b, mid) < key)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == block_size(b) || key_at(b, lo) != key)
+            return nullptr;
+        return &values[b * tree_pack::block_keys + lo];
+    }
+
+    bool contains(uint64_t key) const
+    {
+        return get(key) != nullptr;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // Calls fn(key, value) for every key in [lo, hi), in order,
+    // unpacking a block at a time.
+    template <class F>
+    void scan(uint64_t lo, uint64_t hi, F fn) const
+    {
+        size_t b = std::upper_bound(firsts.begin(), firsts.end(), lo) - firsts.begin();
+        b = b ? b - 1 : 0;
+        uint32_t offsets[tree_pack::block_keys];
+        for (; b < blocks.size() && firsts[b] < hi; b++)
+        {
+            const V *vals = values.data() + b * tree_pack::block_keys;
+            size_t n = block_size(b), i = 0;
+            if (blocks[b].width == 64)
+            {
+                while (i < n && key_at(b, i) < lo)
+                    i++;
+                for (; i < n && key_at(b, i) < hi; i++)
+                    fn(key_at(b, i), vals[i]);
+                continue;
+            }
+            // Everything in the block is within 2^32 of its first
+            // key, so the bounds can be compared as offsets too.
+            uint64_t first = firsts[b];
+            tree_pack::unpackers[blocks[b].width](data.data() + blocks[b].offset, offsets);
+            if (lo > first)
+                i = std::lower_bound(offsets, offsets + n, lo - first) - offsets;
+            size_t end = n;
+            if (hi - first <= UINT32_MAX)
+                end = std::lower_bound(offsets + i, offsets + n, hi - first) - offsets;
+            for (; i < end; i++)
+                fn(first + offsets[i], vals[i]);
+        }
+    }
+
+    // Bytes used by the keys, and by everything.
+    size_t key_bytes() const
+    {
+        return data.size() * sizeof(uint32_t) + firsts.size() * sizeof(uint64_t) + blocks.size() * sizeof(Block);
+    }
+    size_t memory_bytes() const
+    {
+        return key_bytes() + values.size() * sizeof(V);
+    }
+
+private:
+    size_t block_size(size_t b) const
+    {
+        return std::min(tree_pack::block_keys, count - b * tree_pack::block_keys);
+    }
+
+    uint64_t key_at(size_t b, size_t i) const
+    {
+        const uint32_t *in = data.data() + blocks[b].offset;
+        if (blocks[b].width == 64)
+            return in[2 * i] | uint64_t(in[2 * i + 1]) << 32;
+        return firsts[b] + tree_pack::extract(in, blocks[b].width, i);
+    }
+
+    size_t count;
+    std::vector<uint64_t> firsts;
+    std::vector<Block> blocks;
+    std::vector<uint32_t> data;
+    std::vector<V> values;
+};
+
+#endif // TREE_PACKED_HPP
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include "tree_packed.hpp"
+
+TEST(PackedTest, PackAndUnpackEveryWidth)
+{
+    std::mt19937_64 rng(7);
+    for (unsigned width = 0; width <= 32; width++)
+    {
+        uint64_t offsets[tree_pack::block_keys];
+        uint32_t out[tree_pack::block_keys];
+        for (auto &o : offsets)
+            o = width == 0 ? 0 : rng() & ((uint64_t(1) << width) - 1);
+        std::vector<uint32_t> packed(tree_pack::lanes * width + 1, 0xdeadbeef);
+        tree_pack::pack(offsets, width, packed.data());
+        EXPECT_EQ(packed.back(), 0xdeadbeef);
+        tree_pack::unpackers[width](packed.data(), out);
+        for (size_t i = 0; i < tree_pack::block_keys; i++)
+        {
+            ASSERT_EQ(out[i], offsets[i]);
+            ASSERT_EQ(tree_pack::extract(packed.data(), width, i), offsets[i]);
+        }
+    }
+}
+
+TEST(PackedTest, MatchesTree)
+{
+    for (int n : {0, 1, 127, 128, 129, 5000})
+    {
+        BinaryTree<uint64_t, int> b;
+        std::map<uint64_t, int> m;
+        std::mt19937_64 rng(n);
+        // Mostly close together, with the odd big jump so some
+        // blocks have to store their keys as they are.
+        uint64_t key = 1700000000000;
+        for (int i = 0; i < n; i++)
+        {
+            key += rng() % 50 == 0 ? rng() % (uint64_t(1) << 40) : 1 + rng() % 1000;
+            m[key] = i;
+        }
+        // Inserted in random order, to keep the tree shallow.
+        std::vector<std::pair<uint64_t, int>> entries(m.begin(), m.end());
+        std::shuffle(entries.begin(), entries.end(), rng);
+        for (auto [k, v] : entries)
+            b[k] = v;
+        PackedKeyTree<int> p(b);
+        EXPECT_EQ(p.size(), m.size());
+
+        for (auto [k, v] : m)
+        {
+            for (uint64_t probe : {k - 1, k, k + 1})
+            {
+                const int *found = p.get(probe);
+                auto expect = m.find(probe);
+                ASSERT_EQ(found != nullptr, expect != m.end());
+                if (found)
+                {
+                    EXPECT_EQ(*found, expect->second);
+                }
+            }
+        }
+        EXPECT_FALSE(p.contains(0));
+        EXPECT_FALSE(p.contains(UINT64_MAX));
+
+        for (int i = 0; i < 50 && n > 0; i++)
+        {
+            auto lo = std::next(m.begin(), rng() % n)->first + rng() % 3 - 1;
+            auto hi = lo + rng() % (200 * 1000);
+            std::vector<std::pair<uint64_t, int>> got, want;
+            p.scan(lo, hi, [&](uint64_t k, int v) { got.push_back({k, v}); });
+            for (auto it = m.lower_bound(lo); it != m.end() && it->first < hi; ++it)
+                want.push_back(*it);
+            ASSERT_EQ(got, want);
+        }
+    }
+}
+
+TEST(PackedTest, SequentialKeysPackSmall)
+{
+    std::vector<int> order(100000);
+    for (int i = 0; i < 100000; i++)
+        order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(3));
+    BinaryTree<uint64_t, int> b;
+    for (int i : order)
+        b[1700000000000 + 1000 * uint64_t(i)] = i;
+    PackedKeyTree<int> p(b);
+    // 1000 * 127 fits in 17 bits, plus the per block overhead.
+    EXPECT_LE(p.key_bytes(), 100000 * 3);
+    EXPECT_EQ(*p.get(1700000000000 + 1000 * 54321), 54321);
+    size_t seen = 0;
+    p.scan(0, UINT64_MAX, [&](uint64_t, int v) { EXPECT_EQ(v, int(seen++)); });
+    EXPECT_EQ(seen, 100000u);
+}
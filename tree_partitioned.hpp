@@ -0,0 +1,163 @@
+// A tree split into partitions by key, typically by time: each
+// partition covers one interval (an hour, a day) and is a
+// BinaryTree of its own, with its own node pool.  Expiring old
+// data is then a matter of dropping whole partitions rather than
+// erasing keys one at a time; for keys and values that need no
+// destructor, dropping a partition just hands its pool's chunks
+// back, without visiting a single node.
+//
+// part(key) gives the partition a key belongs to.  It has to be
+// monotonic, so that every key in a lower partition is less than
+// every key in a higher one; that is what lets a range scan run
+// through the partitions in order and come out sorted.
+
+#ifndef TREE_PARTITIONED_HPP
+#define TREE_PARTITIONED_HPP
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "tree.hpp"
+
+// Partitions keys (times, say) into fixed width intervals.
+template <int64_t Width>
+struct FixedPartitions
+{
+    template <class K>
+    int64_t operator()(const K &key) const
+    {
+        // Rounding down, so negative keys split the same way.
+        int64_t k = int64_t(key);
+        return k / Width - (k % Width < 0);
+    }
+};
+
+template <class K, class V, class Part>
+class PartitionedTree
+{
+    using Tree = BinaryTree<K, V>;
+
+public:
+    explicit PartitionedTree(Part part = Part()) : part(std::move(part)), count(0), last(nullptr), last_id(0)
+    {
+    }
+
+    V &operator[](const K &key)
+    {
+        Tree &tree = partition(part(key));
+        size_t before = tree.size();
+        V &value = tree[key];
+        count += tree.size() - before;
+        return value;
+    }
+
+    V *get(const K &key)
+    {
+        Tree *tree = find_partition(part(key));
+        return tree ? tree->get(key) : nullptr;
+    }
+
+    bool contains(const K &key)
+    {
+        return get(key) != nullptr;
+    }
+
+    void erase(const K &key)
+    {
+        Tree *tree = find_partition(part(key));
+        if (!tree)
+            return;
+        size_t before = tree->size();
+        tree->erase(key);
+        count -= before - tree->size();
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    // How many partitions there are (empty ones included).
+    size_t partition_count() const
+    {
+        return partitions.size();
+    }
+
+    // Drops every partition before id, returning how many entries
+    // went with them.
+    size_t drop_before(int64_t id)
+    {
+        size_t dropped = 0;
+        while (partitions.size() > 0)
+        {
+            auto it = partitions.begin();
+            int64_t first = (*it).first;
+            if (first >= id)
+                break;
+            dropped += (*it).second->size();
+            partitions.erase(first);
+        }
+        count -= dropped;
+        last = nullptr;
+        return dropped;
+    }
+
+    // Drops the partitions that hold only keys older than key's.
+    size_t drop_older_than(const K &key)
+    {
+        return drop_before(part(key));
+    }
+
+    // Calls fn(key, value) for every key in [lo, hi), in order,
+    // running through the partitions from lo's to hi's.
+    template <class F>
+    void scan(const K &lo, const K &hi, F fn)
+    {
+        int64_t last_part = part(hi);
+        for (auto p = partitions.lower_bound(part(lo)); p != std::default_sentinel; ++p)
+        {
+            auto [id, tree] = *p;
+            if (id > last_part)
+                break;
+            for (auto it = tree->lower_bound(lo); it != std::default_sentinel; ++it)
+            {
+                auto [key, value] = *it;
+                if (!(key < hi))
+                    return;
+                fn(key, value);
+            }
+        }
+    }
+
+private:
+    // Most writes go to the newest partition, so the last one used
+    // is kept to hand.
+    Tree &partition(int64_t id)
+    {
+        if (last && last_id == id)
+            return *last;
+        std::unique_ptr<Tree> &tree = partitions[id];
+        if (!tree)
+            tree = std::make_unique<Tree>();
+        last = tree.get();
+        last_id = id;
+        return *last;
+    }
+
+    Tree *find_partition(int64_t id)
+    {
+        if (last && last_id == id)
+            return last;
+        std::unique_ptr<Tree> *tree = partitions.get(id);
+        return tree ? tree->get() : nullptr;
+    }
+
+    Part part;
+    BinaryTree<int64_t, std::unique_ptr<Tree>> partitions;
+    size_t count;
+    Tree *last;
+    int64_t last_id;
+};
+
+#endif // TREE_PARTITIONED_HPP
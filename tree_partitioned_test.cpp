@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_partitioned.hpp"
+
+TEST(PartitionedTest, MatchesMap)
+{
+    // Hour wide partitions of second timestamps.
+    PartitionedTree<int64_t, uint64_t, FixedPartitions<3600>> t;
+    std::map<int64_t, uint64_t> m;
+    std::mt19937_64 rng(4);
+    for (int i = 0; i < 20000; i++)
+    {
+        int64_t time = int64_t(rng() % (24 * 3600)) - 3600;
+        if (rng() % 5 == 0)
+        {
+            t.erase(time);
+            m.erase(time);
+        }
+        else
+        {
+            t[time] = i;
+            m[time] = i;
+        }
+    }
+    EXPECT_EQ(t.size(), m.size());
+    EXPECT_EQ(t.partition_count(), 24u);
+
+    std::vector<std::pair<int64_t, uint64_t>> seen;
+    t.scan(-100, 7300, [&](int64_t k, uint64_t v) { seen.push_back({k, v}); });
+    std::vector<std::pair<int64_t, uint64_t>> expect(m.lower_bound(-100), m.lower_bound(7300));
+    EXPECT_EQ(seen, expect);
+
+    // Keep the last 12 hours.
+    size_t dropped = t.drop_older_than(11 * 3600);
+    size_t expect_dropped = std::distance(m.begin(), m.lower_bound(11 * 3600));
+    m.erase(m.begin(), m.lower_bound(11 * 3600));
+    EXPECT_EQ(dropped, expect_dropped);
+    EXPECT_EQ(t.size(), m.size());
+    EXPECT_EQ(t.partition_count(), 12u);
+    EXPECT_FALSE(t.contains(3));
+    EXPECT_EQ(t.get(5), nullptr);
+    for (auto [k, v] : m)
+        ASSERT_EQ(*t.get(k), v);
+
+    seen.clear();
+    t.scan(INT64_MIN, INT64_MAX, [&](int64_t k, uint64_t v) { seen.push_back({k, v}); });
+    expect.assign(m.begin(), m.end());
+    EXPECT_EQ(seen, expect);
+
+    // Writing into a dropped interval starts it again.
+    t[5] = 1;
+    EXPECT_EQ(t.partition_count(), 13u);
+    EXPECT_EQ(t.size(), m.size() + 1);
+}
+
+TEST(PartitionedTest, OwningValues)
+{
+    PartitionedTree<int, std::string, FixedPartitions<100>> t;
+    for (int i = 0; i < 1000; i++)
+        t[i] = std::string(40, char('a' + i % 26));
+    EXPECT_EQ(t.drop_before(5), 500u);
+    EXPECT_EQ(*t.get(777), std::string(40, char('a' + 777 % 26)));
+    EXPECT_EQ(t.drop_before(100), 500u);
+    EXPECT_EQ(t.size(), 0u);
+}
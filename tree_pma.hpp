@@ -0,0 +1,385 @@
+// An ordered map kept in one sorted array with gaps in it: a
+// packed memory array.  A BinaryTree scan chases a pointer per
+// entry; here a full scan reads the keys and values straight
+// through memory, so it runs at memory bandwidth, while inserts
+// and erases still only move a few entries around.
+//
+// The array is cut into segments of 64 slots.  Each segment keeps
+// its entries sorted at its front, with the gap at its end, so an
+// insert or erase shifts at most one segment's worth of entries.
+// When a segment fills up, the smallest aligned window of segments
+// around it (2, 4, 8... segments) that is sparse enough gets its
+// entries spread evenly across it again; the allowed density is 1
+// for a single segment and falls to 3/4 for the whole array, so
+// every rebalance leaves room for a good many more inserts before
+// the next.  Erases work the same way with a floor on density
+// (1/8 for a segment, up to 1/4 for the whole array), which also
+// means no segment is ever left empty.  When the whole array is
+// too full or too empty it is reallocated at half density.
+//
+// Lookups don't binary search the big array: each segment's first
+// key also sits in a small implicit search tree, stored in
+// breadth first (Eytzinger) order, so the top levels of the
+// search share a few cache lines.  It finds the segment, and a
+// search of that segment's 64 slots finds the entry.  Entries that
+// rebalancing moves just update their segments' slots in it.
+//
+// Keys and values have to be default constructible, as every gap
+// holds one, and are moved around as the array rebalances, so
+// iterators and pointers to values are only good until the next
+// insert or erase.
+
+#ifndef TREE_PMA_HPP
+#define TREE_PMA_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+template <class K, class V>
+class PmaTree
+{
+    static constexpr size_t segment_size = 64;
+
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using reference = std::pair<const K &, V &>;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() : tree(nullptr), slot(0)
+        {
+        }
+
+        reference operator*() const
+        {
+            return reference(tree->keys[slot], tree->values[slot]);
+        }
+
+        Iterator &operator++()
+        {
+            slot++;
+            // Off the end of this segment's entries: on to the start
+            // of the next segment.
+            size_t s = (slot - 1) / segment_size;
+            if (slot == s * segment_size + tree->fill[s])
+                slot = (s + 1) * segment_size;
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator was = *this;
+            ++*this;
+            return was;
+        }
+
+        bool operator==(const Iterator &other) const
+        {
+            return slot == other.slot;
+        }
+        bool operator==(std::default_sentinel_t) const
+        {
+            return slot >= tree->keys.size();
+        }
+
+    private:
+        friend class PmaTree;
+        Iterator(PmaTree *tree, size_t slot) : tree(tree), slot(slot)
+        {
+        }
+
+        PmaTree *tree;
+        size_t slot;
+    };
+
+    PmaTree() : count(0)
+    {
+        resize(0);
+    }
+
+    // Inserts key with a default value if it isn't there.
+    V &operator[](const K &key)
+    {
+        while (true)
+        {
+            size_t s = segment_for(key);
+            size_t start = s * segment_size, end = start + fill[s];
+            size_t at = std::lower_bound(keys.begin() + start, keys.begin() + end, key) - keys.begin();
+            if (at < end && !(key < keys[at]))
+                return values[at];
+            if (fill[s] == segment_size)
+            {
+                // Spread things out and look again.
+                make_room(s);
+                continue;
+            }
+            std::move_backward(keys.begin() + at, keys.begin() + end, keys.begin() + end + 1);
+            std::move_backward(values.begin() + at, values.begin() + end, values.begin() + end + 1);
+            keys[at] = key;
+            values[at] = V();
+            fill[s]++;
+            count++;
+            if (at == start)
+                index[slot_of[s]] = keys[at];
+            return values[at];
+        }
+    }
+
+    // A pointer to the value for key, or null if it isn't there.
+    V *get(const K &key)
+    {
+        size_t at = find(key);
+        return at == npos ? nullptr : &values[at];
+    }
+
+    bool contains(const K &key)
+    {
+        return find(key) != npos;
+    }
+
+    void erase(const K &key)
+    {
+        size_t at = find(key);
+        if (at == npos)
+            return;
+        size_t s = at / segment_size, start = s * segment_size, end = start + fill[s];
+        std::move(keys.begin() + at + 1, keys.begin() + end, keys.begin() + at);
+        std::move(values.begin() + at + 1, values.begin() + end, values.begin() + at);
+        values[end - 1] = V();
+        fill[s]--;
+        count--;
+        if (at == start && fill[s] > 0)
+            index[slot_of[s]] = keys[start];
+        if (fill.size() > 1 && fill[s] < segment_size / 8)
+            thin_out(s);
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    Iterator begin()
+    {
+        return Iterator(this, count ? 0 : keys.size());
+    }
+    std::default_sentinel_t end()
+    {
+        return std::default_sentinel;
+    }
+
+    // An iterator at the first key that is not less than key.
+    Iterator lower_bound(const K &key)
+    {
+        if (!count)
+            return begin();
+        size_t s = segment_for(key);
+        size_t start = s * segment_size, end = start + fill[s];
+        size_t at = std::lower_bound(keys.begin() + start, keys.begin() + end, key) - keys.begin();
+        // Everything in the next segment is bigger than key.
+        return Iterator(this, at < end ? at : start + segment_size);
+    }
+
+    // Copies the entries out, in key order, and returns how many
+    // there were.  Each segment is one contiguous copy.
+    size_t export_columns(K *keys_out, V *values_out) const
+    {
+        for (size_t s = 0; s < fill.size(); s++)
+        {
+            size_t start = s * segment_size;
+            keys_out = std::copy(keys.begin() + start, keys.begin() + start + fill[s], keys_out);
+            values_out = std::copy(values.begin() + start, values.begin() + start + fill[s], values_out);
+        }
+        return count;
+    }
+
+    // Slots allocated, used or not.
+    size_t capacity() const
+    {
+        return keys.size();
+    }
+
+private:
+    static constexpr size_t npos = size_t(-1);
+
+    // The slot holding key, or npos.
+    size_t find(const K &key) const
+    {
+        if (!count)
+            return npos;
+        size_t s = segment_for(key);
+        size_t start = s * segment_size, end = start + fill[s];
+        size_t at = std::lower_bound(keys.begin() + start, keys.begin() + end, key) - keys.begin();
+        return at < end && !(key < keys[at]) ? at : npos;
+    }
+
+    // The last segment whose first key is not more than key (or the
+    // first segment if key is less than everything): the one key is
+    // in, or would go in.  This is an upper bound search of the
+    // Eytzinger tree, which leaves k at the first key bigger than
+    // key once the trailing right turns are shifted off.
+    size_t segment_for(const K &key) const
+    {
+        size_t n = fill.size(), k = 1;
+        while (k <= n)
+            k = 2 * k + !(key < index[k]);
+        k >>= std::countr_one(k) + 1;
+        if (k == 0)
+            return n - 1;
+        return segment_at[k] ? segment_at[k] - 1 : 0;
+    }
+
+    // The density limits for a window of 2^level segments, out of
+    // height levels, as fractions of its slots.
+    size_t upper_limit(size_t level, size_t height, size_t slots) const
+    {
+        return slots - slots * level / (4 * height);
+    }
+    size_t lower_limit(size_t level, size_t height, size_t slots) const
+    {
+        return slots / 8 + slots * level / (8 * height);
+    }
+
+    // Segment s is full.  Rebalances the smallest window around it
+    // that can take one more entry within its limit, or grows.
+    void make_room(size_t s)
+    {
+        size_t height = std::countr_zero(fill.size());
+        for (size_t level = 1; level <= height; level++)
+        {
+            size_t width = size_t(1) << level, first = s & ~(width - 1);
+            size_t entries = window_count(first, width) + 1;
+            if (entries <= upper_limit(level, height, width * segment_size))
+            {
+                spread(first, width);
+                return;
+            }
+        }
+        resize(count + 1);
+    }
+
+    // Segment s is below its floor.  Rebalances the smallest window
+    // around it that is above its own floor, or shrinks.
+    void thin_out(size_t s)
+    {
+        size_t height = std::countr_zero(fill.size());
+        for (size_t level = 1; level <= height; level++)
+        {
+            size_t width = size_t(1) << level, first = s & ~(width - 1);
+            if (window_count(first, width) >= lower_limit(level, height, width * segment_size))
+            {
+                spread(first, width);
+                return;
+            }
+        }
+        resize(count);
+    }
+
+    size_t window_count(size_t first, size_t width) const
+    {
+        size_t entries = 0;
+        for (size_t s = first; s < first + width; s++)
+            entries += fill[s];
+        return entries;
+    }
+
+    // Gathers the entries of a window of segments into the spare
+    // buffers, then deals them back out evenly.
+    void spread(size_t first, size_t width)
+    {
+        gather(first, width);
+        scatter(first, width);
+    }
+
+    void gather(size_t first, size_t width)
+    {
+        spare_keys.clear();
+        spare_values.clear();
+        for (size_t s = first; s < first + width; s++)
+        {
+            size_t start = s * segment_size;
+            for (size_t i = start; i < start + fill[s]; i++)
+            {
+                spare_keys.push_back(std::move(keys[i]));
+                spare_values.push_back(std::move(values[i]));
+            }
+        }
+    }
+
+    void scatter(size_t first, size_t width)
+    {
+        size_t entries = spare_keys.size(), next = 0;
+        for (size_t s = first; s < first + width; s++)
+        {
+            size_t start = s * segment_size, take = entries / width + (s - first < entries % width);
+            for (size_t i = 0; i < segment_size; i++)
+            {
+                if (i < take)
+                {
+                    keys[start + i] = std::move(spare_keys[next]);
+                    values[start + i] = std::move(spare_values[next]);
+                    next++;
+                }
+                else if (i < fill[s])
+                {
+                    // A slot this segment used to fill is a gap now.
+                    values[start + i] = V();
+                }
+            }
+            fill[s] = take;
+            if (take)
+                index[slot_of[s]] = keys[start];
+        }
+    }
+
+    // Reallocates the array for entries entries at about half
+    // density, and spreads them across it.
+    void resize(size_t entries)
+    {
+        gather(0, fill.size());
+        size_t segments = std::bit_ceil(std::max<size_t>(1, (2 * entries + segment_size - 1) / segment_size));
+        keys = std::vector<K>(segments * segment_size);
+        values = std::vector<V>(segments * segment_size);
+        fill.assign(segments, 0);
+        index = std::vector<K>(segments + 1);
+        segment_at.assign(segments + 1, 0);
+        slot_of.assign(segments, 0);
+        size_t next = 0;
+        number(1, next);
+        scatter(0, segments);
+    }
+
+    // Numbers the Eytzinger tree's slots in order, from slot k.
+    void number(size_t k, size_t &next)
+    {
+        if (k >= segment_at.size())
+            return;
+        number(2 * k, next);
+        segment_at[k] = next;
+        slot_of[next++] = k;
+        number(2 * k + 1, next);
+    }
+
+    size_t count;
+    std::vector<K> keys;
+    std::vector<V> values;
+    // How many entries each segment holds, at its front.
+    std::vector<size_t> fill;
+    // The first key of every segment, in Eytzinger order from
+    // slot 1, and the maps between its slots and the segments.
+    std::vector<K> index;
+    std::vector<size_t> segment_at;
+    std::vector<size_t> slot_of;
+    // Scratch space for rebalancing.
+    std::vector<K> spare_keys;
+    std::vector<V> spare_values;
+};
+
+#endif // TREE_PMA_HPP
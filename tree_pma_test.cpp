@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_pma.hpp"
+
+TEST(PmaTest, MatchesMap)
+{
+    PmaTree<uint64_t, uint64_t> p;
+    std::map<uint64_t, uint64_t> m;
+    std::mt19937_64 rng(4);
+    // Grow to 20000 keys, shrink back to a handful, grow again.
+    for (int round = 0; round < 3; round++)
+    {
+        for (int i = 0; i < 40000; i++)
+        {
+            uint64_t k = rng() % 50000;
+            bool grow = round != 1;
+            if (rng() % 4 != 0 ? grow : !grow)
+            {
+                p[k] = m[k] = rng();
+            }
+            else
+            {
+                p.erase(k);
+                m.erase(k);
+            }
+            ASSERT_EQ(p.size(), m.size());
+        }
+
+        auto it = m.begin();
+        for (auto [key, value] : p)
+        {
+            ASSERT_EQ(key, it->first);
+            ASSERT_EQ(value, it->second);
+            ++it;
+        }
+        EXPECT_TRUE(it == m.end());
+
+        for (uint64_t k = 0; k < 50001; k += 7)
+        {
+            uint64_t *found = p.get(k);
+            auto expect = m.find(k);
+            ASSERT_EQ(found != nullptr, expect != m.end());
+            if (found)
+            {
+                EXPECT_EQ(*found, expect->second);
+            }
+            auto lb = p.lower_bound(k);
+            auto mlb = m.lower_bound(k);
+            if (mlb == m.end())
+            {
+                ASSERT_TRUE(lb == p.end());
+            }
+            else
+            {
+                ASSERT_EQ((*lb).first, mlb->first);
+            }
+        }
+        // Never more than a few times the slots it needs.
+        EXPECT_LE(p.capacity(), 64 + 8 * m.size());
+    }
+}
+
+TEST(PmaTest, SequentialAndReverseInserts)
+{
+    for (bool reverse : {false, true})
+    {
+        PmaTree<int, int> p;
+        for (int i = 0; i < 10000; i++)
+        {
+            int k = reverse ? 10000 - i : i;
+            p[k] = -k;
+        }
+        EXPECT_EQ(p.size(), 10000u);
+        std::vector<int> keys(p.size()), values(p.size());
+        EXPECT_EQ(p.export_columns(keys.data(), values.data()), 10000u);
+        for (size_t i = 1; i < keys.size(); i++)
+        {
+            ASSERT_LT(keys[i - 1], keys[i]);
+            ASSERT_EQ(values[i], -keys[i]);
+        }
+        for (int i = 0; i < 10000; i++)
+            p.erase(reverse ? i + 1 : i);
+        EXPECT_EQ(p.size(), 0u);
+        EXPECT_TRUE(p.begin() == p.end());
+        EXPECT_EQ(p.capacity(), 64u);
+    }
+}
+
+TEST(PmaTest, MoveOnlyValuesAndStringKeys)
+{
+    PmaTree<std::string, std::unique_ptr<int>> p;
+    for (int i = 0; i < 500; i++)
+        p["key" + std::to_string(i)] = std::make_unique<int>(i);
+    for (int i = 0; i < 500; i += 2)
+        p.erase("key" + std::to_string(i));
+    EXPECT_EQ(p.size(), 250u);
+    for (int i = 0; i < 500; i++)
+    {
+        auto *found = p.get("key" + std::to_string(i));
+        ASSERT_EQ(found != nullptr, i % 2 == 1);
+        if (found)
+        {
+            EXPECT_EQ(**found, i);
+        }
+    }
+    EXPECT_FALSE(p.contains("key0"));
+    EXPECT_TRUE(p.contains("key1"));
+}
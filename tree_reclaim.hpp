@@ -0,0 +1,166 @@
+// Deferred teardown for big trees.  Destroying a tree of tens of
+// millions of nodes takes seconds, which is no good on a thread
+// that serves requests.  Handing the tree to a reclaimer instead
+// takes constant time: it takes over the root and the node pool,
+// leaving the tree empty, and the nodes are freed later, either
+// by a thread of the reclaimer's own or in slices of bounded
+// length by whoever calls reclaim(budget).
+//
+//     reclaimer.retire(std::move(live));
+//     live = std::move(rebuilt);
+//
+// The freeing itself is BinaryTreeNode::freesome, a loop rather
+// than a recursion, so chain shaped trees can't overflow the
+// stack.  Once a tree's nodes are all gone its pool's chunks are
+// freed a few at a time too.  For keys and values that need no
+// destructor the node walk is skipped altogether.
+
+#ifndef TREE_RECLAIM_HPP
+#define TREE_RECLAIM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "tree.hpp"
+
+template <class K, class V>
+class BinaryTreeReclaimer
+{
+    // What is left of a retired tree.
+    struct Retired
+    {
+        BinaryTreeNode<K, V> *root;
+        BinaryTreeNodePool<K, V> pool;
+    };
+
+public:
+    enum Mode
+    {
+        manual,    // Nodes are only freed by reclaim().
+        background // A thread of our own frees them as they come.
+    };
+
+    explicit BinaryTreeReclaimer(Mode mode = manual) : outstanding(0), stopping(false)
+    {
+        if (mode == background)
+            worker = std::thread([this] { run(); });
+    }
+    BinaryTreeReclaimer(const BinaryTreeReclaimer &) = delete;
+    BinaryTreeReclaimer &operator=(const BinaryTreeReclaimer &) = delete;
+
+    // Frees whatever is still outstanding before going.
+    ~BinaryTreeReclaimer()
+    {
+        if (worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+        reclaim(SIZE_MAX);
+    }
+
+    // Takes tree's nodes, leaving it empty, in constant time.
+    void retire(BinaryTree<K, V> &&tree)
+    {
+        auto retired = std::make_unique<Retired>();
+        retired->root = std::exchange(tree.root, nullptr);
+        retired->pool.swap(tree.pool);
+        tree.modified();
+        outstanding += retired->pool.size();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(std::move(retired));
+        }
+        wake.notify_one();
+    }
+
+    // Does at most budget steps of freeing (a step frees or rotates
+    // one node; freeing a chunk of nodes counts as several), and
+    // returns how many it did; fewer than budget means there is
+    // nothing left.
+    size_t reclaim(size_t budget)
+    {
+        std::lock_guard<std::mutex> working(work_mutex);
+        size_t start = budget;
+        while (budget)
+        {
+            if (!current)
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (queue.empty())
+                    break;
+                current = std::move(queue.front());
+                queue.pop_front();
+            }
+            size_t before = current->pool.size();
+            if constexpr (!std::is_trivially_destructible_v<K> || !std::is_trivially_destructible_v<V>)
+                current->root = BinaryTreeNode<K, V>::freesome(current->root, current->pool, budget);
+            else
+                current->root = nullptr;
+            if (!current->root)
+            {
+                // The nodes are gone, so the chunks can go, one at a
+                // time.  Handing a big chunk back to the system costs
+                // about as much as freeing a few hundred nodes, so
+                // each is charged that much of the budget.
+                while (budget && current->pool.release_chunk())
+                    budget -= std::min(budget, chunk_steps);
+            }
+            outstanding -= before - current->pool.size();
+            if (budget)
+                current.reset();
+        }
+        return start - budget;
+    }
+
+    // How many retired nodes haven't been freed yet.
+    size_t pending() const
+    {
+        return outstanding;
+    }
+
+private:
+    // The background thread frees a slice at a time, so that a
+    // manual reclaim() or the destructor never waits long for it.
+    void run()
+    {
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping)
+                    return;
+            }
+            while (reclaim(slice) == slice)
+            {
+            }
+        }
+    }
+
+    static constexpr size_t slice = 1 << 16;
+    static constexpr size_t chunk_steps = 256;
+
+    std::atomic<size_t> outstanding;
+    std::unique_ptr<Retired> current;
+    std::deque<std::unique_ptr<Retired>> queue;
+    std::mutex queue_mutex;
+    std::mutex work_mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread worker;
+};
+
+#endif // TREE_RECLAIM_HPP
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include "tree_reclaim.hpp"
+
+// A tree that is one long chain down the right, built directly
+// (adding sorted keys one at a time would take quadratic time).
+template <class V>
+struct ChainTree : BinaryTree<int, V>
+{
+    explicit ChainTree(int n)
+    {
+        BinaryTreeNode<int, V> **link = &this->root;
+        for (int i = 0; i < n; i++)
+        {
+            *link = this->pool.create(i);
+            this->value_of(*link) = V(1, 'x');
+            link = &this->right_of(*link);
+        }
+    }
+};
+
+TEST(ReclaimTest, LongChainsDontOverflowTheStack)
+{
+    {
+        ChainTree<std::string> chain(2000000);
+        EXPECT_EQ(chain.size(), 2000000u);
+        EXPECT_EQ(*chain.get(1999999), "x");
+    }
+    BinaryTreeReclaimer<int, std::string> reclaimer;
+    reclaimer.retire(ChainTree<std::string>(2000000));
+    EXPECT_EQ(reclaimer.pending(), 2000000u);
+    EXPECT_LT(reclaimer.reclaim(SIZE_MAX), SIZE_MAX);
+    EXPECT_EQ(reclaimer.pending(), 0u);
+}
+
+TEST(ReclaimTest, BoundedSlices)
+{
+    auto counter = std::make_shared<int>(0);
+    BinaryTree<int, std::shared_ptr<int>> tree;
+    for (int i = 0; i < 10000; i++)
+        tree[(i * 7919) % 10000] = counter;
+    BinaryTreeReclaimer<int, std::shared_ptr<int>> reclaimer;
+    reclaimer.retire(std::move(tree));
+    // The tree is left empty and usable, and nothing is freed yet.
+    EXPECT_EQ(tree.size(), 0u);
+    EXPECT_TRUE(tree.begin() == tree.end());
+    tree[5] = nullptr;
+    EXPECT_EQ(tree.size(), 1u);
+    EXPECT_EQ(counter.use_count(), 10001);
+
+    size_t pending = reclaimer.pending(), slices = 0;
+    while (reclaimer.reclaim(100) == 100)
+    {
+        EXPECT_LE(reclaimer.pending(), pending);
+        EXPECT_GE(reclaimer.pending() + 100, pending);
+        pending = reclaimer.pending();
+        slices++;
+    }
+    // Each node is freed once and rotated at most once, and then
+    // there are the chunks.
+    EXPECT_GE(slices, 100u);
+    EXPECT_LE(slices, 240u);
+    EXPECT_EQ(reclaimer.pending(), 0u);
+    EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(ReclaimTest, BackgroundThread)
+{
+    BinaryTreeReclaimer<uint64_t, std::string> reclaimer(BinaryTreeReclaimer<uint64_t, std::string>::background);
+    for (int round = 0; round < 5; round++)
+    {
+        BinaryTree<uint64_t, std::string> tree;
+        for (uint64_t i = 0; i < 20000; i++)
+            tree[i * 2654435761u % 100003] = "value";
+        reclaimer.retire(std::move(tree));
+    }
+    for (int i = 0; i < 1000 && reclaimer.pending() > 0; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_EQ(reclaimer.pending(), 0u);
+    EXPECT_EQ(reclaimer.reclaim(10), 0u);
+}
+
+TEST(ReclaimTest, TrivialTypesJustDropChunks)
+{
+    BinaryTree<int, int> tree;
+    for (int i = 0; i < 50000; i++)
+        tree[(i * 7919) % 50000] = i;
+    BinaryTreeReclaimer<int, int> reclaimer;
+    reclaimer.retire(std::move(tree));
+    // No node walk, so the chunks are all there is to free.
+    size_t steps = reclaimer.reclaim(SIZE_MAX);
+    EXPECT_LT(steps, 10000u);
+    EXPECT_EQ(reclaimer.pending(), 0u);
+}
@@ -0,0 +1,471 @@
+// A tree that lives in a memory mapped file, so that one writer
+// process can keep it up to date while any number of reader
+// processes look things up in it directly, with no copying and no
+// messages between them.  Since the file is the tree, it also
+// survives restarts: opening it again picks up where it left off.
+//
+// Nothing in the file may depend on where it is mapped, so nodes
+// link to each other with self-relative offsets (the distance from
+// the link itself to the node it points at, 0 for none) rather
+// than pointers, and the file carries its own allocator: nodes are
+// handed out from the end of the used space, and erased nodes go
+// on a free list for reuse.  The file is sized up front for a set
+// number of nodes; assigning a new key to a full tree throws.
+//
+// Readers and the writer share a sequence lock.  The writer makes
+// the sequence number odd while it changes the tree and even again
+// when it is done; a reader notes the number before a lookup and
+// checks it afterwards, and if a change happened in between (or
+// was in progress) it just looks again.  A lookup that starts
+// mid-change can follow a half updated link, so readers check
+// every offset lands on a node in the file and give up after as
+// many steps as there are nodes, before trusting what they find.
+//
+// Only one process may open a file for writing at a time, which
+// is enforced with an flock.  Keys and values have to be
+// trivially copyable.
+//
+// A writer that dies part way through a change leaves the
+// sequence number odd for good.  Readers that have waited a while
+// for it check whether the flock is still held, and if it isn't
+// get() throws rather than waiting forever.  Opening the file
+// read_write then refuses too, since the tree may not be whole;
+// opening it in recover mode rebuilds the tree from every entry
+// still reachable from the root (the change that was under way,
+// and any entry it was moving, may be lost) and carries on as a
+// writer.
+
+#ifndef TREE_SHARED_HPP
+#define TREE_SHARED_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template <class K, class V>
+class SharedTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "SharedTree stores keys and values as raw bytes");
+
+    struct Node
+    {
+        K key;
+        V value;
+        int64_t left;
+        int64_t right;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t key_size;
+        uint64_t value_size;
+        uint64_t capacity; // Nodes the file has room for.
+        std::atomic<uint64_t> seq;
+        int64_t root;
+        uint64_t count;
+        uint64_t used; // Nodes handed out from the end so far.
+        int64_t free_list;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The sequence lock must work across processes");
+
+    // Nodes start at the first cache line after the header.
+    static constexpr size_t nodes_offset = (sizeof(Header) + 63) / 64 * 64;
+
+public:
+    enum Mode
+    {
+        read_only,
+        read_write,
+        // As read_write, but first repairs a file whose last writer
+        // died part way through a change.
+        recover
+    };
+
+    // Opens path.  When writing, a missing file is created with room
+    // for capacity nodes; otherwise capacity is ignored.
+    SharedTree(const std::string &path, Mode mode, uint64_t capacity = 1 << 20) : writable(mode != read_only)
+    {
+        fd = ::open(path.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Can't open " + path);
+        try
+        {
+            if (writable && !lock_for_writing())
+                throw std::runtime_error(path + " is already open for writing");
+            struct stat st;
+            if (fstat(fd, &st) != 0)
+                throw std::runtime_error("Can't stat " + path);
+            bool fresh = st.st_size == 0;
+            if (fresh && !writable)
+                throw std::runtime_error(path + " is empty");
+            mapped_size = fresh ? nodes_offset + capacity * sizeof(Node) : st.st_size;
+            if (fresh && ftruncate(fd, mapped_size) != 0)
+                throw std::runtime_error("Can't size " + path);
+            void *at = mmap(nullptr, mapped_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            if (at == MAP_FAILED)
+                throw std::runtime_error("Can't map " + path);
+            base = static_cast<char *>(at);
+            if (fresh)
+                format(capacity);
+            check(path);
+            // An odd sequence number means the last writer died part
+            // way through a change, and the tree may not be whole.
+            if (writable && (header()->seq.load() & 1))
+            {
+                if (mode != recover)
+                    throw std::runtime_error(path + " was left mid-update; open it in recover mode");
+                rebuild();
+            }
+        }
+        catch (...)
+        {
+            if (base)
+                munmap(base, mapped_size);
+            ::close(fd);
+            throw;
+        }
+    }
+    SharedTree(const SharedTree &) = delete;
+    SharedTree &operator=(const SharedTree &) = delete;
+    ~SharedTree()
+    {
+        munmap(base, mapped_size);
+        ::close(fd);
+    }
+
+    // A consistent lookup, safe while another process writes.
+    // Throws std::runtime_error if the writer died mid-change.
+    std::optional<V> get(const K &key) const
+    {
+        uint64_t waits = 0;
+        while (true)
+        {
+            uint64_t before = header()->seq.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                // A change normally takes moments, so once it has
+                // taken a good while make sure the writer is still
+                // there to finish it.
+                if (++waits % 4096 == 0 && !writer_alive())
+                    throw std::runtime_error("SharedTree writer died mid-update");
+                std::this_thread::yield();
+                continue;
+            }
+            std::optional<V> found;
+            bool sane = search(key, found);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sane && header()->seq.load(std::memory_order_relaxed) == before)
+                return found;
+        }
+    }
+
+    bool contains(const K &key) const
+    {
+        return get(key).has_value();
+    }
+
+    // How many keys there are, as of some recent moment.
+    size_t size() const
+    {
+        return header()->count;
+    }
+
+    // How many keys the file has room for.
+    size_t capacity() const
+    {
+        return header()->capacity;
+    }
+
+    // Writer only.  Throws std::length_error if key is new and the
+    // file is full.
+    void assign(const K &key, const V &value)
+    {
+        require_writable();
+        int64_t *link = &header()->root;
+        while (Node *node = follow(*link))
+        {
+            if (key < node->key)
+            {
+                link = &node->left;
+            }
+            else if (node->key < key)
+            {
+                link = &node->right;
+            }
+            else
+            {
+                Writing w(header());
+                node->value = value;
+                return;
+            }
+        }
+        Node *node = allocate();
+        node->key = key;
+        node->value = value;
+        node->left = node->right = 0;
+        // The node isn't reachable yet, so only linking it in needs
+        // the lock.
+        Writing w(header());
+        point(*link, node);
+        header()->count++;
+    }
+
+    // Writer only.
+    void erase(const K &key)
+    {
+        require_writable();
+        int64_t *link = &header()->root;
+        Node *node;
+        while ((node = follow(*link)))
+        {
+            if (key < node->key)
+                link = &node->left;
+            else if (node->key < key)
+                link = &node->right;
+            else
+                break;
+        }
+        if (!node)
+            return;
+        Writing w(header());
+        if (!node->left || !node->right)
+        {
+            point(*link, follow(node->left ? node->left : node->right));
+        }
+        else
+        {
+            // Move the largest node on the left up into node's place.
+            int64_t *pred_link = &node->left;
+            Node *pred = follow(*pred_link);
+            while (pred->right)
+            {
+                pred_link = &pred->right;
+                pred = follow(*pred_link);
+            }
+            point(*pred_link, follow(pred->left));
+            point(pred->left, follow(node->left));
+            point(pred->right, follow(node->right));
+            point(*link, pred);
+        }
+        release(node);
+        header()->count--;
+    }
+
+    // Writer only.  Flushes the file to disk.
+    void sync()
+    {
+        require_writable();
+        if (msync(base, mapped_size, MS_SYNC) != 0)
+            throw std::runtime_error("msync failed");
+    }
+
+private:
+    // Holds the sequence number odd while the writer changes things.
+    struct Writing
+    {
+        explicit Writing(Header *header) : header(header)
+        {
+            header->seq.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        ~Writing()
+        {
+            header->seq.fetch_add(1, std::memory_order_release);
+        }
+        Header *header;
+    };
+
+    Header *header() const
+    {
+        return reinterpret_cast<Header *>(base);
+    }
+
+    Node *follow(const int64_t &link) const
+    {
+        return link ? reinterpret_cast<Node *>(const_cast<char *>(reinterpret_cast<const char *>(&link)) + link)
+                    : nullptr;
+    }
+
+    void point(int64_t &link, Node *to)
+    {
+        link = to ? reinterpret_cast<char *>(to) - reinterpret_cast<char *>(&link) : 0;
+    }
+
+    // Whether node is a whole node in the node area of the file.
+    bool valid(const Node *node) const
+    {
+        uintptr_t at = reinterpret_cast<uintptr_t>(node) - reinterpret_cast<uintptr_t>(base);
+        return at >= nodes_offset && at < mapped_size && (at - nodes_offset) % sizeof(Node) == 0 &&
+               at + sizeof(Node) <= mapped_size;
+    }
+
+    // The descent for get().  Returns false if it ran into
+    // something only a concurrent change could explain.
+    bool search(const K &key, std::optional<V> &found) const
+    {
+        const int64_t *link = &header()->root;
+        for (uint64_t steps = 0; *link; steps++)
+        {
+            Node *node = follow(*link);
+            if (!valid(node) || steps > header()->capacity)
+                return false;
+            if (key < node->key)
+            {
+                link = &node->left;
+            }
+            else if (node->key < key)
+            {
+                link = &node->right;
+            }
+            else
+            {
+                found = node->value;
+                return true;
+            }
+        }
+        return true;
+    }
+
+    // Takes the writer's flock.  A reader checking for a dead writer
+    // holds a shared one for a moment, so have a few goes.
+    bool lock_for_writing()
+    {
+        for (int tries = 0; tries < 10; tries++)
+        {
+            if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    // Whether a writer has the file open.  If we can take a shared
+    // flock, nobody holds the exclusive one.
+    bool writer_alive() const
+    {
+        if (writable || flock(fd, LOCK_SH | LOCK_NB) != 0)
+            return true;
+        flock(fd, LOCK_UN);
+        return false;
+    }
+
+    // Recovery after a writer died mid-change.  Copies out every
+    // entry reachable from the root, checking each link as readers
+    // do and visiting each node at most once in case the links now
+    // loop, then rebuilds the tree from scratch, balanced, and makes
+    // the sequence number even again.
+    void rebuild()
+    {
+        Header *h = header();
+        std::vector<std::pair<K, V>> entries;
+        std::vector<bool> seen(h->capacity);
+        std::vector<const int64_t *> todo{&h->root};
+        while (!todo.empty())
+        {
+            Node *node = follow(*todo.back());
+            todo.pop_back();
+            if (!node || !valid(node))
+                continue;
+            size_t index = (reinterpret_cast<char *>(node) - base - nodes_offset) / sizeof(Node);
+            if (index >= std::min(h->used, h->capacity) || seen[index])
+                continue;
+            seen[index] = true;
+            entries.emplace_back(node->key, node->value);
+            todo.push_back(&node->left);
+            todo.push_back(&node->right);
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+        entries.erase(std::unique(entries.begin(), entries.end(),
+                                  [](const auto &a, const auto &b) { return !(a.first < b.first); }),
+                      entries.end());
+        h->root = 0;
+        h->free_list = 0;
+        h->used = 0;
+        point(h->root, build(entries, 0, entries.size()));
+        h->count = entries.size();
+        h->seq.fetch_add(1, std::memory_order_release);
+    }
+
+    // Turns the sorted entries in [lo, hi) into a balanced subtree.
+    Node *build(const std::vector<std::pair<K, V>> &entries, size_t lo, size_t hi)
+    {
+        if (lo == hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = allocate();
+        node->key = entries[mid].first;
+        node->value = entries[mid].second;
+        point(node->left, build(entries, lo, mid));
+        point(node->right, build(entries, mid + 1, hi));
+        return node;
+    }
+
+    Node *allocate()
+    {
+        Header *h = header();
+        if (Node *node = follow(h->free_list))
+        {
+            point(h->free_list, follow(node->left));
+            return node;
+        }
+        if (h->used == h->capacity)
+            throw std::length_error("SharedTree file is full");
+        return reinterpret_cast<Node *>(base + nodes_offset + h->used++ * sizeof(Node));
+    }
+
+    // Free nodes are chained through their left links.
+    void release(Node *node)
+    {
+        Header *h = header();
+        point(node->left, follow(h->free_list));
+        point(h->free_list, node);
+    }
+
+    void format(uint64_t capacity)
+    {
+        Header *h = new (base) Header{};
+        std::memcpy(h->magic, "BTREESHM", 8);
+        h->key_size = sizeof(K);
+        h->value_size = sizeof(V);
+        h->capacity = capacity;
+    }
+
+    void check(const std::string &path)
+    {
+        const Header *h = header();
+        if (mapped_size < nodes_offset || std::memcmp(h->magic, "BTREESHM", 8) != 0 || h->key_size != sizeof(K) ||
+            h->value_size != sizeof(V) || nodes_offset + h->capacity * sizeof(Node) > mapped_size)
+            throw std::runtime_error(path + " is not a SharedTree file of this type");
+    }
+
+    void require_writable() const
+    {
+        if (!writable)
+            throw std::logic_error("SharedTree opened read only");
+    }
+
+    bool writable;
+    int fd;
+    char *base = nullptr;
+    size_t mapped_size = 0;
+};
+
+#endif // TREE_SHARED_HPP
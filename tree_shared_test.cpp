@@ -0,0 +1,171 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "tree_shared.hpp"
+
+TEST(SharedTest, PersistsAcrossOpens)
+{
+    std::string path = testing::TempDir() + "tree_shared_test.bin";
+    std::remove(path.c_str());
+    std::map<uint64_t, uint64_t> m;
+    {
+        SharedTree<uint64_t, uint64_t> t(path, SharedTree<uint64_t, uint64_t>::read_write, 3000);
+        EXPECT_THROW((SharedTree<uint64_t, uint64_t>(path, SharedTree<uint64_t, uint64_t>::read_write)),
+                     std::runtime_error);
+        std::mt19937_64 rng(8);
+        for (int i = 0; i < 20000; i++)
+        {
+            uint64_t k = rng() % 2000;
+            if (rng() % 3 == 0)
+            {
+                t.erase(k);
+                m.erase(k);
+            }
+            else
+            {
+                t.assign(k, i);
+                m[k] = i;
+            }
+        }
+        EXPECT_EQ(t.size(), m.size());
+        t.sync();
+    }
+
+    // Open it again, as a reader and then as the writer.
+    SharedTree<uint64_t, uint64_t> r(path, SharedTree<uint64_t, uint64_t>::read_only);
+    EXPECT_EQ(r.size(), m.size());
+    for (uint64_t k = 0; k < 2000; k++)
+    {
+        auto it = m.find(k);
+        if (it == m.end())
+            EXPECT_FALSE(r.contains(k));
+        else
+            EXPECT_EQ(r.get(k), it->second);
+    }
+    EXPECT_THROW(r.assign(1, 1), std::logic_error);
+
+    SharedTree<uint64_t, uint64_t> w(path, SharedTree<uint64_t, uint64_t>::read_write);
+    w.assign(5000, 7);
+    EXPECT_EQ(r.get(5000), 7u);
+    EXPECT_EQ(w.capacity(), 3000u);
+
+    // Fill it up.  Erased nodes get reused before it runs out.
+    EXPECT_THROW(
+        {
+            for (uint64_t k = 10000;; k++)
+                w.assign(k, k);
+        },
+        std::length_error);
+    EXPECT_EQ(w.size(), 3000u);
+    EXPECT_THROW((SharedTree<int, int>(path, SharedTree<int, int>::read_only)), std::runtime_error);
+    std::remove(path.c_str());
+}
+
+TEST(SharedTest, ReaderInAnotherProcess)
+{
+    std::string path = testing::TempDir() + "tree_shared_fork.bin";
+    std::remove(path.c_str());
+    SharedTree<uint32_t, uint64_t> w(path, SharedTree<uint32_t, uint64_t>::read_write, 1000);
+    for (uint32_t k = 0; k < 500; k++)
+        w.assign(k, k);
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0)
+    {
+        // Every value the writer stores is a multiple of its key,
+        // so a torn read would show up as one that isn't.
+        SharedTree<uint32_t, uint64_t> r(path, SharedTree<uint32_t, uint64_t>::read_only);
+        std::mt19937 rng(1);
+        int bad = 0;
+        for (int i = 0; i < 200000; i++)
+        {
+            uint32_t k = 1 + rng() % 499;
+            auto v = r.get(k);
+            bad += v && *v % k != 0;
+        }
+        _exit(bad ? 1 : 0);
+    }
+    std::mt19937 rng(2);
+    for (uint64_t round = 1; round < 300; round++)
+    {
+        for (uint32_t k = 1; k < 500; k++)
+        {
+            if (rng() % 4 == 0)
+                w.erase(k);
+            else
+                w.assign(k, k * round);
+        }
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+    std::remove(path.c_str());
+}
+
+// Flips the sequence number in the file's header between even and
+// odd, which is what a writer dying part way through a change
+// leaves behind.
+static void flip_sequence(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    uint64_t seq;
+    const off_t at = 32; // After the magic and the three sizes.
+    ASSERT_EQ(pread(fd, &seq, sizeof seq, at), ssize_t(sizeof seq));
+    seq++;
+    ASSERT_EQ(pwrite(fd, &seq, sizeof seq, at), ssize_t(sizeof seq));
+    close(fd);
+}
+
+TEST(SharedTest, RecoversFromADeadWriter)
+{
+    using Tree = SharedTree<uint64_t, uint64_t>;
+    std::string path = testing::TempDir() + "tree_shared_crash.bin";
+    std::remove(path.c_str());
+    {
+        Tree w(path, Tree::read_write, 2000);
+        for (uint64_t k = 0; k < 1000; k++)
+            w.assign(k, 3 * k);
+        for (uint64_t k = 0; k < 1000; k += 3)
+            w.erase(k);
+
+        // While the writer is alive, readers wait for it.
+        Tree r(path, Tree::read_only);
+        flip_sequence(path);
+        std::thread reader([&] { EXPECT_EQ(r.get(5), 15u); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        flip_sequence(path);
+        reader.join();
+        flip_sequence(path);
+    }
+
+    // Now it is gone for good.
+    Tree r(path, Tree::read_only);
+    EXPECT_THROW(r.get(5), std::runtime_error);
+    EXPECT_THROW((Tree(path, Tree::read_write)), std::runtime_error);
+
+    Tree w(path, Tree::recover);
+    EXPECT_EQ(w.size(), 666u);
+    for (uint64_t k = 0; k < 1000; k++)
+    {
+        if (k % 3 == 0)
+            EXPECT_FALSE(r.contains(k));
+        else
+            EXPECT_EQ(r.get(k), 3 * k);
+    }
+    w.assign(5000, 1);
+    w.erase(1);
+    EXPECT_EQ(r.get(5000), 1u);
+    EXPECT_FALSE(r.contains(1));
+    std::remove(path.c_str());
+}
@@ -0,0 +1,473 @@
+// A tree that keeps at most a set number of nodes in memory and
+// spills the rest to a local file.
+//
+// Every lookup or update stamps the nodes on its path with the
+// current operation count, so a node's stamp is the last time
+// anything in its subtree was touched.  When the tree grows past
+// its memory budget, the subtrees that have gone longest without
+// a touch are written out to the spill file, in key order, and
+// each is replaced in memory by a single stub node that records
+// where it went.  Going down into a stub later faults the subtree
+// back in (rebuilt balanced), while range scans that cross a stub
+// just stream its entries sequentially from the file without
+// bringing them back into memory.
+//
+// Keys and values have to be trivially copyable, since they are
+// written to the file as raw bytes.  Space a subtree leaves behind
+// when it is faulted back in (or spilled again inside a bigger one)
+// becomes a hole, merged with any holes next to it, and later
+// spills go into the smallest hole they fit, so a working set that
+// keeps moving in and out doesn't grow the file without end.
+
+#ifndef TREE_SPILL_HPP
+#define TREE_SPILL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+template <class K, class V>
+class SpillTree
+{
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "SpillTree stores keys and values as raw bytes");
+
+    struct Entry
+    {
+        K key;
+        V value;
+    };
+
+    struct Node
+    {
+        K key{};
+        V value{};
+        Node *left = nullptr;
+        Node *right = nullptr;
+        uint64_t touched = 0;
+        // For a stub, the spilled subtree's entries are count
+        // Entries starting at offset in the file.
+        bool stub = false;
+        uint64_t offset = 0;
+        uint64_t count = 0;
+    };
+
+public:
+    // budget is the most nodes to keep in memory.  Subtrees not
+    // touched in the last idle operations are spilled first.
+    SpillTree(const std::string &path, size_t budget, uint64_t idle = 1024)
+        : root(nullptr), budget(budget), idle(idle), clock(0), resident(0), total(0), file_end(0)
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            throw std::runtime_error("Can't create spill file " + path);
+    }
+    SpillTree(const SpillTree &) = delete;
+    SpillTree &operator=(const SpillTree &) = delete;
+    ~SpillTree()
+    {
+        free_subtree(root);
+        ::close(fd);
+    }
+
+    // A pointer to key's value, or null.  Good until the next call.
+    V *get(const K &key)
+    {
+        Node **link = find(key);
+        V *found = *link ? &(*link)->value : nullptr;
+        make_room();
+        return found;
+    }
+
+    bool contains(const K &key)
+    {
+        return get(key) != nullptr;
+    }
+
+    void assign(const K &key, const V &value)
+    {
+        Node **link = find(key);
+        if (!*link)
+        {
+            *link = new Node;
+            (*link)->key = key;
+            (*link)->touched = clock;
+            resident++;
+            total++;
+        }
+        (*link)->value = value;
+        make_room();
+    }
+
+    void erase(const K &key)
+    {
+        Node **link = find(key);
+        Node *node = *link;
+        if (!node)
+        {
+            make_room();
+            return;
+        }
+        if (!fault(node->left))
+        {
+            *link = fault(node->right);
+        }
+        else if (!fault(node->right))
+        {
+            *link = node->left;
+        }
+        else
+        {
+            // Swap in the largest key on the left, as BinaryTree does.
+            Node **pred = &node->left;
+            while (fault((*pred)->right))
+                pred = &(*pred)->right;
+            Node *moved = *pred;
+            node->key = moved->key;
+            node->value = moved->value;
+            *pred = moved->left;
+            node = moved;
+        }
+        delete node;
+        resident--;
+        total--;
+        make_room();
+    }
+
+    // Calls fn(key, value) for every key in [lo, hi), in order.
+    // Spilled subtrees are read straight from the file.
+    template <class F>
+    void scan(const K &lo, const K &hi, F fn)
+    {
+        scan_subtree(root, lo, hi, fn);
+    }
+
+    size_t size() const
+    {
+        return total;
+    }
+
+    // How many entries are in memory right now.
+    size_t in_memory() const
+    {
+        return resident;
+    }
+
+    // Spills cold subtrees until we are back under budget.  This
+    // happens by itself after every call, and never spills the
+    // nodes that call just went through.
+    //
+    // Finding the cold subtrees walks every node in memory, so once
+    // over budget it spills down to three quarters of it: the walk
+    // then comes round only after another quarter of the budget has
+    // been added or faulted in, which pays for it.
+    void make_room()
+    {
+        if (resident <= budget)
+            return;
+        size_t target = budget - budget / 4;
+        for (uint64_t window = idle; resident > target; window /= 2)
+        {
+            std::vector<std::pair<uint64_t, Node **>> cold;
+            collect_cold(&root, clock > window ? clock - window : 0, cold);
+            std::sort(cold.begin(), cold.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+            for (auto &[touched, link] : cold)
+            {
+                if (resident <= target)
+                    break;
+                spill(*link);
+            }
+            if (window == 0)
+                break;
+        }
+    }
+
+private:
+    // Walks down to key, faulting in stubs and stamping the path.
+    // Returns the link that holds (or would hold) key.
+    Node **find(const K &key)
+    {
+        clock++;
+        Node **link = &root;
+        while (fault(*link))
+        {
+            Node *node = *link;
+            node->touched = clock;
+            if (key < node->key)
+                link = &node->left;
+            else if (node->key < key)
+                link = &node->right;
+            else
+                break;
+        }
+        return link;
+    }
+
+    // If link is a stub, reads its subtree back in, builds it
+    // balanced and puts it in place of the stub.
+    Node *fault(Node *&link)
+    {
+        if (!link || !link->stub)
+            return link;
+        Node *stub = link;
+        std::vector<Entry> entries(stub->count);
+        read_entries(stub->offset, entries.data(), entries.size());
+        link = build(entries, 0, entries.size(), stub->touched);
+        resident += entries.size();
+        release(stub->offset, stub->count * sizeof(Entry));
+        delete stub;
+        return link;
+    }
+
+    Node *build(const std::vector<Entry> &entries, size_t lo, size_t hi, uint64_t touched)
+    {
+        if (lo == hi)
+            return nullptr;
+        size_t mid = lo + (hi - lo) / 2;
+        Node *node = new Node;
+        node->key = entries[mid].key;
+        node->value = entries[mid].value;
+        node->touched = touched;
+        node->left = build(entries, lo, mid, touched);
+        node->right = build(entries, mid + 1, hi, touched);
+        return node;
+    }
+
+    // Finds the biggest subtrees not touched since cutoff.  Like
+    // every walk over the whole tree here, this keeps its own stack
+    // rather than recursing, since a tree fed sorted keys is one
+    // long chain.
+    void collect_cold(Node **link, uint64_t cutoff, std::vector<std::pair<uint64_t, Node **>> &cold)
+    {
+        std::vector<Node **> todo{link};
+        while (!todo.empty())
+        {
+            link = todo.back();
+            todo.pop_back();
+            Node *node = *link;
+            if (!node || node->stub)
+                continue;
+            if (node->touched < cutoff)
+            {
+                cold.push_back({node->touched, link});
+                continue;
+            }
+            todo.push_back(&node->right);
+            todo.push_back(&node->left);
+        }
+    }
+
+    // Writes link's subtree to the file and puts a stub in its
+    // place.  Stubs already inside it are copied across from their
+    // old spot in the file, which is then free.
+    void spill(Node *&link)
+    {
+        std::vector<Entry> entries;
+        uint64_t touched = link->touched;
+        for_each_entry(link, [&](const K &key, const V &value) {
+            entries.push_back({key, value});
+            return true;
+        });
+        size_t bytes = entries.size() * sizeof(Entry);
+        uint64_t offset = allocate(bytes);
+        if (pwrite(fd, entries.data(), bytes, offset) != (ssize_t)bytes)
+        {
+            release(offset, bytes);
+            throw std::runtime_error("Short write to spill file");
+        }
+        Node *stub = new Node;
+        stub->stub = true;
+        stub->touched = touched;
+        stub->offset = offset;
+        stub->count = entries.size();
+        free_subtree(link);
+        link = stub;
+    }
+
+    // Finds room for bytes in the file: the smallest hole that
+    // holds it, or else the end.
+    uint64_t allocate(uint64_t bytes)
+    {
+        auto fit = holes_by_size.lower_bound({bytes, 0});
+        if (fit == holes_by_size.end())
+        {
+            file_end += bytes;
+            return file_end - bytes;
+        }
+        auto [size, offset] = *fit;
+        holes_by_size.erase(fit);
+        holes.erase(offset);
+        if (size > bytes)
+            add_hole(offset + bytes, size - bytes);
+        return offset;
+    }
+
+    // Gives bytes at offset back, merging them with the holes on
+    // either side.  A hole that reaches the end just moves the end
+    // back.
+    void release(uint64_t offset, uint64_t bytes)
+    {
+        auto next = holes.lower_bound(offset);
+        if (next != holes.end() && next->first == offset + bytes)
+        {
+            bytes += next->second;
+            holes_by_size.erase({next->second, next->first});
+            next = holes.erase(next);
+        }
+        if (next != holes.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset)
+            {
+                offset = prev->first;
+                bytes += prev->second;
+                holes_by_size.erase({prev->second, prev->first});
+                holes.erase(prev);
+            }
+        }
+        if (offset + bytes == file_end)
+            file_end = offset;
+        else
+            add_hole(offset, bytes);
+    }
+
+    void add_hole(uint64_t offset, uint64_t bytes)
+    {
+        holes[offset] = bytes;
+        holes_by_size.insert({bytes, offset});
+    }
+
+    // Calls fn on every entry of node's subtree in order, reading
+    // stubs from the file.  fn returns false to stop early, and
+    // so does this.
+    template <class F>
+    bool for_each_entry(Node *node, F fn)
+    {
+        std::vector<Node *> path;
+        while (true)
+        {
+            // Down the left side to a stub or the end...
+            while (node && !node->stub)
+            {
+                path.push_back(node);
+                node = node->left;
+            }
+            if (node && !stream(node, fn))
+                return false;
+            // ...then back up to the next node and across to its right.
+            if (path.empty())
+                return true;
+            node = path.back();
+            path.pop_back();
+            if (!fn(node->key, node->value))
+                return false;
+            node = node->right;
+        }
+    }
+
+    // Reads a stub's entries from the file, a chunk at a time.
+    template <class F>
+    bool stream(const Node *stub, F fn)
+    {
+        std::vector<Entry> chunk(std::min<uint64_t>(stub->count, 4096));
+        for (uint64_t done = 0; done < stub->count; done += chunk.size())
+        {
+            size_t n = std::min<uint64_t>(chunk.size(), stub->count - done);
+            read_entries(stub->offset + done * sizeof(Entry), chunk.data(), n);
+            for (size_t i = 0; i < n; i++)
+            {
+                if (!fn(chunk[i].key, chunk[i].value))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // The same walk, skipping the subtrees left of lo and stopping
+    // at hi.
+    template <class F>
+    bool scan_subtree(Node *node, const K &lo, const K &hi, F &fn)
+    {
+        auto in_range = [&](const K &key, const V &value) {
+            if (!(key < hi))
+                return false;
+            if (!(key < lo))
+                fn(key, value);
+            return true;
+        };
+        std::vector<Node *> path;
+        while (true)
+        {
+            while (node && !node->stub)
+            {
+                path.push_back(node);
+                node = lo < node->key ? node->left : nullptr;
+            }
+            if (node && !stream(node, in_range))
+                return false;
+            if (path.empty())
+                return true;
+            node = path.back();
+            path.pop_back();
+            if (!(node->key < hi))
+                return false;
+            if (!(node->key < lo))
+                fn(node->key, node->value);
+            node = node->right;
+        }
+    }
+
+    void read_entries(uint64_t offset, Entry *out, size_t count)
+    {
+        size_t bytes = count * sizeof(Entry);
+        if (pread(fd, out, bytes, offset) != (ssize_t)bytes)
+            throw std::runtime_error("Short read from spill file");
+    }
+
+    // Frees a subtree's nodes, stubs included.
+    void free_subtree(Node *node)
+    {
+        std::vector<Node *> todo;
+        if (node)
+            todo.push_back(node);
+        while (!todo.empty())
+        {
+            node = todo.back();
+            todo.pop_back();
+            if (node->left)
+                todo.push_back(node->left);
+            if (node->right)
+                todo.push_back(node->right);
+            if (node->stub)
+                release(node->offset, node->count * sizeof(Entry));
+            else
+                resident--;
+            delete node;
+        }
+    }
+
+    Node *root;
+    size_t budget;
+    uint64_t idle;
+    uint64_t clock;
+    size_t resident;
+    size_t total;
+    int fd;
+    uint64_t file_end;
+    // The free space below file_end, by offset (to merge neighbours)
+    // and by (size, offset) (to find the best fit).
+    std::map<uint64_t, uint64_t> holes;
+    std::set<std::pair<uint64_t, uint64_t>> holes_by_size;
+};
+
+#endif // TREE_SPILL_HPP
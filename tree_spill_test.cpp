@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <random>
+#include <pthread.h>
+#include "tree_spill.hpp"
+
+TEST(SpillTest, StaysInBudget)
+{
+    std::string path = testing::TempDir() + "tree_spill_test.bin";
+    SpillTree<uint64_t, uint64_t> t(path, 200, 64);
+    std::map<uint64_t, uint64_t> m;
+    std::mt19937_64 rng(9);
+    for (int i = 0; i < 5000; i++)
+    {
+        uint64_t k = rng() % 3000;
+        switch (rng() % 4)
+        {
+        case 0:
+            t.erase(k);
+            m.erase(k);
+            break;
+        case 1:
+            EXPECT_EQ(t.contains(k), m.count(k) == 1);
+            break;
+        default:
+            t.assign(k, i);
+            m[k] = i;
+        }
+        ASSERT_LE(t.in_memory(), 200u);
+        ASSERT_EQ(t.size(), m.size());
+    }
+    EXPECT_LT(t.in_memory(), t.size());
+
+    // Lookups fault spilled subtrees back in.
+    for (auto [k, v] : m)
+    {
+        uint64_t *found = t.get(k);
+        ASSERT_NE(found, nullptr);
+        EXPECT_EQ(*found, v);
+    }
+    EXPECT_EQ(t.get(5000), nullptr);
+
+    // Scans read spilled subtrees straight from the file.
+    std::vector<std::pair<uint64_t, uint64_t>> seen;
+    t.scan(500, 2500, [&](uint64_t k, uint64_t v) { seen.push_back({k, v}); });
+    std::vector<std::pair<uint64_t, uint64_t>> expect(m.lower_bound(500), m.lower_bound(2500));
+    EXPECT_EQ(seen, expect);
+    std::remove(path.c_str());
+}
+
+TEST(SpillTest, HotKeysStayInMemory)
+{
+    std::string path = testing::TempDir() + "tree_spill_hot.bin";
+    SpillTree<int, int> t(path, 100, 32);
+    for (int i = 0; i < 1000; i++)
+        t.assign(i, -i);
+    for (int round = 0; round < 50; round++)
+    {
+        for (int i = 0; i < 10; i++)
+            EXPECT_EQ(*t.get(i * 7), -i * 7);
+    }
+    EXPECT_LE(t.in_memory(), 100u);
+    size_t count = 0;
+    t.scan(0, 1000, [&](int k, int v) {
+        EXPECT_EQ(v, -k);
+        count++;
+    });
+    EXPECT_EQ(count, 1000u);
+    std::remove(path.c_str());
+}
+
+// Going over budget spills well below it, so the walk that looks
+// for cold subtrees doesn't run again on the very next insert.
+TEST(SpillTest, SpillsWellBelowBudget)
+{
+    std::string path = testing::TempDir() + "tree_spill_below.bin";
+    SpillTree<int, int> t(path, 100, 16);
+    int spills = 0;
+    size_t before = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        t.assign(i * 7919 % 1000, i);
+        if (t.in_memory() < before)
+        {
+            spills++;
+            EXPECT_LE(t.in_memory(), 75u);
+        }
+        before = t.in_memory();
+    }
+    EXPECT_GT(spills, 0);
+    std::remove(path.c_str());
+}
+
+// The same keys going out and coming back over and over reuse
+// the space they left, rather than growing the file each time.
+TEST(SpillTest, FileStaysBounded)
+{
+    std::string path = testing::TempDir() + "tree_spill_bounded.bin";
+    SpillTree<uint64_t, uint64_t> t(path, 100, 16);
+    const uint64_t n = 2000;
+    for (uint64_t k = 0; k < n; k++)
+        t.assign(k * 7919 % n, k);
+    std::mt19937_64 rng(3);
+    uintmax_t largest = 0;
+    for (int round = 0; round < 20; round++)
+    {
+        for (int i = 0; i < 1000; i++)
+            ASSERT_NE(t.get(rng() % n), nullptr);
+        largest = std::max(largest, std::filesystem::file_size(path));
+    }
+    // Every entry fits in n * 16 bytes; allow for holes too small
+    // to take the subtrees that come after them.
+    EXPECT_LT(largest, 4 * n * 16);
+    std::map<uint64_t, uint64_t> m;
+    t.scan(0, n, [&](uint64_t k, uint64_t v) { m[k] = v; });
+    EXPECT_EQ(m.size(), size_t(n));
+    std::remove(path.c_str());
+}
+
+// Runs fn on a thread with a small stack.
+template <class F>
+static void on_small_stack(F fn)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 256 * 1024);
+    pthread_t thread;
+    auto run = [](void *arg) -> void * {
+        (*static_cast<F *>(arg))();
+        return nullptr;
+    };
+    ASSERT_EQ(pthread_create(&thread, &attr, run, &fn), 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+}
+
+TEST(SpillTest, SortedKeysDontOverflowTheStack)
+{
+    // Sorted keys make the tree one long chain; scanning it, and
+    // finding and spilling the cold part of it, must not take
+    // stack in proportion.
+    std::string path = testing::TempDir() + "tree_spill_chain_test.bin";
+    on_small_stack([&] {
+        SpillTree<int, int> t(path, 20000, 1000);
+        for (int i = 0; i < 20000; i++)
+            t.assign(i, i * 2);
+        auto check = [&] {
+            int expect = 100;
+            t.scan(100, 19900, [&](int k, int v) {
+                EXPECT_EQ(k, expect++);
+                EXPECT_EQ(v, 2 * k);
+            });
+            EXPECT_EQ(expect, 19900);
+        };
+        check();
+        // One more key, off the chain's root, puts it over budget
+        // and spills everything below the root.
+        t.assign(-1, -2);
+        EXPECT_LT(t.in_memory(), 20000u);
+        check();
+    });
+    std::remove(path.c_str());
+}
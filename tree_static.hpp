@@ -0,0 +1,402 @@
+// A tree with room for at most N entries, all held inside the
+// object itself, for code that must never call the allocator.
+// The nodes are an array of N slots; they link to each other by
+// slot number, and freed slots go on a free list threaded through
+// the same array.  Nothing is ever allocated on the heap, not even
+// by the iterators, whose path is a fixed size array too.
+//
+// The tree is kept balanced as an AA tree (a red-black tree where
+// only right links may be red, stored as a level per node), so
+// every operation takes O(log N) steps however the keys arrive,
+// and the recursion depth is at most twice the log of N.
+//
+// Erasing a key with two children moves its successor's entry into
+// its slot, so pointers to values are only good until the next
+// erase.
+//
+// Inserting a new key into a full tree fails cleanly: operator[]
+// throws std::length_error, and insert() returns null for code
+// that can't afford exceptions.  Either way the tree is untouched.
+//
+// The object is big (N nodes), so give it a static or long lived
+// home rather than a small stack.
+
+#ifndef TREE_STATIC_HPP
+#define TREE_STATIC_HPP
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+template <class K, class V, size_t N>
+class StaticBinaryTree
+{
+    static_assert(N > 0 && N < std::numeric_limits<uint32_t>::max(), "StaticBinaryTree needs 1 to 2^32 - 2 slots");
+
+    // Slot numbers, as small as N allows.
+    using Index = std::conditional_t<(N < std::numeric_limits<uint16_t>::max()), uint16_t, uint32_t>;
+    static constexpr Index nil = std::numeric_limits<Index>::max();
+
+    // An AA tree of N nodes is at most this deep.
+    static constexpr size_t max_depth = 2 * std::bit_width(N) + 2;
+
+    struct Node
+    {
+        K key;
+        V value;
+        Index left;
+        Index right;
+        uint8_t level;
+    };
+
+    // A slot holds a live node, or the next free slot.  Nodes are
+    // only constructed when handed out.
+    union Slot
+    {
+        Slot()
+        {
+        }
+        ~Slot()
+        {
+        }
+        Index next;
+        Node node;
+    };
+
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using reference = std::pair<const K &, V &>;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() : tree(nullptr), depth(0)
+        {
+        }
+
+        reference operator*() const
+        {
+            Node &node = tree->node(path[depth - 1]);
+            return reference(node.key, node.value);
+        }
+
+        // Same walk as BinaryTreeIterator: the leftmost node of the
+        // right subtree if there is one, else back up out of the
+        // first left child.
+        Iterator &operator++()
+        {
+            Index at = path[depth - 1];
+            if (tree->node(at).right != nil)
+            {
+                descend(tree->node(at).right);
+                return *this;
+            }
+            depth--;
+            while (depth > 0 && tree->node(path[depth - 1]).right == at)
+                at = path[--depth];
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator was = *this;
+            ++*this;
+            return was;
+        }
+
+        bool operator==(const Iterator &other) const
+        {
+            return depth == other.depth && (depth == 0 || path[depth - 1] == other.path[depth - 1]);
+        }
+        bool operator==(std::default_sentinel_t) const
+        {
+            return depth == 0;
+        }
+
+    private:
+        friend class StaticBinaryTree;
+        explicit Iterator(StaticBinaryTree *tree) : tree(tree), depth(0)
+        {
+        }
+
+        void descend(Index at)
+        {
+            for (; at != nil; at = tree->node(at).left)
+                path[depth++] = at;
+        }
+
+        StaticBinaryTree *tree;
+        std::array<Index, max_depth> path;
+        size_t depth;
+    };
+
+    StaticBinaryTree() : root(nil), free_list(nil), fresh(0), count(0)
+    {
+    }
+    StaticBinaryTree(const StaticBinaryTree &) = delete;
+    StaticBinaryTree &operator=(const StaticBinaryTree &) = delete;
+    ~StaticBinaryTree()
+    {
+        if constexpr (!std::is_trivially_destructible_v<K> || !std::is_trivially_destructible_v<V>)
+            destroy(root);
+    }
+
+    // The value for key, inserting it with a default value if it
+    // isn't there.  Throws std::length_error if it isn't there and
+    // the tree is full.
+    V &operator[](const K &key)
+    {
+        V *value = insert(key);
+        if (!value)
+            throw std::length_error("StaticBinaryTree is full");
+        return *value;
+    }
+
+    // The same, but returns null instead of throwing when full.
+    V *insert(const K &key)
+    {
+        if (V *value = get(key))
+            return value;
+        if (full())
+            return nullptr;
+        Index added = nil;
+        root = insert(root, key, added);
+        count++;
+        return &node(added).value;
+    }
+
+    // A pointer to the value for key, or null if it isn't there.
+    V *get(const K &key)
+    {
+        Index at = root;
+        while (at != nil)
+        {
+            Node &n = node(at);
+            if (key < n.key)
+                at = n.left;
+            else if (n.key < key)
+                at = n.right;
+            else
+                return &n.value;
+        }
+        return nullptr;
+    }
+
+    bool contains(const K &key)
+    {
+        return get(key) != nullptr;
+    }
+
+    void erase(const K &key)
+    {
+        if (contains(key))
+        {
+            root = erase(root, key);
+            count--;
+        }
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    static constexpr size_t capacity()
+    {
+        return N;
+    }
+
+    bool full() const
+    {
+        return count == N;
+    }
+
+    Iterator begin()
+    {
+        Iterator it(this);
+        it.descend(root);
+        return it;
+    }
+    std::default_sentinel_t end()
+    {
+        return std::default_sentinel;
+    }
+
+    // An iterator at the first key that is not less than key.
+    Iterator lower_bound(const K &key)
+    {
+        Iterator it(this);
+        size_t keep = 0;
+        for (Index at = root; at != nil;)
+        {
+            Node &n = node(at);
+            it.path[it.depth++] = at;
+            if (n.key < key)
+            {
+                at = n.right;
+            }
+            else
+            {
+                keep = it.depth;
+                if (!(key < n.key))
+                    break;
+                at = n.left;
+            }
+        }
+        it.depth = keep;
+        return it;
+    }
+
+private:
+    Node &node(Index at)
+    {
+        return slots[at].node;
+    }
+
+    uint8_t level(Index at)
+    {
+        return at == nil ? 0 : node(at).level;
+    }
+
+    // Hands out a slot, reused ones first.  The caller has checked
+    // there is one.
+    Index allocate(const K &key)
+    {
+        Index at;
+        if (free_list != nil)
+        {
+            at = free_list;
+            free_list = slots[at].next;
+        }
+        else
+        {
+            at = Index(fresh++);
+        }
+        new (&slots[at].node) Node{key, V(), nil, nil, 1};
+        return at;
+    }
+
+    void release(Index at)
+    {
+        slots[at].node.~Node();
+        slots[at].next = free_list;
+        free_list = at;
+    }
+
+    void destroy(Index at)
+    {
+        if (at == nil)
+            return;
+        destroy(node(at).left);
+        destroy(node(at).right);
+        slots[at].node.~Node();
+    }
+
+    // A left link on the same level is a red left link: rotate it
+    // to the right.
+    Index skew(Index at)
+    {
+        if (at == nil)
+            return at;
+        Index left = node(at).left;
+        if (left == nil || node(left).level != node(at).level)
+            return at;
+        node(at).left = node(left).right;
+        node(left).right = at;
+        return left;
+    }
+
+    // Two right links in a row on the same level: rotate left and
+    // lift the middle node a level.
+    Index split(Index at)
+    {
+        if (at == nil)
+            return at;
+        Index right = node(at).right;
+        if (right == nil || node(right).right == nil || node(node(right).right).level != node(at).level)
+            return at;
+        node(at).right = node(right).left;
+        node(right).left = at;
+        node(right).level++;
+        return right;
+    }
+
+    // key isn't in the tree and there is a free slot.
+    Index insert(Index at, const K &key, Index &added)
+    {
+        if (at == nil)
+            return added = allocate(key);
+        if (key < node(at).key)
+            node(at).left = insert(node(at).left, key, added);
+        else
+            node(at).right = insert(node(at).right, key, added);
+        return split(skew(at));
+    }
+
+    // key is in the tree.
+    Index erase(Index at, const K &key)
+    {
+        Node &n = node(at);
+        if (key < n.key)
+        {
+            n.left = erase(n.left, key);
+        }
+        else if (n.key < key)
+        {
+            n.right = erase(n.right, key);
+        }
+        else if (n.left == nil && n.right == nil)
+        {
+            release(at);
+            return nil;
+        }
+        else
+        {
+            // Only leaves have no right child in an AA tree.  Swap
+            // the entry with its successor, which stays in order as
+            // the leftmost of the right subtree, and erase it there.
+            Index next = n.right;
+            while (node(next).left != nil)
+                next = node(next).left;
+            std::swap(n.key, node(next).key);
+            std::swap(n.value, node(next).value);
+            n.right = erase(n.right, key);
+        }
+
+        // Lower this level if a child dropped too far below it, then
+        // fix the red links that leaves on this level.
+        uint8_t should_be = std::min(level(node(at).left), level(node(at).right)) + 1;
+        if (should_be < node(at).level)
+        {
+            node(at).level = should_be;
+            if (should_be < level(node(at).right))
+                node(node(at).right).level = should_be;
+        }
+        at = skew(at);
+        node(at).right = skew(node(at).right);
+        if (node(at).right != nil)
+            node(node(at).right).right = skew(node(node(at).right).right);
+        at = split(at);
+        node(at).right = split(node(at).right);
+        return at;
+    }
+
+    std::array<Slot, N> slots;
+    Index root;
+    Index free_list;
+    // Slots from here on have never been used, so they needn't be
+    // put on the free list up front.
+    size_t fresh;
+    size_t count;
+};
+
+#endif // TREE_STATIC_HPP
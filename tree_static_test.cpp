@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include "tree_static.hpp"
+
+// Counts every trip to the allocator, so the tests can check the
+// tree never makes one.  The replacements are kept out of line so
+// the compiler doesn't pair up the malloc and free across them.
+// They replace the allocator for the whole program, which is why
+// these tests build into an executable of their own, and any
+// thread may allocate, hence the atomic count.
+static std::atomic<size_t> allocations = 0;
+
+[[gnu::noinline]] void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST(StaticTreeTest, MatchesMapWithoutAllocating)
+{
+    static StaticBinaryTree<uint32_t, uint64_t, 3000> t;
+    std::map<uint32_t, uint64_t> m;
+    std::mt19937_64 rng(2);
+    for (int i = 0; i < 200000; i++)
+    {
+        uint32_t k = rng() % 4000;
+        uint64_t v = rng();
+        size_t before = allocations;
+        if (rng() % 2)
+        {
+            uint64_t *found = t.insert(k);
+            size_t after = allocations;
+            if (m.count(k) || m.size() < 3000)
+            {
+                ASSERT_NE(found, nullptr);
+                *found = m[k] = v;
+            }
+            else
+            {
+                ASSERT_EQ(found, nullptr);
+                EXPECT_THROW(t[k], std::length_error);
+            }
+            ASSERT_EQ(after, before);
+        }
+        else
+        {
+            t.erase(k);
+            m.erase(k);
+            ASSERT_EQ(allocations, before);
+        }
+        ASSERT_EQ(t.size(), m.size());
+    }
+
+    size_t before = allocations;
+    auto it = m.begin();
+    for (auto [key, value] : t)
+    {
+        ASSERT_EQ(key, it->first);
+        ASSERT_EQ(value, it->second);
+        ++it;
+    }
+    EXPECT_TRUE(it == m.end());
+    for (uint32_t k = 0; k < 4001; k++)
+    {
+        auto lb = t.lower_bound(k);
+        auto mlb = m.lower_bound(k);
+        if (mlb == m.end())
+        {
+            ASSERT_TRUE(lb == t.end());
+        }
+        else
+        {
+            ASSERT_EQ((*lb).first, mlb->first);
+        }
+    }
+    EXPECT_EQ(allocations, before);
+}
+
+TEST(StaticTreeTest, FullTreeFailsCleanly)
+{
+    StaticBinaryTree<int, int, 100> t;
+    for (int i = 0; i < 100; i++)
+        t[i] = i;
+    EXPECT_TRUE(t.full());
+    EXPECT_EQ(t.insert(100), nullptr);
+    EXPECT_THROW(t[-1], std::length_error);
+    // Existing keys still work, and nothing changed.
+    t[50] = 500;
+    EXPECT_EQ(t.size(), 100u);
+    EXPECT_EQ(*t.get(50), 500);
+    EXPECT_FALSE(t.contains(100));
+    // Room again after an erase, reusing the freed slot.
+    t.erase(7);
+    t[1000] = 1;
+    EXPECT_TRUE(t.contains(1000));
+    EXPECT_FALSE(t.contains(7));
+    // Keys added in order still leave a shallow tree to walk.
+    int seen = 0, last = -1;
+    for (auto [key, value] : t)
+    {
+        EXPECT_LT(last, key);
+        last = key;
+        seen++;
+    }
+    EXPECT_EQ(seen, 100);
+}
+
+TEST(StaticTreeTest, OwnsItsValues)
+{
+    auto counter = std::make_shared<int>(0);
+    {
+        StaticBinaryTree<std::string, std::shared_ptr<int>, 64> t;
+        for (int i = 0; i < 64; i++)
+            t[std::to_string(i)] = counter;
+        for (int i = 0; i < 64; i += 3)
+            t.erase(std::to_string(i));
+        EXPECT_EQ(counter.use_count(), 1 + 64 - 22);
+    }
+    EXPECT_EQ(counter.use_count(), 1);
+}
@@ -0,0 +1,325 @@
+// A frozen, read only copy of a BinaryTree with no pointers at
+// all: the shape of the tree is a bit vector of about 2 bits per
+// node, and the keys and values sit in two plain arrays.
+//
+// The shape is Jacobson's level order encoding.  Go through the
+// tree breadth first, counting the missing children of the leaves
+// as nodes too, and write a 1 for every real node and a 0 for
+// every missing one; that is 2N + 1 bits.  Numbering the bits from
+// 1, if the real node at position p is the r'th 1 in the vector,
+// its children are at positions 2r and 2r + 1, its parent is at
+// select(p / 2), and its key and value are entry r - 1 of the
+// arrays, which are in the same breadth first order.
+//
+// rank() is a lookup in a small table of counts per 512 bits plus
+// a popcount; select() is a binary search over that same table.
+// Freezing always builds a balanced shape from the tree's sorted
+// entries, whatever shape the tree itself had, so lookups take
+// O(log N) steps.  Iteration is in key order.
+
+#ifndef TREE_SUCCINCT_HPP
+#define TREE_SUCCINCT_HPP
+
+#include <bit>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+// A bit vector with rank and select.
+class SuccinctBits
+{
+public:
+    void push_back(bool bit)
+    {
+        if (length % 64 == 0)
+            words.push_back(0);
+        words.back() |= uint64_t(bit) << (length % 64);
+        length++;
+    }
+
+    bool operator[](size_t i) const
+    {
+        return i < length && (words[i / 64] >> (i % 64) & 1);
+    }
+
+    // Builds the rank directory.  Call once all bits are in.
+    void finish()
+    {
+        blocks.assign(words.size() / words_per_block + 1, 0);
+        uint64_t total = 0;
+        for (size_t w = 0; w < words.size(); w++)
+        {
+            if (w % words_per_block == 0)
+                blocks[w / words_per_block] = total;
+            total += std::popcount(words[w]);
+        }
+        if (words.size() % words_per_block == 0)
+            blocks.back() = total;
+    }
+
+    // How many 1s there are before bit i.
+    size_t rank(size_t i) const
+    {
+        size_t w = i / 64;
+        size_t count = blocks[w / words_per_block];
+        for (size_t j = w / words_per_block * words_per_block; j < w; j++)
+            count += std::popcount(words[j]);
+        if (i % 64)
+            count += std::popcount(words[w] & ((uint64_t(1) << (i % 64)) - 1));
+        return count;
+    }
+
+    // Where the k'th 1 is (k counting from 1).
+    size_t select(size_t k) const
+    {
+        // The last block that starts with fewer than k 1s before it.
+        size_t lo = 0, hi = blocks.size();
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (blocks[mid] < k)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        k -= blocks[lo];
+        size_t w = lo * words_per_block;
+        while (size_t(std::popcount(words[w])) < k)
+            k -= std::popcount(words[w++]);
+        uint64_t word = words[w];
+        for (; k > 1; k--)
+            word &= word - 1;
+        return w * 64 + std::countr_zero(word);
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    size_t memory_bytes() const
+    {
+        return words.size() * sizeof(uint64_t) + blocks.size() * sizeof(uint64_t);
+    }
+
+private:
+    static constexpr size_t words_per_block = 8;
+
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> blocks;
+    size_t length = 0;
+};
+
+template <class K, class V>
+class SuccinctTree
+{
+public:
+    // Walks the entries in key order.  Positions are numbered from
+    // 1 as in the comment at the top; 0 is the end.
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<K, V>;
+        using reference = std::pair<const K &, const V &>;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() : tree(nullptr), pos(0)
+        {
+        }
+
+        reference operator*() const
+        {
+            size_t i = tree->index(pos);
+            return reference(tree->keys[i], tree->values[i]);
+        }
+
+        Iterator &operator++()
+        {
+            pos = tree->next(pos);
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            Iterator was = *this;
+            ++*this;
+            return was;
+        }
+
+        bool operator==(const Iterator &other) const
+        {
+            return pos == other.pos;
+        }
+        bool operator==(std::default_sentinel_t) const
+        {
+            return pos == 0;
+        }
+
+    private:
+        friend class SuccinctTree;
+        Iterator(const SuccinctTree *tree, size_t pos) : tree(tree), pos(pos)
+        {
+        }
+
+        const SuccinctTree *tree;
+        size_t pos;
+    };
+
+    // Freezes a copy of tree.
+    explicit SuccinctTree(BinaryTree<K, V> &tree)
+    {
+        std::vector<K> sorted_keys(tree.size());
+        std::vector<V> sorted_values(tree.size());
+        tree.export_columns(sorted_keys.data(), sorted_values.data());
+        build(sorted_keys, sorted_values);
+    }
+
+    const V *get(const K &key) const
+    {
+        size_t pos = 1;
+        while (real(pos))
+        {
+            size_t r = bits.rank(pos + 1);
+            const K &here = keys[r - 1];
+            if (key < here)
+                pos = 2 * r;
+            else if (here < key)
+                pos = 2 * r + 1;
+            else
+                return &values[r - 1];
+        }
+        return nullptr;
+    }
+
+    bool contains(const K &key) const
+    {
+        return get(key) != nullptr;
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+    Iterator begin() const
+    {
+        return Iterator(this, real(1) ? leftmost(1) : 0);
+    }
+    std::default_sentinel_t end() const
+    {
+        return std::default_sentinel;
+    }
+
+    // The first entry whose key is not less than key.
+    Iterator lower_bound(const K &key) const
+    {
+        size_t pos = 1, found = 0;
+        while (real(pos))
+        {
+            size_t r = bits.rank(pos + 1);
+            const K &here = keys[r - 1];
+            if (here < key)
+            {
+                pos = 2 * r + 1;
+            }
+            else
+            {
+                found = pos;
+                if (!(key < here))
+                    break;
+                pos = 2 * r;
+            }
+        }
+        return Iterator(this, found);
+    }
+
+    // Bytes used by the shape, and by the keys and values.
+    size_t shape_bytes() const
+    {
+        return bits.memory_bytes();
+    }
+    size_t memory_bytes() const
+    {
+        return shape_bytes() + keys.size() * sizeof(K) + values.size() * sizeof(V);
+    }
+
+private:
+    // Lays the sorted entries out as a balanced tree, breadth first.
+    void build(std::vector<K> &sorted_keys, std::vector<V> &sorted_values)
+    {
+        keys.reserve(sorted_keys.size());
+        values.reserve(sorted_values.size());
+        // Each entry is a range of the sorted entries still to place;
+        // an empty one is a missing child.
+        std::vector<std::pair<size_t, size_t>> level{{0, sorted_keys.size()}}, next;
+        // Position 0 is unused, so bit p is position p.
+        bits.push_back(false);
+        while (!level.empty())
+        {
+            next.clear();
+            for (auto [lo, hi] : level)
+            {
+                bits.push_back(lo < hi);
+                if (lo == hi)
+                    continue;
+                size_t mid = lo + (hi - lo) / 2;
+                keys.push_back(std::move(sorted_keys[mid]));
+                values.push_back(std::move(sorted_values[mid]));
+                next.push_back({lo, mid});
+                next.push_back({mid + 1, hi});
+            }
+            level.swap(next);
+        }
+        bits.finish();
+    }
+
+    bool real(size_t pos) const
+    {
+        return bits[pos];
+    }
+
+    // Where pos's entry is in the arrays.  rank() counts the 1s
+    // before a bit, so the 1s up to and including pos are
+    // rank(pos + 1).
+    size_t index(size_t pos) const
+    {
+        return bits.rank(pos + 1) - 1;
+    }
+
+    size_t leftmost(size_t pos) const
+    {
+        while (true)
+        {
+            size_t left = 2 * bits.rank(pos + 1);
+            if (!real(left))
+                return pos;
+            pos = left;
+        }
+    }
+
+    size_t parent(size_t pos) const
+    {
+        return bits.select(pos / 2);
+    }
+
+    // The in-order successor of pos, or 0.
+    size_t next(size_t pos) const
+    {
+        size_t right = 2 * bits.rank(pos + 1) + 1;
+        if (real(right))
+            return leftmost(right);
+        // Up past every node we are the right child of.
+        while (pos != 1 && pos % 2 == 1)
+            pos = parent(pos);
+        return pos == 1 ? 0 : parent(pos);
+    }
+
+    SuccinctBits bits;
+    std::vector<K> keys;
+    std::vector<V> values;
+};
+
+#endif // TREE_SUCCINCT_HPP
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "tree_succinct.hpp"
+
+TEST(SuccinctTest, RankAndSelect)
+{
+    SuccinctBits bits;
+    std::vector<size_t> ones;
+    std::mt19937_64 rng(6);
+    for (size_t i = 0; i < 5000; i++)
+    {
+        bool bit = rng() % 3 == 0;
+        bits.push_back(bit);
+        if (bit)
+            ones.push_back(i);
+    }
+    bits.finish();
+    size_t count = 0;
+    for (size_t i = 0; i <= bits.size(); i++)
+    {
+        ASSERT_EQ(bits.rank(i), count);
+        if (i < bits.size() && bits[i])
+            count++;
+    }
+    for (size_t k = 1; k <= ones.size(); k++)
+        ASSERT_EQ(bits.select(k), ones[k - 1]);
+}
+
+TEST(SuccinctTest, MatchesTree)
+{
+    for (int n : {0, 1, 2, 3, 511, 512, 513, 20000})
+    {
+        BinaryTree<uint64_t, std::string> b;
+        std::map<uint64_t, std::string> m;
+        std::mt19937_64 rng(n);
+        while ((int)m.size() < n)
+        {
+            uint64_t k = rng() % (4 * n) * 2;
+            b[k] = m[k] = std::to_string(k);
+        }
+        SuccinctTree<uint64_t, std::string> s(b);
+        EXPECT_EQ(s.size(), m.size());
+        // About 2 bits per node of shape, and a bit for rank.
+        EXPECT_LE(s.shape_bytes(), 48 + m.size() * 5 / 16);
+
+        auto it = m.begin();
+        for (auto [key, value] : s)
+        {
+            ASSERT_EQ(key, it->first);
+            ASSERT_EQ(value, it->second);
+            ++it;
+        }
+        EXPECT_TRUE(it == m.end());
+
+        for (uint64_t k = 0; k < uint64_t(8 * n + 4); k++)
+        {
+            const std::string *found = s.get(k);
+            auto expect = m.find(k);
+            ASSERT_EQ(found != nullptr, expect != m.end());
+            if (found)
+            {
+                EXPECT_EQ(*found, expect->second);
+            }
+            auto lb = s.lower_bound(k);
+            auto mlb = m.lower_bound(k);
+            if (mlb == m.end())
+            {
+                ASSERT_TRUE(lb == s.end());
+            }
+            else
+            {
+                ASSERT_EQ((*lb).first, mlb->first);
+            }
+        }
+    }
+}
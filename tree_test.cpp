@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <string>
 #include <algorithm>
+#include <map>
 #include <random>
 #include <ranges>
 #include "tree.hpp"
@@ -51,3 +52,252 @@ TEST(TreeTest, BasicTests)
     EXPECT_EQ(b["fubar"], 43);
     EXPECT_EQ(b["baz"], 62);
 }
+
+TEST(TreeTest, Compact)
+{
+    auto rng = std::default_random_engine{};
+    std::vector<int> keys(1000);
+    for (int i = 0; i < 1000; i++)
+        keys[i] = i;
+    for (auto layout : {BinaryTreeLayout::depth_first, BinaryTreeLayout::van_emde_boas})
+    {
+        BinaryTree<int, std::string> b;
+        b.compact(layout);
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (auto k : keys)
+            b[k] = std::to_string(k);
+        for (int k = 0; k < 1000; k += 3)
+            b.erase(k);
+        b.compact(layout);
+
+        int count = 0;
+        for (const auto &[key, value] : b)
+        {
+            EXPECT_NE(key % 3, 0);
+            EXPECT_EQ(value, std::to_string(key));
+            count++;
+        }
+        EXPECT_EQ(count, 666);
+
+        // And the tree is still fully usable afterwards.
+        b[0] = "zero";
+        b.erase(1);
+        EXPECT_TRUE(b.contains(0));
+        EXPECT_FALSE(b.contains(1));
+        EXPECT_EQ(b[2], "2");
+    }
+}
+
+TEST(TreeTest, ModificationDuringIteration)
+{
+    BinaryTree<int, int> b;
+    for (int i = 0; i < 10; i++)
+        b[i] = i;
+    EXPECT_EQ(b.size(), 10u);
+
+    // Changing values is fine...
+    for (auto it = b.begin(); it != b.end(); ++it)
+    {
+        b[(*it).first] = 0;
+    }
+#if TREE_CHECK_ITERATORS
+    // ...but adding or removing keys is caught.
+    EXPECT_THROW(
+        for (const auto &[key, value] : b) {
+            (void)value;
+            b.erase(key);
+        },
+        std::logic_error);
+    EXPECT_THROW(
+        for (const auto &[key, value] : b) {
+            (void)value;
+            b[key + 100] = 1;
+        },
+        std::logic_error);
+#endif
+}
+
+TEST(TreeTest, EraseIf)
+{
+    BinaryTree<int, int> b;
+    EXPECT_EQ(b.erase_if([](const int &, int &) { return true; }), 0u);
+    for (int i = 0; i < 1000; i++)
+        b[(i * 7919) % 1000] = i;
+    auto removed = b.erase_if([](const int &key, int &value) {
+        value = -key;
+        return key % 2 == 0;
+    });
+    EXPECT_EQ(removed, 500u);
+    EXPECT_EQ(b.size(), 500u);
+    int expect = 1;
+    for (const auto &[key, value] : b)
+    {
+        EXPECT_EQ(key, expect);
+        EXPECT_EQ(value, -key);
+        expect += 2;
+    }
+    EXPECT_EQ(expect, 1001);
+    EXPECT_FALSE(b.contains(0));
+    EXPECT_TRUE(b.contains(999));
+}
+
+TEST(TreeTest, RangesAndIteratorConcepts)
+{
+    static_assert(std::bidirectional_iterator<BinaryTreeIterator<std::string, int>>);
+    static_assert(std::sentinel_for<std::default_sentinel_t, BinaryTreeIterator<std::string, int>>);
+    static_assert(std::ranges::bidirectional_range<BinaryTree<std::string, int>>);
+
+    BinaryTree<int, int> b;
+    EXPECT_TRUE(b.begin() == b.end());
+    EXPECT_TRUE(b.begin() == b.iterator_end());
+    for (int i = 0; i < 20; i++)
+        b[(i * 7) % 20] = i;
+
+    // A pipeline straight over the tree.
+    std::vector<int> evens;
+    for (int k : b | std::views::filter([](auto kv) { return kv.first % 2 == 0; })
+                   | std::views::transform([](auto kv) { return kv.first; })
+                   | std::views::take(3))
+    {
+        evens.push_back(k);
+    }
+    EXPECT_EQ(evens, std::vector<int>({0, 2, 4}));
+    EXPECT_EQ(std::ranges::distance(b), 20);
+
+    // Values can be changed through the iterator.
+    for (auto [key, value] : b)
+        value = key * 10;
+    EXPECT_EQ(b[7], 70);
+
+    // Forwards and backwards.
+    auto it = b.begin();
+    auto first = it++;
+    EXPECT_EQ((*first).first, 0);
+    EXPECT_EQ((*it).first, 1);
+    --it;
+    EXPECT_TRUE(it == first);
+    auto last = b.iterator_end();
+    --last;
+    EXPECT_EQ((*last).first, 19);
+    std::vector<int> backwards;
+    for (auto back = b.iterator_end(); back != b.begin();)
+    {
+        --back;
+        backwards.push_back((*back).first);
+    }
+    EXPECT_EQ(backwards.size(), 20u);
+    EXPECT_TRUE(std::is_sorted(backwards.rbegin(), backwards.rend()));
+    EXPECT_THROW(*b.iterator_end(), std::logic_error);
+}
+
+TEST(TreeTest, DeepPathsSpillAndCopy)
+{
+    // Sorted inserts make a chain, so the paths here go well past
+    // the iterator's inline room and onto the heap.
+    BinaryTree<int, int> b;
+    for (int i = 0; i < 200; i++)
+        b[i] = i;
+    std::vector<int> forwards;
+    for (auto it = b.begin(); it != b.end();)
+    {
+        auto was = it++;
+        forwards.push_back((*was).first);
+    }
+    EXPECT_EQ(forwards.size(), 200u);
+    EXPECT_TRUE(std::is_sorted(forwards.begin(), forwards.end()));
+
+    // Copies taken deep down walk on independently.
+    auto deep = b.lower_bound(150);
+    auto copy = deep;
+    ++deep;
+    EXPECT_EQ((*copy).first, 150);
+    EXPECT_EQ((*deep).first, 151);
+    auto last = b.iterator_end();
+    --last;
+    EXPECT_EQ((*last).first, 199);
+    copy = last;
+    --copy;
+    EXPECT_EQ((*copy).first, 198);
+    EXPECT_EQ((*last).first, 199);
+}
+
+TEST(TreeTest, ExportColumns)
+{
+    for (int n : {0, 10, 100000})
+    for (unsigned threads : {1u, 4u})
+    {
+        BinaryTree<int, long> b;
+        for (int i = 0; i < n; i++)
+            b[(int)(((long)i * 7919) % n)] = i;
+        std::vector<int> keys(b.size());
+        std::vector<long> values(b.size());
+        EXPECT_EQ(b.export_columns(keys.data(), values.data(), threads), (size_t)n);
+        size_t i = 0;
+        for (const auto &[key, value] : b)
+        {
+            ASSERT_EQ(keys[i], key);
+            ASSERT_EQ(values[i], value);
+            i++;
+        }
+        EXPECT_EQ(i, (size_t)n);
+    }
+
+    BinaryTree<int, int> b;
+    for (int i = 0; i < 100; i += 2)
+        b[i] = -i;
+    EXPECT_EQ(b.count_range(11, 21), 5u);
+    std::vector<int> keys(5), values(5);
+    EXPECT_EQ(b.export_columns(keys.data(), values.data(), 11, 21), 5u);
+    EXPECT_EQ(keys, std::vector<int>({12, 14, 16, 18, 20}));
+    EXPECT_EQ(values[0], -12);
+    EXPECT_EQ(b.count_range(200, 300), 0u);
+}
+
+TEST(TreeTest, StringKeyPrefixes)
+{
+    // Keys that share long prefixes, differ only past byte 8,
+    // have embedded zeros or high bytes, or are prefixes of
+    // each other, all against std::map's ordering.
+    std::vector<std::string> keys = {"", "a", std::string("a\0", 2), "ab", "abcdefgh", "abcdefgh1", "abcdefgh2",
+                                     "abcdefgg", "abcdefgi", "\xff", "\x7f", "b", std::string(20, 'x'),
+                                     std::string(19, 'x'), "zzzzzzzzzzzzzzzzz"};
+    std::mt19937_64 rng(3);
+    std::map<std::string, int> m;
+    BinaryTree<std::string, int> b;
+    for (int i = 0; i < 2000; i++)
+    {
+        std::string k = keys[rng() % keys.size()] + keys[rng() % keys.size()];
+        if (rng() % 3 == 0)
+        {
+            b.erase(k);
+            m.erase(k);
+        }
+        else
+        {
+            b[k] = i;
+            m[k] = i;
+        }
+        ASSERT_EQ(b.size(), m.size());
+    }
+    auto it = m.begin();
+    for (const auto &[key, value] : b)
+    {
+        ASSERT_EQ(key, it->first);
+        ASSERT_EQ(value, it->second);
+        ++it;
+    }
+    for (const auto &a : keys)
+    {
+        for (const auto &c : keys)
+        {
+            std::string k = a + c;
+            EXPECT_EQ(b.contains(k), m.count(k) == 1);
+            auto lb = b.lower_bound(k);
+            auto mlb = m.lower_bound(k);
+            if (mlb == m.end())
+                EXPECT_TRUE(lb == b.end());
+            else
+                EXPECT_EQ((*lb).first, mlb->first);
+        }
+    }
+}